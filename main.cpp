@@ -1,19 +1,45 @@
 #include <iostream>
 #include <vector>
+#include <array>
 #include <string>
 #include <random>
 #include <chrono>
 #include <algorithm>
 #include <functional>
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <queue>
+#include <deque>
 #include <cmath>
 #include <sstream>
 #include <iomanip>
 #include <fstream>
 #include <memory>
+#include <cstring>
 #include <limits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <cerrno>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 #include <os>
 
 using namespace std;
@@ -79,42 +105,122 @@ double length(const Vec2 &v)
     return std::sqrt(static_cast<double>(v.x * v.x + v.y * v.y));
 }
 
+inline uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
 struct RNG
 {
-    mt19937_64 engine;
+    uint64_t key;
+    uint64_t counter;
 
     RNG()
     {
         seedWithTime();
     }
 
+    RNG(uint64_t k, uint64_t c)
+        : key(k), counter(c)
+    {
+    }
+
+    static RNG forEntity(uint64_t seed, uint64_t id, int tick, uint64_t purpose = 0)
+    {
+        uint64_t k = splitmix64(seed);
+        k = splitmix64(k ^ (id * 0xD1B54A32D192ED03ull));
+        k = splitmix64(k ^ (static_cast<uint64_t>(static_cast<uint32_t>(tick)) * 0xABC98388FB8FAC03ull));
+        return RNG(k ^ purpose, 0);
+    }
+
+    static uint64_t at(uint64_t key, uint64_t counter)
+    {
+        return splitmix64(key + counter * 0x9E3779B97F4A7C15ull);
+    }
+
     void seedWithTime()
     {
         auto now = chrono::high_resolution_clock::now().time_since_epoch().count();
-        engine.seed(static_cast<uint64_t>(now));
+        seed(static_cast<uint64_t>(now));
     }
 
     void seed(uint64_t value)
     {
-        engine.seed(value);
+        key = splitmix64(value);
+        counter = 0;
+    }
+
+    void skip(uint64_t n)
+    {
+        counter += n;
+    }
+
+    uint64_t next()
+    {
+        return at(key, counter++);
+    }
+
+    void fill(uint64_t *out, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            out[i] = at(key, counter + i);
+        }
+        counter += n;
+    }
+
+    void fillRange(double *out, size_t n, double a, double b)
+    {
+        double scale = (b - a) * 0x1.0p-53;
+        for (size_t i = 0; i < n; ++i)
+        {
+            out[i] = a + static_cast<double>(at(key, counter + i) >> 11) * scale;
+        }
+        counter += n;
+    }
+
+    void fillReal01(double *out, size_t n)
+    {
+        fillRange(out, n, 0.0, 1.0);
+    }
+
+    uint32_t bounded(uint32_t range)
+    {
+        uint64_t m = static_cast<uint64_t>(static_cast<uint32_t>(next())) * range;
+        uint32_t low = static_cast<uint32_t>(m);
+        if (low < range)
+        {
+            uint32_t threshold = static_cast<uint32_t>(-range) % range;
+            while (low < threshold)
+            {
+                m = static_cast<uint64_t>(static_cast<uint32_t>(next())) * range;
+                low = static_cast<uint32_t>(m);
+            }
+        }
+        return static_cast<uint32_t>(m >> 32);
     }
 
     int intInRange(int a, int b)
     {
-        uniform_int_distribution<int> dist(a, b);
-        return dist(engine);
+        uint32_t span = static_cast<uint32_t>(static_cast<int64_t>(b) - a + 1);
+        if (span == 0)
+        {
+            return static_cast<int>(static_cast<uint32_t>(next()));
+        }
+        return static_cast<int>(static_cast<int64_t>(a) + bounded(span));
     }
 
     double real01()
     {
-        uniform_real_distribution<double> dist(0.0, 1.0);
-        return dist(engine);
+        return static_cast<double>(next() >> 11) * 0x1.0p-53;
     }
 
     double realRange(double a, double b)
     {
-        uniform_real_distribution<double> dist(a, b);
-        return dist(engine);
+        return a + (b - a) * real01();
     }
 
     bool chance(double p)
@@ -134,7 +240,7 @@ struct RNG
     }
 };
 
-enum class CellType
+enum class CellType : uint8_t
 {
     Empty,
     Wall,
@@ -174,1592 +280,9513 @@ char cellTypeToChar(CellType t)
     }
 }
 
-struct Cell
+#if defined(GRID_FIXED_VALUES)
+struct CellValue
 {
-    CellType type;
-    double value1;
-    double value2;
+    int32_t raw;
+
+    CellValue(double v = 0.0) : raw(static_cast<int32_t>(lround(v * 65536.0))) {}
+
+    operator double() const
+    {
+        return static_cast<double>(raw) / 65536.0;
+    }
+
+    CellValue &operator+=(double v)
+    {
+        raw += static_cast<int32_t>(lround(v * 65536.0));
+        return *this;
+    }
 
-    Cell() : type(CellType::Empty), value1(0.0), value2(0.0) {}
+    CellValue &operator*=(double v)
+    {
+        raw = static_cast<int32_t>(lround(static_cast<double>(raw) * v));
+        return *this;
+    }
 };
+#else
+using CellValue = float;
+#endif
 
-class Grid
+struct GridRow
 {
+    const CellType *type;
+    CellValue *value1;
+    CellValue *value2;
     int width;
-    int height;
-    vector<Cell> data;
+};
+
+struct ConstGridRow
+{
+    const CellType *type;
+    const CellValue *value1;
+    const CellValue *value2;
+    int width;
+};
 
+class CellIndex
+{
 public:
-    Grid(int w = 0, int h = 0)
-        : width(w), height(h), data(static_cast<size_t>(w * h))
+    enum class Set : uint8_t
     {
-    }
+        Free,
+        Source,
+        Sink,
+        None
+    };
 
-    void resize(int w, int h)
-    {
-        width = w;
-        height = h;
-        data.assign(static_cast<size_t>(w * h), Cell{});
-    }
+private:
+    static const uint32_t kNoSlot = 0xFFFFFFFFu;
 
-    int getWidth() const
+    int width;
+    vector<uint32_t> members[3];
+    vector<uint32_t> slot;
+
+    vector<uint32_t> &of(Set s)
     {
-        return width;
+        return members[static_cast<size_t>(s)];
     }
 
-    int getHeight() const
+    const vector<uint32_t> &of(Set s) const
     {
-        return height;
+        return members[static_cast<size_t>(s)];
     }
 
-    bool inBounds(const Vec2 &p) const
+    void insert(Set s, uint32_t i)
     {
-        return p.x >= 0 && p.y >= 0 && p.x < width && p.y < height;
+        vector<uint32_t> &m = of(s);
+        slot[i] = static_cast<uint32_t>(m.size());
+        m.push_back(i);
     }
 
-    Cell &at(const Vec2 &p)
+    void erase(Set s, uint32_t i)
     {
-        return data[static_cast<size_t>(p.y * width + p.x)];
+        vector<uint32_t> &m = of(s);
+        uint32_t k = slot[i];
+        uint32_t last = m.back();
+        m[k] = last;
+        slot[last] = k;
+        m.pop_back();
+        slot[i] = kNoSlot;
     }
 
-    const Cell &at(const Vec2 &p) const
+public:
+    CellIndex()
+        : width(1)
     {
-        return data[static_cast<size_t>(p.y * width + p.x)];
     }
 
-    void fill(CellType t)
+    static Set setOf(CellType t)
     {
-        for (auto &c : data)
+        switch (t)
         {
-            c.type = t;
-            c.value1 = 0.0;
-            c.value2 = 0.0;
+        case CellType::Empty:
+        case CellType::Trail:
+        case CellType::MarkerA:
+        case CellType::MarkerB:
+        case CellType::MarkerC:
+            return Set::Free;
+        case CellType::Source:
+            return Set::Source;
+        case CellType::Sink:
+            return Set::Sink;
+        default:
+            return Set::None;
         }
     }
 
-    void forEach(function<void(const Vec2 &, Cell &)> fn)
+    void rebuild(const CellType *types, size_t n, int w)
     {
-        for (int y = 0; y < height; ++y)
+        width = max(w, 1);
+        for (auto &m : members)
+        {
+            m.clear();
+        }
+        slot.assign(n, static_cast<uint32_t>(kNoSlot));
+        for (size_t i = 0; i < n; ++i)
         {
-            for (int x = 0; x < width; ++x)
+            Set s = setOf(types[i]);
+            if (s != Set::None)
             {
-                Vec2 p(x, y);
-                fn(p, at(p));
+                insert(s, static_cast<uint32_t>(i));
             }
         }
     }
 
-    void forEach(function<void(const Vec2 &, const Cell &)> fn) const
+    void update(size_t i, CellType from, CellType to)
     {
-        for (int y = 0; y < height; ++y)
+        Set a = setOf(from);
+        Set b = setOf(to);
+        if (a == b)
         {
-            for (int x = 0; x < width; ++x)
-            {
-                Vec2 p(x, y);
-                fn(p, at(p));
-            }
+            return;
+        }
+        if (a != Set::None)
+        {
+            erase(a, static_cast<uint32_t>(i));
+        }
+        if (b != Set::None)
+        {
+            insert(b, static_cast<uint32_t>(i));
         }
     }
-};
 
-struct EntityId
-{
-    int value;
-    EntityId(int v = 0) : value(v) {}
-    bool operator==(const EntityId &o) const { return value == o.value; }
-    bool operator!=(const EntityId &o) const { return value != o.value; }
-    bool operator<(const EntityId &o) const { return value < o.value; }
-};
+    size_t size(Set s) const
+    {
+        return of(s).size();
+    }
 
-class World;
+    Vec2 at(Set s, size_t k) const
+    {
+        uint32_t i = of(s)[k];
+        return Vec2(static_cast<int>(i % static_cast<uint32_t>(width)), static_cast<int>(i / static_cast<uint32_t>(width)));
+    }
 
-class Entity
-{
-protected:
-    EntityId id;
-    Vec2 position;
-    bool alive;
+    Vec2 pick(Set s, RNG &rng) const
+    {
+        return at(s, static_cast<size_t>(rng.intInRange(0, static_cast<int>(size(s)) - 1)));
+    }
 
-public:
-    Entity(EntityId id_, const Vec2 &pos)
-        : id(id_), position(pos), alive(true)
+    void collect(Set s, vector<Vec2> &out) const
     {
+        out.clear();
+        for (size_t k = 0; k < size(s); ++k)
+        {
+            out.push_back(at(s, k));
+        }
     }
+};
 
-    virtual ~Entity() {}
+class Grid
+{
+    int width;
+    int height;
+    vector<CellType> types;
+    vector<uint64_t> walls;
+    vector<CellValue> values1;
+    vector<CellValue> values2;
+    uint64_t wallVersion;
+    CellIndex *index;
+
+    void reindex()
+    {
+        if (index)
+        {
+            index->rebuild(types.data(), types.size(), width);
+        }
+    }
 
-    EntityId getId() const
+    void writeWallBit(size_t i, bool wall)
     {
-        return id;
+        uint64_t bit = uint64_t(1) << (i & 63);
+        if (wall)
+        {
+            walls[i >> 6] |= bit;
+        }
+        else
+        {
+            walls[i >> 6] &= ~bit;
+        }
     }
 
-    const Vec2 &getPos() const
+public:
+    Grid(int w = 0, int h = 0) : width(0), height(0), wallVersion(0), index(nullptr)
     {
-        return position;
+        resize(w, h);
     }
 
-    void setPos(const Vec2 &p)
+    Grid(const Grid &o)
+        : width(o.width), height(o.height), types(o.types), walls(o.walls), values1(o.values1), values2(o.values2),
+          wallVersion(o.wallVersion), index(nullptr)
     {
-        position = p;
     }
 
-    bool isAlive() const
+    Grid(Grid &&o) noexcept
+        : width(o.width), height(o.height), types(move(o.types)), walls(move(o.walls)), values1(move(o.values1)),
+          values2(move(o.values2)), wallVersion(o.wallVersion), index(nullptr)
     {
-        return alive;
     }
 
-    void kill()
+    // Copies never share the source's CellIndex hook; an indexed grid takes new
+    // contents through swapContents, which keeps its own hook and reindexes.
+    Grid &operator=(const Grid &o)
     {
-        alive = false;
+        if (this != &o)
+        {
+            width = o.width;
+            height = o.height;
+            types = o.types;
+            walls = o.walls;
+            values1 = o.values1;
+            values2 = o.values2;
+            wallVersion = o.wallVersion;
+            index = nullptr;
+        }
+        return *this;
     }
 
-    virtual void update(World &world, double dt) = 0;
-    virtual char glyph() const = 0;
-};
+    Grid &operator=(Grid &&o) noexcept
+    {
+        if (this != &o)
+        {
+            width = o.width;
+            height = o.height;
+            types = move(o.types);
+            walls = move(o.walls);
+            values1 = move(o.values1);
+            values2 = move(o.values2);
+            wallVersion = o.wallVersion;
+            index = nullptr;
+        }
+        return *this;
+    }
 
-enum class EventType
-{
-    None,
-    Arrive,
-    Leave,
-    Ping,
-    Custom
-};
+    void attachIndex(CellIndex *ix)
+    {
+        index = ix;
+        reindex();
+    }
 
-struct Event
-{
-    EventType type;
-    EntityId from;
-    EntityId to;
-    string payload;
-    Vec2 pos;
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        size_t n = static_cast<size_t>(max(w, 0)) * static_cast<size_t>(max(h, 0));
+        types.assign(n, CellType::Empty);
+        walls.assign((n + 63) / 64, 0);
+        values1.assign(n, CellValue(0.0));
+        values2.assign(n, CellValue(0.0));
+        ++wallVersion;
+        reindex();
+    }
 
-    Event()
-        : type(EventType::None), from(0), to(0), payload(""), pos(0, 0)
+    uint64_t getWallVersion() const
     {
+        return wallVersion;
     }
 
-    Event(EventType t, EntityId f, EntityId tt, const string &pl, const Vec2 &p)
-        : type(t), from(f), to(tt), payload(pl), pos(p)
+    void markWallsChanged()
     {
+        ++wallVersion;
     }
-};
 
-class EventQueue
-{
-    vector<Event> events;
-    vector<Event> nextEvents;
+    int getWidth() const
+    {
+        return width;
+    }
 
-public:
-    void push(const Event &e)
+    int getHeight() const
     {
-        nextEvents.push_back(e);
+        return height;
     }
 
-    void flip()
+    size_t cellCount() const
     {
-        events.clear();
-        events.swap(nextEvents);
+        return types.size();
     }
 
-    const vector<Event> &getEvents() const
+    size_t memoryBytes() const
     {
-        return events;
+        return types.size() * sizeof(CellType) + walls.size() * sizeof(uint64_t) + (values1.size() + values2.size()) * sizeof(CellValue);
     }
 
-    void clear()
+    bool inBounds(const Vec2 &p) const
     {
-        events.clear();
-        nextEvents.clear();
+        return p.x >= 0 && p.y >= 0 && p.x < width && p.y < height;
     }
-};
 
-struct PathNode
-{
-    Vec2 pos;
-    double g;
-    double h;
-    double f;
-    int parentIndex;
-};
+    size_t indexOf(const Vec2 &p) const
+    {
+        return static_cast<size_t>(p.y) * static_cast<size_t>(width) + static_cast<size_t>(p.x);
+    }
 
-struct Pathfinding
-{
-    static bool neighbors(const Grid &grid, const Vec2 &p, vector<Vec2> &out)
+    CellType type(size_t i) const
     {
-        static const Vec2 dirs[4] = {
-            Vec2(1, 0),
-            Vec2(-1, 0),
-            Vec2(0, 1),
-            Vec2(0, -1)};
-        out.clear();
-        for (int i = 0; i < 4; ++i)
-        {
-            Vec2 q = p + dirs[i];
-            if (grid.inBounds(q))
-            {
-                const Cell &c = grid.at(q);
-                if (c.type != CellType::Wall)
-                {
-                    out.push_back(q);
-                }
-            }
-        }
-        return !out.empty();
+        return types[i];
     }
 
-    static double heuristic(const Vec2 &a, const Vec2 &b)
+    CellType type(const Vec2 &p) const
     {
-        return std::abs(a.x - b.x) + std::abs(a.y - b.y);
+        return types[indexOf(p)];
     }
 
-    static bool aStar(const Grid &grid, const Vec2 &start, const Vec2 &goal, vector<Vec2> &outPath)
+    void setType(size_t i, CellType t)
     {
-        outPath.clear();
-        if (!grid.inBounds(start) || !grid.inBounds(goal))
+        if (index)
         {
-            return false;
+            index->update(i, types[i], t);
         }
+        types[i] = t;
+        writeWallBit(i, t == CellType::Wall);
+    }
 
-        vector<PathNode> nodes;
-        nodes.reserve(1024);
+    void setType(const Vec2 &p, CellType t)
+    {
+        setType(indexOf(p), t);
+    }
 
-        auto cmp = [&](int lhs, int rhs)
-        {
-            return nodes[lhs].f > nodes[rhs].f;
-        };
+    bool isWall(size_t i) const
+    {
+        return (walls[i >> 6] >> (i & 63)) & 1;
+    }
 
-        vector<int> open;
-        vector<vector<int>> indexMap(grid.getHeight(), vector<int>(grid.getWidth(), -1));
-        vector<bool> closed;
+    bool isWall(const Vec2 &p) const
+    {
+        return isWall(indexOf(p));
+    }
 
-        nodes.push_back(PathNode{start, 0.0, heuristic(start, goal), heuristic(start, goal), -1});
-        open.push_back(0);
-        push_heap(open.begin(), open.end(), cmp);
-        indexMap[start.y][start.x] = 0;
-        closed.assign(1, false);
+    const uint64_t *wallBits() const
+    {
+        return walls.data();
+    }
 
-        vector<Vec2> neigh;
+    CellValue &value1(size_t i)
+    {
+        return values1[i];
+    }
 
-        while (!open.empty())
-        {
-            pop_heap(open.begin(), open.end(), cmp);
-            int currentIndex = open.back();
-            open.pop_back();
+    CellValue value1(size_t i) const
+    {
+        return values1[i];
+    }
 
-            if (closed[currentIndex])
-            {
-                continue;
-            }
-
-            PathNode &current = nodes[currentIndex];
-            closed[currentIndex] = true;
-
-            if (current.pos == goal)
-            {
-                int idx = currentIndex;
-                while (idx != -1)
-                {
-                    outPath.push_back(nodes[idx].pos);
-                    idx = nodes[idx].parentIndex;
-                }
-                reverse(outPath.begin(), outPath.end());
-                return true;
-            }
-
-            neighbors(grid, current.pos, neigh);
-            for (const Vec2 &nPos : neigh)
-            {
-                double tentativeG = current.g + 1.0;
-                int &mapIndex = indexMap[nPos.y][nPos.x];
-
-                if (mapIndex == -1)
-                {
-                    PathNode node;
-                    node.pos = nPos;
-                    node.g = tentativeG;
-                    node.h = heuristic(nPos, goal);
-                    node.f = node.g + node.h;
-                    node.parentIndex = currentIndex;
-
-                    int newIndex = static_cast<int>(nodes.size());
-                    nodes.push_back(node);
-                    closed.push_back(false);
-                    mapIndex = newIndex;
-                    open.push_back(newIndex);
-                    push_heap(open.begin(), open.end(), cmp);
-                }
-                else
-                {
-                    PathNode &existing = nodes[mapIndex];
-                    if (!closed[mapIndex] && tentativeG < existing.g)
-                    {
-                        existing.g = tentativeG;
-                        existing.f = existing.g + existing.h;
-                        existing.parentIndex = currentIndex;
-                        open.push_back(mapIndex);
-                        push_heap(open.begin(), open.end(), cmp);
-                    }
-                }
-            }
-        }
-
-        return false;
-    }
-};
-
-struct LSystemRule
-{
-    char from;
-    string to;
-};
-
-class LSystem
-{
-    string axiom;
-    vector<LSystemRule> rules;
-
-public:
-    void setAxiom(const string &a)
+    CellValue &value1(const Vec2 &p)
     {
-        axiom = a;
+        return values1[indexOf(p)];
     }
 
-    void addRule(char f, const string &t)
+    CellValue value1(const Vec2 &p) const
     {
-        rules.push_back(LSystemRule{f, t});
+        return values1[indexOf(p)];
     }
 
-    string generate(int iterations) const
+    CellValue &value2(size_t i)
     {
-        string current = axiom;
-        for (int i = 0; i < iterations; ++i)
-        {
-            string next;
-            next.reserve(current.size() * 2);
-            for (char c : current)
-            {
-                bool replaced = false;
-                for (const auto &r : rules)
-                {
-                    if (r.from == c)
-                    {
-                        next += r.to;
-                        replaced = true;
-                        break;
-                    }
-                }
-                if (!replaced)
-                {
-                    next.push_back(c);
-                }
-            }
-            current.swap(next);
-        }
-        return current;
+        return values2[i];
     }
-};
-
-class NoiseField
-{
-    int width;
-    int height;
-    vector<double> values;
 
-public:
-    NoiseField(int w = 0, int h = 0)
-        : width(w), height(h), values(static_cast<size_t>(w * h), 0.0)
+    CellValue value2(size_t i) const
     {
+        return values2[i];
     }
 
-    void resize(int w, int h)
+    CellValue &value2(const Vec2 &p)
     {
-        width = w;
-        height = h;
-        values.assign(static_cast<size_t>(w * h), 0.0);
+        return values2[indexOf(p)];
     }
 
-    double &at(int x, int y)
+    CellValue value2(const Vec2 &p) const
     {
-        return values[static_cast<size_t>(y * width + x)];
+        return values2[indexOf(p)];
     }
 
-    const double &at(int x, int y) const
+    void fill(CellType t)
     {
-        return values[static_cast<size_t>(y * width + x)];
+        fill_n(types.begin(), types.size(), t);
+        fill_n(walls.begin(), walls.size(), t == CellType::Wall ? ~uint64_t(0) : uint64_t(0));
+        fill_n(values1.begin(), values1.size(), CellValue(0.0));
+        fill_n(values2.begin(), values2.size(), CellValue(0.0));
+        ++wallVersion;
+        reindex();
     }
 
-    int getWidth() const
+    void swapContents(Grid &other)
     {
-        return width;
+        swap(width, other.width);
+        swap(height, other.height);
+        types.swap(other.types);
+        walls.swap(other.walls);
+        values1.swap(other.values1);
+        values2.swap(other.values2);
+        wallVersion = max(wallVersion, other.wallVersion) + 1;
+        other.wallVersion = wallVersion;
+        reindex();
+        other.reindex();
     }
 
-    int getHeight() const
+    template <typename Out>
+    void save(Out &out) const
     {
-        return height;
+        out.value(static_cast<int32_t>(width));
+        out.value(static_cast<int32_t>(height));
+        out.array(types);
+        out.array(values1);
+        out.array(values2);
     }
 
-    void generate(RNG &rng, int octaves, double persistence)
+    template <typename In>
+    bool load(In &in)
     {
-        if (width <= 0 || height <= 0)
-        {
-            return;
-        }
-
-        vector<double> base(values.size());
-        for (auto &v : base)
+        int32_t w = 0;
+        int32_t h = 0;
+        if (!in.value(w) || !in.value(h) || w < 0 || h < 0)
         {
-            v = rng.real01();
+            return false;
         }
-
-        for (int y = 0; y < height; ++y)
+        size_t n = static_cast<size_t>(w) * static_cast<size_t>(h);
+        if (!in.array(types, n) || !in.array(values1, n) || !in.array(values2, n))
         {
-            for (int x = 0; x < width; ++x)
-            {
-                at(x, y) = 0.0;
-            }
+            return false;
         }
-
-        double amplitude = 1.0;
-        double totalAmplitude = 0.0;
-
-        for (int octave = 0; octave < octaves; ++octave)
+        for (size_t i = 0; i < n; ++i)
         {
-            int step = max(1, (1 << octave));
-            for (int y = 0; y < height; ++y)
+            if (types[i] > CellType::Signal)
             {
-                int y0 = (y / step) * step;
-                int y1 = min(y0 + step, height - 1);
-                double fy = (step == 0) ? 0.0 : (double)(y - y0) / (double)max(step, 1);
-
-                for (int x = 0; x < width; ++x)
-                {
-                    int x0 = (x / step) * step;
-                    int x1 = min(x0 + step, width - 1);
-                    double fx = (step == 0) ? 0.0 : (double)(x - x0) / (double)max(step, 1);
-
-                    double v00 = base[static_cast<size_t>(y0 * width + x0)];
-                    double v10 = base[static_cast<size_t>(y0 * width + x1)];
-                    double v01 = base[static_cast<size_t>(y1 * width + x0)];
-                    double v11 = base[static_cast<size_t>(y1 * width + x1)];
-
-                    double v0 = v00 + (v10 - v00) * fx;
-                    double v1 = v01 + (v11 - v01) * fx;
-                    double v = v0 + (v1 - v0) * fy;
-
-                    at(x, y) += v * amplitude;
-                }
+                return false;
             }
-
-            totalAmplitude += amplitude;
-            amplitude *= persistence;
         }
-
-        if (totalAmplitude > 0.0)
+        width = w;
+        height = h;
+        walls.assign((n + 63) / 64, 0);
+        for (size_t i = 0; i < n; ++i)
         {
-            for (auto &v : values)
-            {
-                v /= totalAmplitude;
-            }
+            writeWallBit(i, types[i] == CellType::Wall);
         }
-    }
-};
-
-class World;
-
-class Agent : public Entity
-{
-protected:
-    Vec2 velocity;
-    double speed;
-    double phase;
-    RNG localRng;
-
-public:
-    Agent(EntityId id_, const Vec2 &pos)
-        : Entity(id_, pos), velocity(0, 0), speed(1.0), phase(0.0)
-    {
+        ++wallVersion;
+        reindex();
+        return true;
     }
 
-    void setSpeed(double s)
+    GridRow row(int y)
     {
-        speed = s;
+        size_t i = static_cast<size_t>(y) * static_cast<size_t>(width);
+        return GridRow{types.data() + i, values1.data() + i, values2.data() + i, width};
     }
 
-    virtual void onEvent(World &world, const Event &e) = 0;
-
-    void stepPosition(World &world, double dt);
-
-    virtual ~Agent() {}
-};
-
-class Wanderer : public Agent
-{
-public:
-    Wanderer(EntityId id_, const Vec2 &pos)
-        : Agent(id_, pos)
+    ConstGridRow row(int y) const
     {
-        speed = 1.0;
-        phase = localRng.realRange(0.0, 1000.0);
+        size_t i = static_cast<size_t>(y) * static_cast<size_t>(width);
+        return ConstGridRow{types.data() + i, values1.data() + i, values2.data() + i, width};
     }
 
-    void update(World &world, double dt) override;
-
-    char glyph() const override
+    template <typename F>
+    void forEach(F &&fn) const
     {
-        return 'w';
+        size_t i = 0;
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x, ++i)
+            {
+                fn(Vec2(x, y), i);
+            }
+        }
     }
 
-    void onEvent(World &world, const Event &e) override;
-};
-
-class Seeker : public Agent
-{
-    Vec2 target;
-    bool hasTarget;
-
-public:
-    Seeker(EntityId id_, const Vec2 &pos)
-        : Agent(id_, pos), target(0, 0), hasTarget(false)
+    template <typename F>
+    void forEachRow(F &&fn)
     {
-        speed = 2.0;
+        for (int y = 0; y < height; ++y)
+        {
+            fn(y, row(y));
+        }
     }
 
-    void setTarget(const Vec2 &t)
+    template <typename F>
+    void forEachRow(F &&fn) const
     {
-        target = t;
-        hasTarget = true;
+        for (int y = 0; y < height; ++y)
+        {
+            fn(y, row(y));
+        }
     }
 
-    void update(World &world, double dt) override;
-
-    char glyph() const override
+    template <typename F>
+    void forEachSpan(const Vec2 &lo, const Vec2 &hi, F &&fn)
     {
-        return 's';
+        int x0 = max(lo.x, 0);
+        int x1 = min(hi.x, width - 1);
+        int y0 = max(lo.y, 0);
+        int y1 = min(hi.y, height - 1);
+        if (x0 > x1)
+        {
+            return;
+        }
+        for (int y = y0; y <= y1; ++y)
+        {
+            GridRow r = row(y);
+            fn(Vec2(x0, y), GridRow{r.type + x0, r.value1 + x0, r.value2 + x0, x1 - x0 + 1});
+        }
     }
 
-    void onEvent(World &world, const Event &e) override;
-};
-
-class TrailMaker : public Agent
-{
-public:
-    TrailMaker(EntityId id_, const Vec2 &pos)
-        : Agent(id_, pos)
+    template <typename F>
+    void forEachSpan(const Vec2 &lo, const Vec2 &hi, F &&fn) const
     {
-        speed = 1.5;
+        int x0 = max(lo.x, 0);
+        int x1 = min(hi.x, width - 1);
+        int y0 = max(lo.y, 0);
+        int y1 = min(hi.y, height - 1);
+        if (x0 > x1)
+        {
+            return;
+        }
+        for (int y = y0; y <= y1; ++y)
+        {
+            ConstGridRow r = row(y);
+            fn(Vec2(x0, y), ConstGridRow{r.type + x0, r.value1 + x0, r.value2 + x0, x1 - x0 + 1});
+        }
     }
 
-    void update(World &world, double dt) override;
-
-    char glyph() const override
+    template <typename Pool, typename F>
+    void parallelForEachRow(Pool &pool, F &&fn)
     {
-        return 't';
+        size_t bands = min(pool.size() * 4, static_cast<size_t>(max(height, 0)));
+        if (bands == 0)
+        {
+            return;
+        }
+        size_t rows = (static_cast<size_t>(height) + bands - 1) / bands;
+        pool.parallelFor(bands, [&](size_t b)
+                         {
+                             int y0 = static_cast<int>(b * rows);
+                             int y1 = min(height, static_cast<int>((b + 1) * rows));
+                             for (int y = y0; y < y1; ++y)
+                             {
+                                 fn(y, row(y));
+                             }
+                         });
     }
-
-    void onEvent(World &world, const Event &e) override;
 };
 
-class SignalSource : public Agent
+struct EntityId
 {
-    double cooldown;
-    double timer;
+    uint32_t index;
+    uint32_t generation;
+    EntityId(uint32_t i = 0, uint32_t g = 0) : index(i), generation(g) {}
+    bool valid() const { return index != 0; }
+    uint64_t key() const { return (static_cast<uint64_t>(generation) << 32) | index; }
+    bool operator==(const EntityId &o) const { return index == o.index && generation == o.generation; }
+    bool operator!=(const EntityId &o) const { return !(*this == o); }
+    bool operator<(const EntityId &o) const { return key() < o.key(); }
+};
 
-public:
-    SignalSource(EntityId id_, const Vec2 &pos)
-        : Agent(id_, pos), cooldown(1.0), timer(0.0)
+inline ostream &operator<<(ostream &os, const EntityId &id)
+{
+    os << id.index;
+    if (id.generation != 0)
     {
-        speed = 0.0;
+        os << '.' << id.generation;
     }
+    return os;
+}
 
-    void update(World &world, double dt) override;
-
-    char glyph() const override
-    {
-        return 'o';
-    }
+class Entity;
 
-    void onEvent(World &world, const Event &e) override;
+enum class AgentKind
+{
+    Wanderer,
+    Seeker,
+    TrailMaker,
+    SignalSource,
+    SignalSink,
+    Count
 };
 
-class SignalSink : public Agent
+struct AgentColumns
 {
-public:
-    SignalSink(EntityId id_, const Vec2 &pos)
-        : Agent(id_, pos)
+    vector<EntityId> id;
+    vector<Vec2> position;
+    vector<Vec2> velocity;
+    vector<double> speed;
+    vector<double> phase;
+    vector<uint8_t> alive;
+    vector<Vec2> target;
+    vector<uint8_t> hasTarget;
+    vector<double> cooldown;
+    vector<double> timer;
+    vector<Entity *> facade;
+    size_t dead = 0;
+
+    size_t size() const
     {
-        speed = 0.0;
+        return id.size();
     }
 
-    void update(World &world, double dt) override;
-
-    char glyph() const override
+    size_t push(EntityId i, const Vec2 &p, Entity *owner)
     {
-        return 'x';
+        id.push_back(i);
+        position.push_back(p);
+        velocity.push_back(Vec2(0, 0));
+        speed.push_back(1.0);
+        phase.push_back(0.0);
+        alive.push_back(1);
+        target.push_back(Vec2(0, 0));
+        hasTarget.push_back(0);
+        cooldown.push_back(0.0);
+        timer.push_back(0.0);
+        facade.push_back(owner);
+        return id.size() - 1;
     }
 
-    void onEvent(World &world, const Event &e) override;
-};
-
-class Recorder
-{
-    vector<string> lines;
-    bool enabled;
-    size_t maxLines;
+    size_t pushFrom(AgentColumns &src, size_t r)
+    {
+        id.push_back(src.id[r]);
+        position.push_back(src.position[r]);
+        velocity.push_back(src.velocity[r]);
+        speed.push_back(src.speed[r]);
+        phase.push_back(src.phase[r]);
+        alive.push_back(src.alive[r]);
+        target.push_back(src.target[r]);
+        hasTarget.push_back(src.hasTarget[r]);
+        cooldown.push_back(src.cooldown[r]);
+        timer.push_back(src.timer[r]);
+        facade.push_back(src.facade[r]);
+        if (!src.alive[r])
+        {
+            ++dead;
+        }
+        return id.size() - 1;
+    }
 
-public:
-    Recorder()
-        : enabled(false), maxLines(2000)
+    void moveRow(size_t from, size_t to)
     {
+        id[to] = id[from];
+        position[to] = position[from];
+        velocity[to] = velocity[from];
+        speed[to] = speed[from];
+        phase[to] = phase[from];
+        alive[to] = alive[from];
+        target[to] = target[from];
+        hasTarget[to] = hasTarget[from];
+        cooldown[to] = cooldown[from];
+        timer[to] = timer[from];
+        facade[to] = facade[from];
     }
 
-    void setEnabled(bool e)
+    void truncate(size_t n)
     {
-        enabled = e;
+        id.resize(n);
+        position.resize(n);
+        velocity.resize(n);
+        speed.resize(n);
+        phase.resize(n);
+        alive.resize(n);
+        target.resize(n);
+        hasTarget.resize(n);
+        cooldown.resize(n);
+        timer.resize(n);
+        facade.resize(n);
     }
 
-    bool isEnabled() const
+    void clear()
     {
-        return enabled;
+        truncate(0);
+        dead = 0;
     }
 
-    void setMaxLines(size_t m)
+    template <typename Out>
+    void save(Out &out) const
     {
-        maxLines = m;
+        out.array(id);
+        out.array(position);
+        out.array(velocity);
+        out.array(speed);
+        out.array(phase);
+        out.array(alive);
+        out.array(target);
+        out.array(hasTarget);
+        out.array(cooldown);
+        out.array(timer);
     }
 
-    void log(const string &s)
+    template <typename In>
+    bool load(In &in)
     {
-        if (!enabled)
+        if (!in.array(id))
         {
-            return;
+            return false;
         }
-        if (lines.size() >= maxLines)
+        size_t n = id.size();
+        facade.assign(n, nullptr);
+        if (!in.array(position, n) || !in.array(velocity, n) || !in.array(speed, n) || !in.array(phase, n) ||
+            !in.array(alive, n) || !in.array(target, n) || !in.array(hasTarget, n) || !in.array(cooldown, n) ||
+            !in.array(timer, n))
         {
-            lines.erase(lines.begin());
+            return false;
         }
-        lines.push_back(s);
-    }
-
-    void saveToFile(const string &filename) const
-    {
-        ofstream out(filename);
-        for (const auto &line : lines)
+        for (size_t r = 0; r < n; ++r)
         {
-            out << line << "\n";
+            if (alive[r] > 1 || hasTarget[r] > 1 || !std::isfinite(speed[r]) || !std::isfinite(phase[r]) ||
+                !std::isfinite(cooldown[r]) || !std::isfinite(timer[r]))
+            {
+                return false;
+            }
         }
+        return true;
     }
 };
 
-struct Command
-{
-    string name;
-    vector<string> args;
-};
+class World;
 
-class CommandParser
+class Entity
 {
+protected:
+    EntityId id;
+    AgentColumns *cols;
+    size_t row;
+    unique_ptr<AgentColumns> ownColumns;
+
 public:
-    static Command parse(const string &line)
+    Entity(EntityId id_, const Vec2 &pos, AgentColumns *home = nullptr)
+        : id(id_), cols(home), row(0)
     {
-        Command cmd;
-        string token;
-        istringstream iss(line);
-        if (!(iss >> cmd.name))
-        {
-            cmd.name.clear();
-            return cmd;
-        }
-        while (iss >> token)
+        if (!cols)
         {
-            cmd.args.push_back(token);
+            ownColumns = make_unique<AgentColumns>();
+            cols = ownColumns.get();
         }
-        return cmd;
+        row = cols->push(id_, pos, this);
     }
-};
 
-struct WorldConfig
-{
-    int width;
-    int height;
-    int wanderers;
-    int seekers;
-    int trails;
-    int sources;
-    int sinks;
-    unsigned seed;
-};
+    virtual ~Entity() {}
 
-class World
-{
-    Grid grid;
-    NoiseField noise;
-    RNG rng;
-    vector<unique_ptr<Entity>> entities;
-    EventQueue events;
-    Recorder recorder;
-    int nextId;
-    int tick;
-    WorldConfig config;
-    vector<Vec2> cachedSources;
-    vector<Vec2> cachedSinks;
-    vector<Vec2> cachedEmptyCells;
-    bool running;
-    bool redrawRequired;
-    double timeAccum;
-    double timestep;
-    bool showOverlay;
-    bool showNoise;
-    bool showIds;
-    bool advancedMode;
-    vector<Vec2> debugPath;
+    EntityId getId() const
+    {
+        return id;
+    }
 
-public:
-    World()
-        : grid(0, 0),
-          noise(0, 0),
-          rng(),
-          nextId(1),
-          tick(0),
-          running(true),
-          redrawRequired(true),
-          timeAccum(0.0),
-          timestep(0.1),
-          showOverlay(true),
-          showNoise(false),
-          showIds(false),
-          advancedMode(true)
+    const Vec2 &getPos() const
     {
-        config.width = 60;
-        config.height = 24;
-        config.wanderers = 12;
-        config.seekers = 4;
-        config.trails = 6;
-        config.sources = 4;
-        config.sinks = 4;
-        config.seed = static_cast<unsigned>(chrono::high_resolution_clock::now().time_since_epoch().count());
+        return cols->position[row];
     }
 
-    void init()
+    void setPos(const Vec2 &p)
     {
-        rng.seed(config.seed);
-        grid.resize(config.width, config.height);
-        noise.resize(config.width, config.height);
-        grid.fill(CellType::Empty);
-        noise.generate(rng, 5, 0.5);
-        generateLayout();
-        spawnEntities();
-        rebuildCaches();
+        cols->position[row] = p;
     }
 
-    void generateLayout()
+    bool isAlive() const
     {
-        for (int y = 0; y < grid.getHeight(); ++y)
-        {
-            for (int x = 0; x < grid.getWidth(); ++x)
-            {
-                Vec2 p(x, y);
-                Cell &c = grid.at(p);
-                if (y == 0 || y == grid.getHeight() - 1 || x == 0 || x == grid.getWidth() - 1)
-                {
-                    c.type = CellType::Wall;
-                }
-                else
-                {
-                    double v = noise.at(x, y);
-                    if (v < 0.12)
-                    {
-                        c.type = CellType::Wall;
-                    }
-                    else if (v > 0.88)
-                    {
-                        c.type = CellType::MarkerC;
-                    }
-                    else if (v > 0.72)
-                    {
-                        c.type = CellType::MarkerB;
-                    }
-                    else if (v > 0.55)
-                    {
-                        c.type = CellType::MarkerA;
-                    }
-                    else
-                    {
-                        c.type = CellType::Empty;
-                    }
-                }
-                c.value1 = noise.at(x, y);
-                c.value2 = 0.0;
-            }
-        }
+        return cols->alive[row] != 0;
     }
 
-    void spawnEntities()
+    void kill()
     {
-        for (int i = 0; i < config.wanderers; ++i)
-        {
-            Vec2 p = randomEmptyCell();
-            addEntity(make_unique<Wanderer>(allocId(), p));
-        }
-        for (int i = 0; i < config.seekers; ++i)
-        {
-            Vec2 p = randomEmptyCell();
-            addEntity(make_unique<Seeker>(allocId(), p));
-        }
-        for (int i = 0; i < config.trails; ++i)
-        {
-            Vec2 p = randomEmptyCell();
-            addEntity(make_unique<TrailMaker>(allocId(), p));
-        }
-        for (int i = 0; i < config.sources; ++i)
-        {
-            Vec2 p = randomEmptyCell();
-            addEntity(make_unique<SignalSource>(allocId(), p));
-            grid.at(p).type = CellType::Source;
-        }
-        for (int i = 0; i < config.sinks; ++i)
+        if (cols->alive[row])
         {
-            Vec2 p = randomEmptyCell();
-            addEntity(make_unique<SignalSink>(allocId(), p));
-            grid.at(p).type = CellType::Sink;
+            cols->alive[row] = 0;
+            ++cols->dead;
         }
     }
 
-    void rebuildCaches()
+    AgentColumns &storage()
     {
-        cachedSources.clear();
-        cachedSinks.clear();
-        cachedEmptyCells.clear();
-        for (int y = 0; y < grid.getHeight(); ++y)
-        {
-            for (int x = 0; x < grid.getWidth(); ++x)
-            {
-                Vec2 p(x, y);
-                const Cell &c = grid.at(p);
-                if (c.type == CellType::Source)
-                {
-                    cachedSources.push_back(p);
-                }
-                else if (c.type == CellType::Sink)
-                {
-                    cachedSinks.push_back(p);
-                }
-                else if (c.type == CellType::Empty || c.type == CellType::Trail || c.type == CellType::MarkerA || c.type == CellType::MarkerB || c.type == CellType::MarkerC)
-                {
-                    cachedEmptyCells.push_back(p);
-                }
-            }
-        }
+        return *cols;
     }
 
-    Vec2 randomEmptyCell()
+    size_t storageRow() const
+    {
+        return row;
+    }
+
+    void bindStorage(AgentColumns *c, size_t r)
+    {
+        cols = c;
+        row = r;
+        ownColumns.reset();
+    }
+
+    virtual void update(World &world, double dt) = 0;
+    virtual char glyph() const = 0;
+};
+
+enum class EventType
+{
+    None,
+    Arrive,
+    Leave,
+    Ping,
+    Custom,
+    Count
+};
+
+inline unsigned eventBit(EventType t)
+{
+    return 1u << static_cast<unsigned>(t);
+}
+
+using PayloadId = uint16_t;
+
+class Payloads
+{
+    vector<string> names;
+    map<string, PayloadId> ids;
+
+    Payloads()
+    {
+        names.push_back("");
+        ids[""] = 0;
+    }
+
+    static Payloads &table()
+    {
+        static Payloads payloads;
+        return payloads;
+    }
+
+public:
+    static PayloadId intern(const string &name)
     {
-        if (cachedEmptyCells.empty())
+        Payloads &t = table();
+        auto it = t.ids.find(name);
+        if (it != t.ids.end())
         {
-            rebuildCaches();
+            return it->second;
         }
-        if (cachedEmptyCells.empty())
+        if (t.names.size() > numeric_limits<PayloadId>::max())
         {
-            return Vec2(1, 1);
+            throw runtime_error("payload table full");
         }
-        return rng.choice(cachedEmptyCells);
+        PayloadId id = static_cast<PayloadId>(t.names.size());
+        t.names.push_back(name);
+        t.ids.emplace(name, id);
+        return id;
     }
 
-    EntityId allocId()
+    static const string &name(PayloadId id)
     {
-        return EntityId(nextId++);
+        const Payloads &t = table();
+        static const string unknown = "?";
+        return id < t.names.size() ? t.names[id] : unknown;
     }
+};
 
-    void addEntity(unique_ptr<Entity> e)
-    {
-        entities.push_back(move(e));
-    }
+static const PayloadId kNoPayload = 0;
+static const PayloadId kSignalPayload = Payloads::intern("signal");
 
-    RNG &random()
+struct Event
+{
+    EventType type;
+    PayloadId payload;
+    int radius;
+    EntityId from;
+    EntityId to;
+    Vec2 pos;
+
+    Event()
+        : type(EventType::None), payload(kNoPayload), radius(0), from(0), to(0), pos(0, 0)
     {
-        return rng;
     }
 
-    Grid &getGrid()
+    Event(EventType t, EntityId f, EntityId tt, PayloadId pl, const Vec2 &p, int r = 0)
+        : type(t), payload(pl), radius(r), from(f), to(tt), pos(p)
     {
-        return grid;
     }
+};
 
-    const Grid &getGrid() const
+class EventQueue
+{
+    vector<Event> events;
+    vector<Event> nextEvents;
+
+public:
+    void push(const Event &e)
     {
-        return grid;
+        nextEvents.push_back(e);
     }
 
-    EventQueue &getEvents()
+    template <typename... Args>
+    void emplace(Args &&...args)
     {
-        return events;
+        nextEvents.emplace_back(std::forward<Args>(args)...);
     }
 
-    const EventQueue &getEvents() const
+    size_t capacity() const
     {
-        return events;
+        return events.capacity() + nextEvents.capacity();
     }
 
-    Recorder &getRecorder()
+    void flip()
     {
-        return recorder;
+        events.clear();
+        events.swap(nextEvents);
     }
 
-    bool isRunning() const
+    const vector<Event> &getEvents() const
     {
-        return running;
+        return events;
     }
 
-    void requestRedraw()
+    void clear()
     {
-        redrawRequired = true;
+        events.clear();
+        nextEvents.clear();
     }
 
-    void broadcast(const Event &e)
+    template <typename Out>
+    void save(Out &out) const
     {
-        events.push(e);
+        out.array(events);
+        out.array(nextEvents);
     }
 
-    void step(double dt)
+    template <typename In>
+    bool load(In &in)
     {
-        if (!running)
+        if (!in.array(events) || !in.array(nextEvents))
         {
-            return;
+            return false;
         }
-
-        timeAccum += dt;
-        while (timeAccum >= timestep)
+        for (const vector<Event> *queue : {&events, &nextEvents})
         {
-            tick++;
-            timeAccum -= timestep;
-            events.flip();
-
-            for (const Event &e : events.getEvents())
-            {
-                for (auto &ptr : entities)
-                {
-                    if (ptr && ptr->isAlive())
-                    {
-                        Agent *agent = dynamic_cast<Agent *>(ptr.get());
-                        if (agent)
-                        {
-                            agent->onEvent(*this, e);
-                        }
-                    }
-                }
-            }
-
-            for (auto &ptr : entities)
+            for (const Event &e : *queue)
             {
-                if (ptr && ptr->isAlive())
+                if (static_cast<unsigned>(e.type) >= static_cast<unsigned>(EventType::Count) || e.radius < 0)
                 {
-                    ptr->update(*this, timestep);
+                    return false;
                 }
             }
-
-            entities.erase(
-                remove_if(entities.begin(), entities.end(),
-                          [](const unique_ptr<Entity> &p)
-                          {
-                              return !p || !p->isAlive();
-                          }),
-                entities.end());
-
-            evaporateTrails();
-            redrawRequired = true;
         }
+        return true;
     }
+};
 
-    void evaporateTrails()
+class SpatialIndex
+{
+public:
+    struct Entry
     {
-        grid.forEach([&](const Vec2 &p, Cell &c)
-                     {
-                         if (c.type == CellType::Trail || c.type == CellType::Signal)
-                         {
-                             c.value2 += 0.02;
-                             if (c.value2 >= 1.0)
-                             {
-                                 c.type = CellType::Empty;
-                                 c.value2 = 0.0;
-                             }
-                         }
-                     });
-    }
+        EntityId id;
+        Vec2 pos;
+    };
 
-    void render(ostream &os)
+private:
+    struct Location
     {
-        if (!redrawRequired)
-        {
-            return;
-        }
+        int bucket;
+        int slot;
+    };
 
-        vector<string> lines;
-        lines.resize(static_cast<size_t>(grid.getHeight()));
-        for (int y = 0; y < grid.getHeight(); ++y)
+    int width;
+    int height;
+    int bucketShift;
+    int bucketsX;
+    int bucketsY;
+    size_t count;
+    vector<vector<Entry>> buckets;
+    vector<Location> locations;
+
+    int bucketOf(const Vec2 &p) const
+    {
+        int bx = min(max(p.x, 0), max(width - 1, 0)) >> bucketShift;
+        int by = min(max(p.y, 0), max(height - 1, 0)) >> bucketShift;
+        return by * bucketsX + bx;
+    }
+
+    Location *locate(EntityId id)
+    {
+        if (static_cast<size_t>(id.index) >= locations.size())
         {
-            lines[static_cast<size_t>(y)].assign(static_cast<size_t>(grid.getWidth()), ' ');
+            return nullptr;
         }
-
-        grid.forEach([&](const Vec2 &p, const Cell &c)
-                     {
-                         char ch = ' ';
-                         if (showNoise)
-                         {
-                             double v = c.value1;
-                             if (v < 0.2)
-                                 ch = ' ';
-                             else if (v < 0.4)
-                                 ch = '.';
-                             else if (v < 0.6)
-                                 ch = '-';
-                             else if (v < 0.8)
-                                 ch = '+';
-                             else
-                                 ch = '#';
-                         }
-                         else
-                         {
-                             ch = cellTypeToChar(c.type);
-                         }
-
-                         lines[static_cast<size_t>(p.y)][static_cast<size_t>(p.x)] = ch;
-                     });
-
-        for (const auto &nodePos : debugPath)
+        Location &loc = locations[static_cast<size_t>(id.index)];
+        if (loc.bucket < 0 || buckets[static_cast<size_t>(loc.bucket)][static_cast<size_t>(loc.slot)].id != id)
         {
-            if (grid.inBounds(nodePos))
-            {
-                lines[static_cast<size_t>(nodePos.y)][static_cast<size_t>(nodePos.x)] = '@';
-            }
+            return nullptr;
         }
+        return &loc;
+    }
 
-        for (const auto &ptr : entities)
+    void unlink(Location &loc)
+    {
+        vector<Entry> &bucket = buckets[static_cast<size_t>(loc.bucket)];
+        size_t slot = static_cast<size_t>(loc.slot);
+        if (slot + 1 != bucket.size())
         {
-            if (ptr && ptr->isAlive())
-            {
-                Vec2 p = ptr->getPos();
-                if (grid.inBounds(p))
-                {
-                    lines[static_cast<size_t>(p.y)][static_cast<size_t>(p.x)] = ptr->glyph();
-                }
-            }
+            bucket[slot] = bucket.back();
+            locations[static_cast<size_t>(bucket[slot].id.index)].slot = loc.slot;
         }
+        bucket.pop_back();
+    }
 
-        os << "\x1b[H";
-        for (int y = 0; y < grid.getHeight(); ++y)
+    void link(EntityId id, const Vec2 &p)
+    {
+        int b = bucketOf(p);
+        vector<Entry> &bucket = buckets[static_cast<size_t>(b)];
+        Location &loc = locations[static_cast<size_t>(id.index)];
+        loc.bucket = b;
+        loc.slot = static_cast<int>(bucket.size());
+        bucket.push_back(Entry{id, p});
+    }
+
+public:
+    explicit SpatialIndex(int shift = 3)
+        : width(0), height(0), bucketShift(shift), bucketsX(0), bucketsY(0), count(0)
+    {
+    }
+
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        int side = 1 << bucketShift;
+        bucketsX = max(1, (w + side - 1) / side);
+        bucketsY = max(1, (h + side - 1) / side);
+        buckets.assign(static_cast<size_t>(bucketsX * bucketsY), vector<Entry>());
+        locations.clear();
+        count = 0;
+    }
+
+    void clear()
+    {
+        for (auto &b : buckets)
         {
-            os << lines[static_cast<size_t>(y)] << "\n";
+            b.clear();
         }
+        locations.clear();
+        count = 0;
+    }
 
-        if (showOverlay)
+    size_t size() const
+    {
+        return count;
+    }
+
+    int getBucketSize() const
+    {
+        return 1 << bucketShift;
+    }
+
+    bool contains(EntityId id) const
+    {
+        if (static_cast<size_t>(id.index) >= locations.size())
         {
-            os << "\n";
-            os << "tick: " << tick
-               << " entities: " << entities.size()
-               << " running: " << (running ? "yes" : "no")
-               << " mode: " << (advancedMode ? "advanced" : "basic")
-               << " overlay: " << (showOverlay ? "on" : "off")
-               << " noise: " << (showNoise ? "on" : "off")
-               << " ids: " << (showIds ? "on" : "off")
-               << "\n";
-            os << "commands: "
-               << "[p]ause/[r]esume, [q]uit, [n]oise, [o]verlay, [c]lear path, "
-               << "[a]dv mode, [s]ave log <file>, [g]enerate path, [?]help\n";
+            return false;
         }
-
-        redrawRequired = false;
+        const Location &loc = locations[static_cast<size_t>(id.index)];
+        return loc.bucket >= 0 && buckets[static_cast<size_t>(loc.bucket)][static_cast<size_t>(loc.slot)].id == id;
     }
 
-    void handleCommand(const Command &cmd)
+    void insert(EntityId id, const Vec2 &p)
     {
-        if (cmd.name.empty())
+        if (!id.valid() || buckets.empty())
         {
             return;
         }
-
-        if (cmd.name == "q" || cmd.name == "quit" || cmd.name == "exit")
+        if (static_cast<size_t>(id.index) >= locations.size())
         {
-            running = false;
+            locations.resize(static_cast<size_t>(id.index) + 1, Location{-1, -1});
         }
-        else if (cmd.name == "p" || cmd.name == "pause")
+        Location *loc = locate(id);
+        if (loc)
         {
-            running = false;
+            unlink(*loc);
+            --count;
         }
-        else if (cmd.name == "r" || cmd.name == "resume")
+        link(id, p);
+        ++count;
+    }
+
+    template <typename Out>
+    void save(Out &out) const
+    {
+        vector<uint32_t> sizes;
+        vector<Entry> flat;
+        sizes.reserve(buckets.size());
+        flat.reserve(count);
+        for (const auto &b : buckets)
         {
-            running = true;
+            sizes.push_back(static_cast<uint32_t>(b.size()));
+            flat.insert(flat.end(), b.begin(), b.end());
         }
-        else if (cmd.name == "overlay" || cmd.name == "o")
+        out.array(sizes);
+        out.array(flat);
+    }
+
+    // idLimit bounds the entity indices the snapshot may reference.
+    template <typename In>
+    bool load(In &in, size_t idLimit)
+    {
+        vector<uint32_t> sizes;
+        vector<Entry> flat;
+        if (!in.array(sizes, buckets.size()) || !in.array(flat))
         {
-            showOverlay = !showOverlay;
-            requestRedraw();
+            return false;
         }
-        else if (cmd.name == "noise" || cmd.name == "n")
+        clear();
+        size_t k = 0;
+        for (size_t b = 0; b < buckets.size(); ++b)
         {
-            showNoise = !showNoise;
-            requestRedraw();
+            for (uint32_t n = 0; n < sizes[b]; ++n, ++k)
+            {
+                if (k >= flat.size() || !flat[k].id.valid() || static_cast<size_t>(flat[k].id.index) >= idLimit)
+                {
+                    return false;
+                }
+                const Vec2 &p = flat[k].pos;
+                if (p.x < 0 || p.y < 0 || p.x >= width || p.y >= height || bucketOf(p) != static_cast<int>(b))
+                {
+                    return false;
+                }
+                size_t idx = static_cast<size_t>(flat[k].id.index);
+                if (idx >= locations.size())
+                {
+                    locations.resize(idx + 1, Location{-1, -1});
+                }
+                if (locations[idx].bucket >= 0)
+                {
+                    return false;
+                }
+                locations[idx] = Location{static_cast<int>(b), static_cast<int>(buckets[b].size())};
+                buckets[b].push_back(flat[k]);
+                ++count;
+            }
         }
-        else if (cmd.name == "ids" || cmd.name == "i")
+        return k == flat.size();
+    }
+
+    void remove(EntityId id)
+    {
+        Location *loc = locate(id);
+        if (!loc)
         {
-            showIds = !showIds;
-            requestRedraw();
+            return;
         }
-        else if (cmd.name == "rec" || cmd.name == "record")
+        unlink(*loc);
+        loc->bucket = -1;
+        loc->slot = -1;
+        --count;
+    }
+
+    void move(EntityId id, const Vec2 &p)
+    {
+        Location *loc = locate(id);
+        if (!loc)
         {
-            recorder.setEnabled(!recorder.isEnabled());
+            insert(id, p);
+            return;
         }
-        else if (cmd.name == "save" || cmd.name == "s")
+        int b = bucketOf(p);
+        if (b == loc->bucket)
         {
-            if (!cmd.args.empty())
-            {
-                recorder.saveToFile(cmd.args[0]);
-            }
+            buckets[static_cast<size_t>(b)][static_cast<size_t>(loc->slot)].pos = p;
+            return;
         }
-        else if (cmd.name == "regen")
+        unlink(*loc);
+        link(id, p);
+    }
+
+    template <typename F>
+    void forEachInRect(const Vec2 &lo, const Vec2 &hi, F &&fn) const
+    {
+        if (buckets.empty() || hi.x < lo.x || hi.y < lo.y)
         {
-            debugPath.clear();
-            entities.clear();
-            grid.fill(CellType::Empty);
-            noise.generate(rng, 5, 0.5);
-            generateLayout();
-            spawnEntities();
-            rebuildCaches();
-            requestRedraw();
+            return;
         }
-        else if (cmd.name == "step")
+        int bx0 = bucketOf(lo) % bucketsX;
+        int by0 = bucketOf(lo) / bucketsX;
+        int bx1 = bucketOf(hi) % bucketsX;
+        int by1 = bucketOf(hi) / bucketsX;
+        for (int by = by0; by <= by1; ++by)
         {
-            if (!cmd.args.empty())
+            for (int bx = bx0; bx <= bx1; ++bx)
             {
-                int n = stoi(cmd.args[0]);
-                for (int i = 0; i < n; ++i)
+                for (const Entry &e : buckets[static_cast<size_t>(by * bucketsX + bx)])
                 {
-                    step(timestep);
+                    if (e.pos.x >= lo.x && e.pos.x <= hi.x && e.pos.y >= lo.y && e.pos.y <= hi.y)
+                    {
+                        fn(e);
+                    }
                 }
             }
-            else
-            {
-                step(timestep);
-            }
-        }
-        else if (cmd.name == "help" || cmd.name == "?")
-        {
-            cout << "basic commands:\n";
-            cout << "  q/quit/exit     - stop\n";
-            cout << "  p/pause         - pause\n";
-            cout << "  r/resume        - resume\n";
-            cout << "  overlay/o       - toggle overlay\n";
-            cout << "  noise/n         - toggle noise mode\n";
-            cout << "  ids/i           - toggle ids\n";
-            cout << "  regen           - regenerate world\n";
-            cout << "  step [n]        - step n ticks (default 1)\n";
-            cout << "  rec/record      - toggle recording\n";
-            cout << "  save/s <file>   - save recording\n";
-            cout << "  g/genpath       - generate a path between source and sink\n";
-            cout << "  c/clear         - clear path\n";
-        }
-        else if (cmd.name == "genpath" || cmd.name == "g")
-        {
-            generatePathBetweenSourceAndSink();
-        }
-        else if (cmd.name == "clear" || cmd.name == "c")
-        {
-            debugPath.clear();
-            requestRedraw();
-        }
-        else if (cmd.name == "mode" || cmd.name == "a")
-        {
-            advancedMode = !advancedMode;
-            requestRedraw();
         }
     }
 
-    void generatePathBetweenSourceAndSink()
+    template <typename F>
+    void forEachInRadius(const Vec2 &center, int radius, F &&fn) const
+    {
+        int r2 = radius * radius;
+        forEachInRect(center - Vec2(radius, radius), center + Vec2(radius, radius), [&](const Entry &e)
+                      {
+                          Vec2 d = e.pos - center;
+                          if (d.x * d.x + d.y * d.y <= r2)
+                          {
+                              fn(e);
+                          }
+                      });
+    }
+
+    template <typename F>
+    void forEachAt(const Vec2 &p, F &&fn) const
+    {
+        forEachInRect(p, p, fn);
+    }
+
+    void queryRect(const Vec2 &lo, const Vec2 &hi, vector<EntityId> &out) const
+    {
+        out.clear();
+        forEachInRect(lo, hi, [&](const Entry &e)
+                      { out.push_back(e.id); });
+    }
+
+    void queryRadius(const Vec2 &center, int radius, vector<EntityId> &out) const
+    {
+        out.clear();
+        forEachInRadius(center, radius, [&](const Entry &e)
+                        { out.push_back(e.id); });
+    }
+
+    size_t countAt(const Vec2 &p) const
+    {
+        size_t n = 0;
+        forEachAt(p, [&](const Entry &)
+                  { ++n; });
+        return n;
+    }
+};
+
+class ActiveCellSet
+{
+private:
+    int width;
+    int height;
+    vector<Vec2> cells;
+    vector<uint8_t> member;
+
+    size_t indexOf(const Vec2 &p) const
+    {
+        return static_cast<size_t>(p.y) * static_cast<size_t>(width) + static_cast<size_t>(p.x);
+    }
+
+public:
+    ActiveCellSet() : width(0), height(0) {}
+
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        cells.clear();
+        member.assign(static_cast<size_t>(max(w, 0)) * static_cast<size_t>(max(h, 0)), 0);
+    }
+
+    bool insert(const Vec2 &p)
     {
-        if (cachedSources.empty() || cachedSinks.empty())
+        size_t i = indexOf(p);
+        if (member[i])
         {
-            rebuildCaches();
+            return false;
         }
+        member[i] = 1;
+        cells.push_back(p);
+        return true;
+    }
 
-        if (cachedSources.empty() || cachedSinks.empty())
+    bool contains(const Vec2 &p) const
+    {
+        return member[indexOf(p)] != 0;
+    }
+
+    template <typename F>
+    void retainIf(F &&keep)
+    {
+        size_t out = 0;
+        for (size_t i = 0; i < cells.size(); ++i)
         {
-            return;
+            if (keep(cells[i]))
+            {
+                cells[out++] = cells[i];
+            }
+            else
+            {
+                member[indexOf(cells[i])] = 0;
+            }
         }
+        cells.resize(out);
+    }
 
-        Vec2 s = rng.choice(cachedSources);
-        Vec2 t = rng.choice(cachedSinks);
+    size_t size() const
+    {
+        return cells.size();
+    }
 
-        vector<Vec2> path;
-        bool ok = Pathfinding::aStar(grid, s, t, path);
-        if (ok)
+    void clear()
+    {
+        for (const Vec2 &p : cells)
         {
-            debugPath = path;
-            requestRedraw();
+            member[indexOf(p)] = 0;
         }
+        cells.clear();
     }
+};
 
-    void addTrailAt(const Vec2 &p)
+struct PathNode
+{
+    Vec2 pos;
+    double g;
+    double h;
+    double f;
+    int parentIndex;
+};
+
+struct Pathfinding
+{
+    static bool neighbors(const Grid &grid, const Vec2 &p, vector<Vec2> &out)
     {
-        if (grid.inBounds(p))
+        static const Vec2 dirs[4] = {
+            Vec2(1, 0),
+            Vec2(-1, 0),
+            Vec2(0, 1),
+            Vec2(0, -1)};
+        out.clear();
+        for (int i = 0; i < 4; ++i)
         {
-            Cell &c = grid.at(p);
-            if (c.type == CellType::Empty || c.type == CellType::MarkerA || c.type == CellType::MarkerB || c.type == CellType::MarkerC)
+            Vec2 q = p + dirs[i];
+            if (grid.inBounds(q))
             {
-                c.type = CellType::Trail;
-                c.value2 = 0.0;
+                if (!grid.isWall(q))
+                {
+                    out.push_back(q);
+                }
             }
         }
+        return !out.empty();
     }
 
-    void addSignalAt(const Vec2 &p)
+    static double heuristic(const Vec2 &a, const Vec2 &b)
     {
-        if (grid.inBounds(p))
+        return std::abs(a.x - b.x) + std::abs(a.y - b.y);
+    }
+
+    static bool aStar(const Grid &grid, const Vec2 &start, const Vec2 &goal, vector<Vec2> &outPath)
+    {
+        outPath.clear();
+        if (!grid.inBounds(start) || !grid.inBounds(goal))
+        {
+            return false;
+        }
+
+        vector<PathNode> nodes;
+        nodes.reserve(1024);
+
+        auto cmp = [&](int lhs, int rhs)
+        {
+            return nodes[lhs].f > nodes[rhs].f;
+        };
+
+        vector<int> open;
+        vector<vector<int>> indexMap(grid.getHeight(), vector<int>(grid.getWidth(), -1));
+        vector<bool> closed;
+
+        nodes.push_back(PathNode{start, 0.0, heuristic(start, goal), heuristic(start, goal), -1});
+        open.push_back(0);
+        push_heap(open.begin(), open.end(), cmp);
+        indexMap[start.y][start.x] = 0;
+        closed.assign(1, false);
+
+        vector<Vec2> neigh;
+
+        while (!open.empty())
+        {
+            pop_heap(open.begin(), open.end(), cmp);
+            int currentIndex = open.back();
+            open.pop_back();
+
+            if (closed[currentIndex])
+            {
+                continue;
+            }
+
+            PathNode &current = nodes[currentIndex];
+            closed[currentIndex] = true;
+
+            if (current.pos == goal)
+            {
+                int idx = currentIndex;
+                while (idx != -1)
+                {
+                    outPath.push_back(nodes[idx].pos);
+                    idx = nodes[idx].parentIndex;
+                }
+                reverse(outPath.begin(), outPath.end());
+                return true;
+            }
+
+            double currentG = current.g;
+            neighbors(grid, current.pos, neigh);
+            for (const Vec2 &nPos : neigh)
+            {
+                double tentativeG = currentG + 1.0;
+                int &mapIndex = indexMap[nPos.y][nPos.x];
+
+                if (mapIndex == -1)
+                {
+                    PathNode node;
+                    node.pos = nPos;
+                    node.g = tentativeG;
+                    node.h = heuristic(nPos, goal);
+                    node.f = node.g + node.h;
+                    node.parentIndex = currentIndex;
+
+                    int newIndex = static_cast<int>(nodes.size());
+                    nodes.push_back(node);
+                    closed.push_back(false);
+                    mapIndex = newIndex;
+                    open.push_back(newIndex);
+                    push_heap(open.begin(), open.end(), cmp);
+                }
+                else
+                {
+                    PathNode &existing = nodes[mapIndex];
+                    if (!closed[mapIndex] && tentativeG < existing.g)
+                    {
+                        existing.g = tentativeG;
+                        existing.f = existing.g + existing.h;
+                        existing.parentIndex = currentIndex;
+                        open.push_back(mapIndex);
+                        push_heap(open.begin(), open.end(), cmp);
+                    }
+                }
+            }
+        }
+
+        return false;
+    }
+};
+
+class PathfindingService
+{
+public:
+    struct FlowField
+    {
+        Vec2 goal;
+        uint64_t wallVersion;
+        uint64_t lastUse;
+        vector<uint16_t> dist;
+    };
+
+    static const uint16_t kUnreachable = UINT16_MAX;
+    static const uint16_t kMaxDistance = UINT16_MAX - 1;
+    static const size_t kSpareFields = 4;
+    static const size_t kDefaultByteBudget = size_t(256) << 20;
+
+private:
+    int width;
+    int height;
+    uint32_t generation;
+    vector<uint32_t> stamp;
+    vector<int> nodeIndex;
+    vector<PathNode> nodes;
+    vector<uint8_t> closed;
+    vector<pair<double, int>> open;
+    vector<Vec2> neigh;
+    vector<int> frontier;
+    unordered_map<uint64_t, FlowField> fields;
+    size_t maxFields;
+    size_t byteBudget;
+    uint64_t useClock;
+    size_t builds;
+
+    static uint64_t goalKey(const Vec2 &p)
+    {
+        return static_cast<uint64_t>(static_cast<uint32_t>(p.x)) << 32 | static_cast<uint32_t>(p.y);
+    }
+
+    size_t bytesPerField() const
+    {
+        return max<size_t>(1, static_cast<size_t>(max(width, 0)) * static_cast<size_t>(max(height, 0)) * sizeof(uint16_t));
+    }
+
+    size_t fieldLimit() const
+    {
+        return max<size_t>(1, min(maxFields, byteBudget / bytesPerField()));
+    }
+
+    // Evicts least recently used fields until `room` more fit under the count and byte limits
+    void trim(size_t room)
+    {
+        size_t limit = fieldLimit();
+        while (!fields.empty() && fields.size() + room > limit)
+        {
+            auto victim = fields.begin();
+            for (auto it = fields.begin(); it != fields.end(); ++it)
+            {
+                if (it->second.lastUse < victim->second.lastUse)
+                {
+                    victim = it;
+                }
+            }
+            fields.erase(victim);
+        }
+    }
+
+    void ensureSize(const Grid &grid)
+    {
+        if (grid.getWidth() == width && grid.getHeight() == height)
+        {
+            return;
+        }
+        width = grid.getWidth();
+        height = grid.getHeight();
+        stamp.assign(static_cast<size_t>(width * height), 0);
+        nodeIndex.assign(static_cast<size_t>(width * height), -1);
+        generation = 0;
+        fields.clear();
+    }
+
+    void nextGeneration()
+    {
+        if (++generation == 0)
+        {
+            fill(stamp.begin(), stamp.end(), 0);
+            generation = 1;
+        }
+    }
+
+    // Distances past kMaxDistance saturate; agents on such a plateau find no
+    // downhill step and fall back to greedy steering until they leave it
+    void buildField(const Grid &grid, FlowField &f)
+    {
+        ++builds;
+        f.wallVersion = grid.getWallVersion();
+        f.dist.assign(static_cast<size_t>(width * height), static_cast<uint16_t>(kUnreachable));
+        if (!grid.inBounds(f.goal) || grid.isWall(f.goal))
+        {
+            return;
+        }
+        frontier.clear();
+        frontier.push_back(f.goal.y * width + f.goal.x);
+        f.dist[static_cast<size_t>(frontier[0])] = 0;
+        for (size_t head = 0; head < frontier.size(); ++head)
+        {
+            int idx = frontier[head];
+            Vec2 p(idx % width, idx / width);
+            uint16_t d = min<uint16_t>(f.dist[static_cast<size_t>(idx)] + 1, static_cast<uint16_t>(kMaxDistance));
+            Pathfinding::neighbors(grid, p, neigh);
+            for (const Vec2 &q : neigh)
+            {
+                int qi = q.y * width + q.x;
+                if (f.dist[static_cast<size_t>(qi)] == kUnreachable)
+                {
+                    f.dist[static_cast<size_t>(qi)] = d;
+                    frontier.push_back(qi);
+                }
+            }
+        }
+    }
+
+public:
+    PathfindingService()
+        : width(-1), height(-1), generation(0), maxFields(16), byteBudget(kDefaultByteBudget), useClock(0), builds(0)
+    {
+    }
+
+    void setMaxFields(size_t n)
+    {
+        maxFields = max<size_t>(n, 1);
+        trim(0);
+    }
+
+    void setByteBudget(size_t bytes)
+    {
+        byteBudget = bytes;
+        trim(0);
+    }
+
+    void clear()
+    {
+        fields.clear();
+    }
+
+    size_t fieldCount() const
+    {
+        return fields.size();
+    }
+
+    size_t fieldBytes() const
+    {
+        size_t total = 0;
+        for (const auto &kv : fields)
+        {
+            total += kv.second.dist.capacity() * sizeof(uint16_t);
+        }
+        return total;
+    }
+
+    size_t buildCount() const
+    {
+        return builds;
+    }
+
+    bool findPath(const Grid &grid, const Vec2 &start, const Vec2 &goal, vector<Vec2> &outPath)
+    {
+        outPath.clear();
+        if (!grid.inBounds(start) || !grid.inBounds(goal))
+        {
+            return false;
+        }
+        ensureSize(grid);
+        nextGeneration();
+        nodes.clear();
+        closed.clear();
+        open.clear();
+
+        auto cmp = [](const pair<double, int> &lhs, const pair<double, int> &rhs)
+        {
+            return lhs.first > rhs.first;
+        };
+        auto slotOf = [&](const Vec2 &p) -> int &
+        {
+            size_t i = static_cast<size_t>(p.y * width + p.x);
+            if (stamp[i] != generation)
+            {
+                stamp[i] = generation;
+                nodeIndex[i] = -1;
+            }
+            return nodeIndex[i];
+        };
+
+        double h0 = Pathfinding::heuristic(start, goal);
+        nodes.push_back(PathNode{start, 0.0, h0, h0, -1});
+        closed.push_back(0);
+        open.push_back(make_pair(h0, 0));
+        slotOf(start) = 0;
+
+        while (!open.empty())
+        {
+            pop_heap(open.begin(), open.end(), cmp);
+            int currentIndex = open.back().second;
+            open.pop_back();
+            if (closed[static_cast<size_t>(currentIndex)])
+            {
+                continue;
+            }
+            closed[static_cast<size_t>(currentIndex)] = 1;
+            Vec2 currentPos = nodes[static_cast<size_t>(currentIndex)].pos;
+            double currentG = nodes[static_cast<size_t>(currentIndex)].g;
+
+            if (currentPos == goal)
+            {
+                for (int idx = currentIndex; idx != -1; idx = nodes[static_cast<size_t>(idx)].parentIndex)
+                {
+                    outPath.push_back(nodes[static_cast<size_t>(idx)].pos);
+                }
+                reverse(outPath.begin(), outPath.end());
+                return true;
+            }
+
+            Pathfinding::neighbors(grid, currentPos, neigh);
+            for (const Vec2 &nPos : neigh)
+            {
+                double tentativeG = currentG + 1.0;
+                int &mapIndex = slotOf(nPos);
+                if (mapIndex == -1)
+                {
+                    double h = Pathfinding::heuristic(nPos, goal);
+                    mapIndex = static_cast<int>(nodes.size());
+                    nodes.push_back(PathNode{nPos, tentativeG, h, tentativeG + h, currentIndex});
+                    closed.push_back(0);
+                    open.push_back(make_pair(tentativeG + h, mapIndex));
+                    push_heap(open.begin(), open.end(), cmp);
+                }
+                else
+                {
+                    PathNode &existing = nodes[static_cast<size_t>(mapIndex)];
+                    if (!closed[static_cast<size_t>(mapIndex)] && tentativeG < existing.g)
+                    {
+                        existing.g = tentativeG;
+                        existing.f = existing.g + existing.h;
+                        existing.parentIndex = currentIndex;
+                        open.push_back(make_pair(existing.f, mapIndex));
+                        push_heap(open.begin(), open.end(), cmp);
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    const FlowField *findField(const Grid &grid, const Vec2 &goal) const
+    {
+        auto it = fields.find(goalKey(goal));
+        if (it != fields.end() && it->second.wallVersion == grid.getWallVersion() &&
+            grid.getWidth() == width && grid.getHeight() == height)
+        {
+            return &it->second;
+        }
+        return nullptr;
+    }
+
+    const FlowField &flowField(const Grid &grid, const Vec2 &goal)
+    {
+        ensureSize(grid);
+        ++useClock;
+        auto it = fields.find(goalKey(goal));
+        if (it == fields.end())
+        {
+            trim(1);
+            it = fields.emplace(goalKey(goal), FlowField{goal, 0, useClock, vector<uint16_t>()}).first;
+            buildField(grid, it->second);
+        }
+        else if (it->second.wallVersion != grid.getWallVersion())
+        {
+            buildField(grid, it->second);
+        }
+        it->second.lastUse = useClock;
+        return it->second;
+    }
+
+    // Sizes the cache to the active goal set and marks those goals most recently
+    // used, so trimming only drops fields whose goals went away. Room is left for
+    // as many again recently dropped goals, since Seeker targets such as ping
+    // origins come and go from tick to tick. Fields are still built lazily by
+    // flowField.
+    void retain(const Grid &grid, const vector<Vec2> &goals)
+    {
+        ensureSize(grid);
+        maxFields = 2 * goals.size() + kSpareFields;
+        for (const Vec2 &g : goals)
+        {
+            auto it = fields.find(goalKey(g));
+            if (it != fields.end())
+            {
+                it->second.lastUse = ++useClock;
+            }
+        }
+        trim(0);
+    }
+
+    void prepare(const Grid &grid, const vector<Vec2> &goals)
+    {
+        retain(grid, goals);
+        for (const Vec2 &g : goals)
+        {
+            flowField(grid, g);
+        }
+    }
+
+    static bool stepAlong(const Grid &grid, const FlowField &f, const Vec2 &from, Vec2 &outDir)
+    {
+        static const Vec2 dirs[4] = {
+            Vec2(1, 0),
+            Vec2(-1, 0),
+            Vec2(0, 1),
+            Vec2(0, -1)};
+        if (!grid.inBounds(from))
+        {
+            return false;
+        }
+        int w = grid.getWidth();
+        uint16_t best = f.dist[static_cast<size_t>(from.y * w + from.x)];
+        if (best == 0 || best == kUnreachable)
+        {
+            return false;
+        }
+        int pick = 4;
+        for (int k = 0; k < 4; ++k)
+        {
+            Vec2 q = from + dirs[k];
+            if (grid.inBounds(q))
+            {
+                uint16_t dq = f.dist[static_cast<size_t>(q.y * w + q.x)];
+                bool take = dq < best;
+                best = take ? dq : best;
+                pick = take ? k : pick;
+            }
+        }
+        if (pick == 4)
+        {
+            return false;
+        }
+        outDir = dirs[pick];
+        return true;
+    }
+
+    bool flowPath(const Grid &grid, const Vec2 &start, const Vec2 &goal, vector<Vec2> &outPath)
+    {
+        outPath.clear();
+        if (!grid.inBounds(start) || !grid.inBounds(goal))
+        {
+            return false;
+        }
+        const FlowField &f = flowField(grid, goal);
+        if (f.dist[static_cast<size_t>(start.y * width + start.x)] == kUnreachable)
+        {
+            return false;
+        }
+        Vec2 p = start;
+        outPath.push_back(p);
+        Vec2 dir;
+        while (p != goal && stepAlong(grid, f, p, dir))
+        {
+            p += dir;
+            outPath.push_back(p);
+        }
+        return p == goal;
+    }
+};
+
+class HierarchicalPathfinder
+{
+    struct Node
+    {
+        Vec2 pos;
+        int chunk;
+        int partner;
+        bool live;
+        vector<pair<int, int>> edges;
+    };
+
+    int chunkSize;
+    int width;
+    int height;
+    int chunksX;
+    int chunksY;
+    int horizontalBorders;
+    bool built;
+    uint64_t syncedVersion;
+    size_t rebuiltChunks;
+    vector<Node> nodes;
+    vector<int> freeNodes;
+    vector<vector<int>> borderNodes;
+    vector<uint8_t> dirty;
+    vector<int> dirtyChunks;
+
+    uint32_t generation;
+    vector<uint32_t> stamp;
+    vector<int> parent;
+    vector<int> dist;
+    vector<int> frontier;
+
+    uint32_t nodeGeneration;
+    vector<uint32_t> nodeStamp;
+    vector<int> nodeG;
+    vector<int> nodeParent;
+    vector<uint8_t> nodeClosed;
+    vector<pair<int, int>> open;
+    vector<int> chunkScratch;
+    vector<int> abstractPath;
+    vector<Vec2> segment;
+
+    static bool passable(const Grid &grid, const Vec2 &p)
+    {
+        return grid.inBounds(p) && !grid.isWall(p);
+    }
+
+    int chunkOf(const Vec2 &p) const
+    {
+        return (p.y / chunkSize) * chunksX + p.x / chunkSize;
+    }
+
+    void chunkRect(int c, Vec2 &lo, Vec2 &hi) const
+    {
+        int cx = c % chunksX;
+        int cy = c / chunksX;
+        lo = Vec2(cx * chunkSize, cy * chunkSize);
+        hi = Vec2(min(width, (cx + 1) * chunkSize) - 1, min(height, (cy + 1) * chunkSize) - 1);
+    }
+
+    int allocNode(const Vec2 &p, int chunk)
+    {
+        int idx;
+        if (!freeNodes.empty())
+        {
+            idx = freeNodes.back();
+            freeNodes.pop_back();
+        }
+        else
+        {
+            idx = static_cast<int>(nodes.size());
+            nodes.push_back(Node());
+        }
+        Node &n = nodes[static_cast<size_t>(idx)];
+        n.pos = p;
+        n.chunk = chunk;
+        n.partner = -1;
+        n.live = true;
+        n.edges.clear();
+        return idx;
+    }
+
+    void appendBorderNodes(int border, Vec2 a, Vec2 b, const Vec2 &along, int length, const Grid &grid)
+    {
+        int ca = chunkOf(a);
+        int cb = chunkOf(b);
+        int spanStart = -1;
+        for (int i = 0; i <= length; ++i)
+        {
+            Vec2 pa = a + Vec2(along.x * i, along.y * i);
+            Vec2 pb = b + Vec2(along.x * i, along.y * i);
+            bool crossable = i < length && passable(grid, pa) && passable(grid, pb);
+            if (crossable && spanStart < 0)
+            {
+                spanStart = i;
+            }
+            else if (!crossable && spanStart >= 0)
+            {
+                int spanEnd = i - 1;
+                int picks[2] = {(spanStart + spanEnd) / 2, -1};
+                if (spanEnd - spanStart + 1 >= 6)
+                {
+                    picks[0] = spanStart;
+                    picks[1] = spanEnd;
+                }
+                for (int t : picks)
+                {
+                    if (t < 0)
+                    {
+                        continue;
+                    }
+                    int na = allocNode(a + Vec2(along.x * t, along.y * t), ca);
+                    int nb = allocNode(b + Vec2(along.x * t, along.y * t), cb);
+                    nodes[static_cast<size_t>(na)].partner = nb;
+                    nodes[static_cast<size_t>(nb)].partner = na;
+                    borderNodes[static_cast<size_t>(border)].push_back(na);
+                    borderNodes[static_cast<size_t>(border)].push_back(nb);
+                }
+                spanStart = -1;
+            }
+        }
+    }
+
+    void buildBorder(const Grid &grid, int border)
+    {
+        for (int n : borderNodes[static_cast<size_t>(border)])
+        {
+            nodes[static_cast<size_t>(n)].live = false;
+            nodes[static_cast<size_t>(n)].edges.clear();
+            freeNodes.push_back(n);
+        }
+        borderNodes[static_cast<size_t>(border)].clear();
+
+        if (border < horizontalBorders)
+        {
+            int cx = border % (chunksX - 1);
+            int cy = border / (chunksX - 1);
+            int x = (cx + 1) * chunkSize - 1;
+            int y0 = cy * chunkSize;
+            int len = min(height, y0 + chunkSize) - y0;
+            appendBorderNodes(border, Vec2(x, y0), Vec2(x + 1, y0), Vec2(0, 1), len, grid);
+        }
+        else
+        {
+            int v = border - horizontalBorders;
+            int cx = v % chunksX;
+            int cy = v / chunksX;
+            int y = (cy + 1) * chunkSize - 1;
+            int x0 = cx * chunkSize;
+            int len = min(width, x0 + chunkSize) - x0;
+            appendBorderNodes(border, Vec2(x0, y), Vec2(x0, y + 1), Vec2(1, 0), len, grid);
+        }
+    }
+
+    void bordersOfChunk(int c, int out[4]) const
+    {
+        int cx = c % chunksX;
+        int cy = c / chunksX;
+        out[0] = cx > 0 ? cy * (chunksX - 1) + cx - 1 : -1;
+        out[1] = cx < chunksX - 1 ? cy * (chunksX - 1) + cx : -1;
+        out[2] = cy > 0 ? horizontalBorders + (cy - 1) * chunksX + cx : -1;
+        out[3] = cy < chunksY - 1 ? horizontalBorders + cy * chunksX + cx : -1;
+    }
+
+    void gatherChunkNodes(int c, vector<int> &out) const
+    {
+        out.clear();
+        int borders[4];
+        bordersOfChunk(c, borders);
+        for (int b : borders)
+        {
+            if (b < 0)
+            {
+                continue;
+            }
+            for (int n : borderNodes[static_cast<size_t>(b)])
+            {
+                if (nodes[static_cast<size_t>(n)].chunk == c)
+                {
+                    out.push_back(n);
+                }
+            }
+        }
+    }
+
+    void nextGeneration()
+    {
+        if (++generation == 0)
+        {
+            fill(stamp.begin(), stamp.end(), 0);
+            generation = 1;
+        }
+    }
+
+    void localFlood(const Grid &grid, const Vec2 &from, const Vec2 &lo, const Vec2 &hi, const Vec2 *stopAt)
+    {
+        static const Vec2 dirs[4] = {
+            Vec2(1, 0),
+            Vec2(-1, 0),
+            Vec2(0, 1),
+            Vec2(0, -1)};
+        nextGeneration();
+        frontier.clear();
+        size_t fi = static_cast<size_t>(from.y * width + from.x);
+        stamp[fi] = generation;
+        dist[fi] = 0;
+        parent[fi] = -1;
+        frontier.push_back(static_cast<int>(fi));
+        for (size_t head = 0; head < frontier.size(); ++head)
+        {
+            int idx = frontier[head];
+            Vec2 p(idx % width, idx / width);
+            if (stopAt && p == *stopAt)
+            {
+                return;
+            }
+            for (const Vec2 &d : dirs)
+            {
+                Vec2 q = p + d;
+                if (q.x < lo.x || q.y < lo.y || q.x > hi.x || q.y > hi.y || !passable(grid, q))
+                {
+                    continue;
+                }
+                size_t qi = static_cast<size_t>(q.y * width + q.x);
+                if (stamp[qi] != generation)
+                {
+                    stamp[qi] = generation;
+                    dist[qi] = dist[static_cast<size_t>(idx)] + 1;
+                    parent[qi] = idx;
+                    frontier.push_back(static_cast<int>(qi));
+                }
+            }
+        }
+    }
+
+    int floodDistance(const Vec2 &p) const
+    {
+        size_t i = static_cast<size_t>(p.y * width + p.x);
+        return stamp[i] == generation ? dist[i] : -1;
+    }
+
+    bool localPath(const Grid &grid, const Vec2 &from, const Vec2 &to, int chunk, vector<Vec2> &out)
+    {
+        Vec2 lo, hi;
+        chunkRect(chunk, lo, hi);
+        localFlood(grid, from, lo, hi, &to);
+        if (floodDistance(to) < 0)
+        {
+            return false;
+        }
+        size_t mark = out.size();
+        for (int idx = to.y * width + to.x; idx != -1; idx = parent[static_cast<size_t>(idx)])
+        {
+            out.push_back(Vec2(idx % width, idx / width));
+        }
+        reverse(out.begin() + static_cast<ptrdiff_t>(mark), out.end());
+        return true;
+    }
+
+    void connectInChunk(const Grid &grid, int n, int chunk, const vector<int> &targets, bool reverseEdges)
+    {
+        Vec2 lo, hi;
+        chunkRect(chunk, lo, hi);
+        localFlood(grid, nodes[static_cast<size_t>(n)].pos, lo, hi, nullptr);
+        for (int m : targets)
+        {
+            if (m == n)
+            {
+                continue;
+            }
+            int d = floodDistance(nodes[static_cast<size_t>(m)].pos);
+            if (d < 0)
+            {
+                continue;
+            }
+            if (reverseEdges)
+            {
+                nodes[static_cast<size_t>(m)].edges.push_back(make_pair(n, d));
+            }
+            else
+            {
+                nodes[static_cast<size_t>(n)].edges.push_back(make_pair(m, d));
+            }
+        }
+    }
+
+    void rebuildChunkEdges(const Grid &grid, int c)
+    {
+        gatherChunkNodes(c, chunkScratch);
+        for (int n : chunkScratch)
+        {
+            nodes[static_cast<size_t>(n)].edges.clear();
+        }
+        for (int n : chunkScratch)
+        {
+            connectInChunk(grid, n, c, chunkScratch, false);
+        }
+        ++rebuiltChunks;
+    }
+
+    void rebuildAll(const Grid &grid)
+    {
+        width = grid.getWidth();
+        height = grid.getHeight();
+        chunksX = max(1, (width + chunkSize - 1) / chunkSize);
+        chunksY = max(1, (height + chunkSize - 1) / chunkSize);
+        horizontalBorders = (chunksX - 1) * chunksY;
+        nodes.clear();
+        freeNodes.clear();
+        borderNodes.assign(static_cast<size_t>(horizontalBorders + chunksX * (chunksY - 1)), vector<int>());
+        dirty.assign(static_cast<size_t>(chunksX * chunksY), 0);
+        dirtyChunks.clear();
+        stamp.assign(static_cast<size_t>(width * height), 0);
+        parent.assign(stamp.size(), -1);
+        dist.assign(stamp.size(), 0);
+        generation = 0;
+        for (int b = 0; b < static_cast<int>(borderNodes.size()); ++b)
+        {
+            buildBorder(grid, b);
+        }
+        for (int c = 0; c < chunksX * chunksY; ++c)
+        {
+            rebuildChunkEdges(grid, c);
+        }
+        syncedVersion = grid.getWallVersion();
+        built = true;
+    }
+
+    void rebuildDirty(const Grid &grid)
+    {
+        vector<int> borders;
+        vector<int> affected;
+        for (int c : dirtyChunks)
+        {
+            dirty[static_cast<size_t>(c)] = 0;
+            int bs[4];
+            bordersOfChunk(c, bs);
+            for (int b : bs)
+            {
+                if (b >= 0 && find(borders.begin(), borders.end(), b) == borders.end())
+                {
+                    borders.push_back(b);
+                }
+            }
+            if (find(affected.begin(), affected.end(), c) == affected.end())
+            {
+                affected.push_back(c);
+            }
+        }
+        dirtyChunks.clear();
+        for (int b : borders)
+        {
+            buildBorder(grid, b);
+            int a;
+            int n;
+            if (b < horizontalBorders)
+            {
+                a = (b / (chunksX - 1)) * chunksX + b % (chunksX - 1);
+                n = a + 1;
+            }
+            else
+            {
+                a = b - horizontalBorders;
+                n = a + chunksX;
+            }
+            for (int c : {a, n})
+            {
+                if (find(affected.begin(), affected.end(), c) == affected.end())
+                {
+                    affected.push_back(c);
+                }
+            }
+        }
+        for (int c : affected)
+        {
+            rebuildChunkEdges(grid, c);
+        }
+    }
+
+    void sync(const Grid &grid)
+    {
+        if (!built || grid.getWidth() != width || grid.getHeight() != height || grid.getWallVersion() != syncedVersion)
+        {
+            rebuildAll(grid);
+        }
+        else if (!dirtyChunks.empty())
+        {
+            rebuildDirty(grid);
+        }
+    }
+
+public:
+    explicit HierarchicalPathfinder(int chunk = 16)
+        : chunkSize(max(chunk, 2)), width(0), height(0), chunksX(0), chunksY(0), horizontalBorders(0),
+          built(false), syncedVersion(0), rebuiltChunks(0), generation(0), nodeGeneration(0)
+    {
+    }
+
+    int getChunkSize() const
+    {
+        return chunkSize;
+    }
+
+    size_t nodeCount() const
+    {
+        return nodes.size() - freeNodes.size();
+    }
+
+    size_t getRebuiltChunks() const
+    {
+        return rebuiltChunks;
+    }
+
+    void invalidateAll()
+    {
+        built = false;
+    }
+
+    void noteWallChange(const Vec2 &p, uint64_t newVersion)
+    {
+        if (!built || newVersion != syncedVersion + 1 || p.x < 0 || p.y < 0 || p.x >= width || p.y >= height)
+        {
+            built = false;
+            return;
+        }
+        syncedVersion = newVersion;
+        int c = chunkOf(p);
+        if (!dirty[static_cast<size_t>(c)])
+        {
+            dirty[static_cast<size_t>(c)] = 1;
+            dirtyChunks.push_back(c);
+        }
+    }
+
+    void prepare(const Grid &grid)
+    {
+        sync(grid);
+    }
+
+    bool findPath(const Grid &grid, const Vec2 &start, const Vec2 &goal, vector<Vec2> &outPath)
+    {
+        outPath.clear();
+        if (!grid.inBounds(start) || !passable(grid, goal))
+        {
+            return false;
+        }
+        if (!passable(grid, start))
+        {
+            static const Vec2 dirs[4] = {
+                Vec2(1, 0),
+                Vec2(-1, 0),
+                Vec2(0, 1),
+                Vec2(0, -1)};
+            for (const Vec2 &d : dirs)
+            {
+                if (passable(grid, start + d) && findPath(grid, start + d, goal, outPath))
+                {
+                    outPath.insert(outPath.begin(), start);
+                    return true;
+                }
+            }
+            return false;
+        }
+        sync(grid);
+
+        int sc = chunkOf(start);
+        int gc = chunkOf(goal);
+        if (sc == gc && localPath(grid, start, goal, sc, outPath))
+        {
+            return true;
+        }
+        outPath.clear();
+
+        size_t baseCount = nodes.size();
+        int s = static_cast<int>(nodes.size());
+        nodes.push_back(Node{start, sc, -1, true, {}});
+        int g = static_cast<int>(nodes.size());
+        nodes.push_back(Node{goal, gc, -1, true, {}});
+
+        gatherChunkNodes(sc, chunkScratch);
+        connectInChunk(grid, s, sc, chunkScratch, false);
+        gatherChunkNodes(gc, chunkScratch);
+        vector<int> goalLinked = chunkScratch;
+        connectInChunk(grid, g, gc, goalLinked, true);
+
+        if (nodeStamp.size() < nodes.size())
+        {
+            nodeStamp.resize(nodes.size(), 0);
+            nodeG.resize(nodes.size(), 0);
+            nodeParent.resize(nodes.size(), -1);
+            nodeClosed.resize(nodes.size(), 0);
+        }
+        if (++nodeGeneration == 0)
+        {
+            fill(nodeStamp.begin(), nodeStamp.end(), 0);
+            nodeGeneration = 1;
+        }
+        auto touch = [&](int n)
+        {
+            size_t i = static_cast<size_t>(n);
+            if (nodeStamp[i] != nodeGeneration)
+            {
+                nodeStamp[i] = nodeGeneration;
+                nodeG[i] = numeric_limits<int>::max();
+                nodeParent[i] = -1;
+                nodeClosed[i] = 0;
+            }
+        };
+        auto h = [&](int n)
+        {
+            const Vec2 &p = nodes[static_cast<size_t>(n)].pos;
+            return std::abs(p.x - goal.x) + std::abs(p.y - goal.y);
+        };
+        auto cmp = [](const pair<int, int> &a, const pair<int, int> &b)
+        {
+            return a.first > b.first;
+        };
+
+        open.clear();
+        touch(s);
+        nodeG[static_cast<size_t>(s)] = 0;
+        open.push_back(make_pair(h(s), s));
+        bool found = false;
+        while (!open.empty())
+        {
+            pop_heap(open.begin(), open.end(), cmp);
+            int cur = open.back().second;
+            open.pop_back();
+            if (nodeClosed[static_cast<size_t>(cur)])
+            {
+                continue;
+            }
+            nodeClosed[static_cast<size_t>(cur)] = 1;
+            if (cur == g)
+            {
+                found = true;
+                break;
+            }
+            const Node &cn = nodes[static_cast<size_t>(cur)];
+            auto relax = [&](int to, int cost)
+            {
+                touch(to);
+                int tentative = nodeG[static_cast<size_t>(cur)] + cost;
+                if (!nodeClosed[static_cast<size_t>(to)] && tentative < nodeG[static_cast<size_t>(to)])
+                {
+                    nodeG[static_cast<size_t>(to)] = tentative;
+                    nodeParent[static_cast<size_t>(to)] = cur;
+                    open.push_back(make_pair(tentative + h(to), to));
+                    push_heap(open.begin(), open.end(), cmp);
+                }
+            };
+            for (const auto &e : cn.edges)
+            {
+                relax(e.first, e.second);
+            }
+            if (cn.partner >= 0)
+            {
+                relax(cn.partner, 1);
+            }
+        }
+
+        if (found)
+        {
+            abstractPath.clear();
+            for (int n = g; n != -1; n = nodeParent[static_cast<size_t>(n)])
+            {
+                abstractPath.push_back(n);
+            }
+            reverse(abstractPath.begin(), abstractPath.end());
+            outPath.push_back(start);
+            for (size_t i = 1; i < abstractPath.size(); ++i)
+            {
+                const Node &a = nodes[static_cast<size_t>(abstractPath[i - 1])];
+                const Node &b = nodes[static_cast<size_t>(abstractPath[i])];
+                if (a.partner == abstractPath[i])
+                {
+                    outPath.push_back(b.pos);
+                    continue;
+                }
+                segment.clear();
+                localPath(grid, a.pos, b.pos, a.chunk, segment);
+                outPath.insert(outPath.end(), segment.begin() + (segment.empty() ? 0 : 1), segment.end());
+            }
+        }
+
+        for (int m : goalLinked)
+        {
+            vector<pair<int, int>> &edges = nodes[static_cast<size_t>(m)].edges;
+            if (!edges.empty() && edges.back().first == g)
+            {
+                edges.pop_back();
+            }
+        }
+        nodes.resize(baseCount);
+        return found;
+    }
+};
+
+class LSystem
+{
+    struct Frame
+    {
+        const string *symbols;
+        size_t next;
+        int depth;
+    };
+
+    string axiom;
+    vector<string> productions;
+    int16_t ruleOf[256];
+    mutable vector<array<uint64_t, 256>> lengths;
+
+    const string *production(char c) const
+    {
+        int16_t r = ruleOf[static_cast<unsigned char>(c)];
+        return r < 0 ? nullptr : &productions[static_cast<size_t>(r)];
+    }
+
+    const array<uint64_t, 256> &lengthsAt(int depth) const
+    {
+        if (lengths.empty())
+        {
+            lengths.emplace_back();
+            lengths[0].fill(1);
+        }
+        while (static_cast<int>(lengths.size()) <= depth)
+        {
+            const array<uint64_t, 256> &prev = lengths.back();
+            array<uint64_t, 256> cur;
+            for (size_t c = 0; c < 256; ++c)
+            {
+                int16_t r = ruleOf[c];
+                if (r < 0)
+                {
+                    cur[c] = 1;
+                    continue;
+                }
+                uint64_t n = 0;
+                for (char s : productions[static_cast<size_t>(r)])
+                {
+                    uint64_t add = prev[static_cast<unsigned char>(s)];
+                    n = add > numeric_limits<uint64_t>::max() - n ? numeric_limits<uint64_t>::max() : n + add;
+                }
+                cur[c] = n;
+            }
+            lengths.push_back(cur);
+        }
+        return lengths[static_cast<size_t>(depth)];
+    }
+
+public:
+    LSystem()
+    {
+        fill(begin(ruleOf), end(ruleOf), int16_t(-1));
+    }
+
+    void setAxiom(const string &a)
+    {
+        axiom = a;
+    }
+
+    void addRule(char f, const string &t)
+    {
+        int16_t &r = ruleOf[static_cast<unsigned char>(f)];
+        if (r >= 0)
+        {
+            return;
+        }
+        r = static_cast<int16_t>(productions.size());
+        productions.push_back(t);
+        lengths.clear();
+    }
+
+    uint64_t length(int iterations) const
+    {
+        const array<uint64_t, 256> &len = lengthsAt(max(iterations, 0));
+        uint64_t n = 0;
+        for (char c : axiom)
+        {
+            uint64_t add = len[static_cast<unsigned char>(c)];
+            n = add > numeric_limits<uint64_t>::max() - n ? numeric_limits<uint64_t>::max() : n + add;
+        }
+        return n;
+    }
+
+    char at(int iterations, uint64_t index) const
+    {
+        int depth = max(iterations, 0);
+        lengthsAt(depth);
+        const string *symbols = &axiom;
+        for (;;)
+        {
+            const array<uint64_t, 256> &len = lengths[static_cast<size_t>(depth)];
+            size_t i = 0;
+            for (; i < symbols->size(); ++i)
+            {
+                uint64_t n = len[static_cast<unsigned char>((*symbols)[i])];
+                if (index < n)
+                {
+                    break;
+                }
+                index -= n;
+            }
+            if (i == symbols->size())
+            {
+                return '\0';
+            }
+            char c = (*symbols)[i];
+            const string *next = production(c);
+            if (depth == 0 || !next)
+            {
+                return c;
+            }
+            symbols = next;
+            --depth;
+        }
+    }
+
+    template <typename F>
+    void expand(int iterations, F &&emit) const
+    {
+        vector<Frame> stack;
+        stack.push_back(Frame{&axiom, 0, max(iterations, 0)});
+        while (!stack.empty())
+        {
+            Frame &f = stack.back();
+            if (f.next == f.symbols->size())
+            {
+                stack.pop_back();
+                continue;
+            }
+            char c = (*f.symbols)[f.next++];
+            const string *next = f.depth > 0 ? production(c) : nullptr;
+            if (next)
+            {
+                stack.push_back(Frame{next, 0, f.depth - 1});
+            }
+            else
+            {
+                emit(c);
+            }
+        }
+    }
+
+    string generate(int iterations) const
+    {
+        string current = axiom;
+        for (int i = 0; i < iterations; ++i)
+        {
+            string next;
+            next.reserve(static_cast<size_t>(min<uint64_t>(length(i + 1), next.max_size())));
+            for (char c : current)
+            {
+                if (const string *p = production(c))
+                {
+                    next += *p;
+                }
+                else
+                {
+                    next.push_back(c);
+                }
+            }
+            current.swap(next);
+        }
+        return current;
+    }
+};
+
+#if !defined(NOISE_SCALAR) && defined(__AVX2__)
+struct FloatLanes
+{
+    static const int width = 8;
+    __m256 v;
+
+    static FloatLanes load(const float *p)
+    {
+        return FloatLanes{_mm256_loadu_ps(p)};
+    }
+
+    static FloatLanes broadcast(float s)
+    {
+        return FloatLanes{_mm256_set1_ps(s)};
+    }
+
+    void store(float *p) const
+    {
+        _mm256_storeu_ps(p, v);
+    }
+};
+
+inline FloatLanes operator+(FloatLanes a, FloatLanes b) { return FloatLanes{_mm256_add_ps(a.v, b.v)}; }
+inline FloatLanes operator-(FloatLanes a, FloatLanes b) { return FloatLanes{_mm256_sub_ps(a.v, b.v)}; }
+inline FloatLanes operator*(FloatLanes a, FloatLanes b) { return FloatLanes{_mm256_mul_ps(a.v, b.v)}; }
+inline FloatLanes lanesLess(FloatLanes a, FloatLanes b) { return FloatLanes{_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+inline FloatLanes lanesGreater(FloatLanes a, FloatLanes b) { return FloatLanes{_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+inline FloatLanes lanesSelect(FloatLanes m, FloatLanes a, FloatLanes b) { return FloatLanes{_mm256_blendv_ps(b.v, a.v, m.v)}; }
+#elif !defined(NOISE_SCALAR) && defined(__SSE2__)
+struct FloatLanes
+{
+    static const int width = 4;
+    __m128 v;
+
+    static FloatLanes load(const float *p)
+    {
+        return FloatLanes{_mm_loadu_ps(p)};
+    }
+
+    static FloatLanes broadcast(float s)
+    {
+        return FloatLanes{_mm_set1_ps(s)};
+    }
+
+    void store(float *p) const
+    {
+        _mm_storeu_ps(p, v);
+    }
+};
+
+inline FloatLanes operator+(FloatLanes a, FloatLanes b) { return FloatLanes{_mm_add_ps(a.v, b.v)}; }
+inline FloatLanes operator-(FloatLanes a, FloatLanes b) { return FloatLanes{_mm_sub_ps(a.v, b.v)}; }
+inline FloatLanes operator*(FloatLanes a, FloatLanes b) { return FloatLanes{_mm_mul_ps(a.v, b.v)}; }
+inline FloatLanes lanesLess(FloatLanes a, FloatLanes b) { return FloatLanes{_mm_cmplt_ps(a.v, b.v)}; }
+inline FloatLanes lanesGreater(FloatLanes a, FloatLanes b) { return FloatLanes{_mm_cmpgt_ps(a.v, b.v)}; }
+inline FloatLanes lanesSelect(FloatLanes m, FloatLanes a, FloatLanes b) { return FloatLanes{_mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v))}; }
+#elif !defined(NOISE_SCALAR) && defined(__ARM_NEON)
+struct FloatLanes
+{
+    static const int width = 4;
+    float32x4_t v;
+
+    static FloatLanes load(const float *p)
+    {
+        return FloatLanes{vld1q_f32(p)};
+    }
+
+    static FloatLanes broadcast(float s)
+    {
+        return FloatLanes{vdupq_n_f32(s)};
+    }
+
+    void store(float *p) const
+    {
+        vst1q_f32(p, v);
+    }
+};
+
+inline FloatLanes operator+(FloatLanes a, FloatLanes b) { return FloatLanes{vaddq_f32(a.v, b.v)}; }
+inline FloatLanes operator-(FloatLanes a, FloatLanes b) { return FloatLanes{vsubq_f32(a.v, b.v)}; }
+inline FloatLanes operator*(FloatLanes a, FloatLanes b) { return FloatLanes{vmulq_f32(a.v, b.v)}; }
+inline FloatLanes lanesLess(FloatLanes a, FloatLanes b) { return FloatLanes{vreinterpretq_f32_u32(vcltq_f32(a.v, b.v))}; }
+inline FloatLanes lanesGreater(FloatLanes a, FloatLanes b) { return FloatLanes{vreinterpretq_f32_u32(vcgtq_f32(a.v, b.v))}; }
+inline FloatLanes lanesSelect(FloatLanes m, FloatLanes a, FloatLanes b) { return FloatLanes{vbslq_f32(vreinterpretq_u32_f32(m.v), a.v, b.v)}; }
+#else
+struct FloatLanes
+{
+    static const int width = 1;
+    float v;
+
+    static FloatLanes load(const float *p)
+    {
+        return FloatLanes{*p};
+    }
+
+    static FloatLanes broadcast(float s)
+    {
+        return FloatLanes{s};
+    }
+
+    void store(float *p) const
+    {
+        *p = v;
+    }
+};
+
+inline FloatLanes operator+(FloatLanes a, FloatLanes b) { return FloatLanes{a.v + b.v}; }
+inline FloatLanes operator-(FloatLanes a, FloatLanes b) { return FloatLanes{a.v - b.v}; }
+inline FloatLanes operator*(FloatLanes a, FloatLanes b) { return FloatLanes{a.v * b.v}; }
+inline FloatLanes lanesLess(FloatLanes a, FloatLanes b) { return FloatLanes{a.v < b.v ? 1.0f : 0.0f}; }
+inline FloatLanes lanesGreater(FloatLanes a, FloatLanes b) { return FloatLanes{a.v > b.v ? 1.0f : 0.0f}; }
+inline FloatLanes lanesSelect(FloatLanes m, FloatLanes a, FloatLanes b) { return FloatLanes{m.v != 0.0f ? a.v : b.v}; }
+#endif
+
+enum class NoiseMode
+{
+    Classic,
+    Value,
+    Perlin
+};
+
+const char *noiseModeName(NoiseMode m)
+{
+    switch (m)
+    {
+    case NoiseMode::Classic:
+        return "classic";
+    case NoiseMode::Value:
+        return "value";
+    case NoiseMode::Perlin:
+        return "perlin";
+    default:
+        return "?";
+    }
+}
+
+class NoiseField
+{
+    struct Octave
+    {
+        int cell;
+        float amplitude;
+        vector<float> ramp;
+        vector<float> fade;
+    };
+
+    struct InlineRunner
+    {
+        size_t size() const
+        {
+            return 1;
+        }
+
+        template <typename F>
+        void parallelFor(size_t n, F &&fn)
+        {
+            for (size_t t = 0; t < n; ++t)
+            {
+                fn(t);
+            }
+        }
+    };
+
+    static const int kLatticeCell = 64;
+
+    int width;
+    int height;
+    int originX;
+    int originY;
+    vector<float> values;
+
+    static float smooth(float t)
+    {
+        return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+    }
+
+    static uint64_t latticeHash(uint64_t key, int octave, int ix, int iy)
+    {
+        uint64_t k = splitmix64(key + static_cast<uint64_t>(octave) * 0x9E3779B97F4A7C15ull);
+        return splitmix64(k ^ (static_cast<uint64_t>(static_cast<uint32_t>(ix)) << 32 | static_cast<uint32_t>(iy)));
+    }
+
+    static float latticeValue(uint64_t key, int octave, int ix, int iy)
+    {
+        return static_cast<float>(static_cast<double>(latticeHash(key, octave, ix, iy) >> 11) * 0x1.0p-53);
+    }
+
+    static void latticeGradient(uint64_t key, int octave, int ix, int iy, float &gx, float &gy)
+    {
+        static const float dirs[8][2] = {
+            {1.0f, 0.0f},
+            {-1.0f, 0.0f},
+            {0.0f, 1.0f},
+            {0.0f, -1.0f},
+            {0.70710678f, 0.70710678f},
+            {-0.70710678f, 0.70710678f},
+            {0.70710678f, -0.70710678f},
+            {-0.70710678f, -0.70710678f}};
+        const float *d = dirs[latticeHash(key, octave, ix, iy) >> 61];
+        gx = d[0];
+        gy = d[1];
+    }
+
+    static void addScaled(float *acc, const float *src, float s, int n)
+    {
+        int x = 0;
+        FloatLanes vs = FloatLanes::broadcast(s);
+        for (; x + FloatLanes::width <= n; x += FloatLanes::width)
+        {
+            (FloatLanes::load(acc + x) + FloatLanes::load(src + x) * vs).store(acc + x);
+        }
+        for (; x < n; ++x)
+        {
+            acc[x] += src[x] * s;
+        }
+    }
+
+    static void addRamp(float *acc, const float *ramp, float a, float b, int n)
+    {
+        int x = 0;
+        FloatLanes va = FloatLanes::broadcast(a);
+        FloatLanes vb = FloatLanes::broadcast(b);
+        for (; x + FloatLanes::width <= n; x += FloatLanes::width)
+        {
+            (FloatLanes::load(acc + x) + va + vb * FloatLanes::load(ramp + x)).store(acc + x);
+        }
+        for (; x < n; ++x)
+        {
+            acc[x] += a + b * ramp[x];
+        }
+    }
+
+    static void addGradient(float *acc, const float *ramp, const float *fade, const float line[8], float fv, float amp, int n)
+    {
+        int x = 0;
+        FloatLanes p0 = FloatLanes::broadcast(line[0]), q0 = FloatLanes::broadcast(line[1]);
+        FloatLanes p1 = FloatLanes::broadcast(line[2]), q1 = FloatLanes::broadcast(line[3]);
+        FloatLanes p2 = FloatLanes::broadcast(line[4]), q2 = FloatLanes::broadcast(line[5]);
+        FloatLanes p3 = FloatLanes::broadcast(line[6]), q3 = FloatLanes::broadcast(line[7]);
+        FloatLanes vfv = FloatLanes::broadcast(fv);
+        FloatLanes vamp = FloatLanes::broadcast(amp);
+        for (; x + FloatLanes::width <= n; x += FloatLanes::width)
+        {
+            FloatLanes t = FloatLanes::load(ramp + x);
+            FloatLanes u = FloatLanes::load(fade + x);
+            FloatLanes a0 = p0 * t + q0;
+            FloatLanes a = a0 + u * (p1 * t + q1 - a0);
+            FloatLanes b0 = p2 * t + q2;
+            FloatLanes b = b0 + u * (p3 * t + q3 - b0);
+            (FloatLanes::load(acc + x) + vamp * (a + vfv * (b - a))).store(acc + x);
+        }
+        for (; x < n; ++x)
+        {
+            float t = ramp[x];
+            float u = fade[x];
+            float a0 = line[0] * t + line[1];
+            float a = a0 + u * (line[2] * t + line[3] - a0);
+            float b0 = line[4] * t + line[5];
+            float b = b0 + u * (line[6] * t + line[7] - b0);
+            acc[x] += amp * (a + fv * (b - a));
+        }
+    }
+
+    static void scaleOffset(float *out, const float *acc, float s, float o, int n)
+    {
+        int x = 0;
+        FloatLanes vs = FloatLanes::broadcast(s);
+        FloatLanes vo = FloatLanes::broadcast(o);
+        for (; x + FloatLanes::width <= n; x += FloatLanes::width)
+        {
+            (FloatLanes::load(acc + x) * vs + vo).store(out + x);
+        }
+        for (; x < n; ++x)
+        {
+            out[x] = acc[x] * s + o;
+        }
+    }
+
+    void classicRow(int y, const Octave &o, uint64_t key, uint64_t start, vector<float> &knots, float *acc) const
+    {
+        int step = o.cell;
+        auto base = [&](int bx, int by)
+        {
+            uint64_t i = static_cast<uint64_t>(by) * static_cast<uint64_t>(width) + static_cast<uint64_t>(bx);
+            return static_cast<float>(static_cast<double>(RNG::at(key, start + i) >> 11) * 0x1.0p-53);
+        };
+        int y0 = (y / step) * step;
+        int y1 = min(y0 + step, height - 1);
+        float fy = static_cast<float>(y - y0) / static_cast<float>(step);
+        int count = (width - 1) / step + 2;
+        knots.resize(static_cast<size_t>(count));
+        for (int j = 0; j < count; ++j)
+        {
+            int kx = min(j * step, width - 1);
+            float v0 = base(kx, y0);
+            knots[static_cast<size_t>(j)] = fy == 0.0f ? v0 : v0 + (base(kx, y1) - v0) * fy;
+        }
+        if (step == 1)
+        {
+            addScaled(acc, knots.data(), o.amplitude, width);
+            return;
+        }
+        for (int j = 0; j * step < width; ++j)
+        {
+            int x0 = j * step;
+            float r0 = knots[static_cast<size_t>(j)];
+            float r1 = knots[static_cast<size_t>(j + 1)];
+            addRamp(acc + x0, o.ramp.data(), o.amplitude * r0, o.amplitude * (r1 - r0), min(step, width - x0));
+        }
+    }
+
+    void valueRow(int y, int octave, const Octave &o, uint64_t key, vector<float> &knots, float *acc) const
+    {
+        int cell = o.cell;
+        int ix = originX / cell;
+        int iy = originY / cell + y / cell;
+        float fv = o.fade[static_cast<size_t>(y % cell)];
+        int count = (width - 1) / cell + 2;
+        knots.resize(static_cast<size_t>(count));
+        for (int j = 0; j < count; ++j)
+        {
+            float v0 = latticeValue(key, octave, ix + j, iy);
+            float v1 = latticeValue(key, octave, ix + j, iy + 1);
+            knots[static_cast<size_t>(j)] = v0 + (v1 - v0) * fv;
+        }
+        for (int j = 0; j * cell < width; ++j)
+        {
+            int x0 = j * cell;
+            float c0 = knots[static_cast<size_t>(j)];
+            float c1 = knots[static_cast<size_t>(j + 1)];
+            addRamp(acc + x0, o.fade.data(), o.amplitude * c0, o.amplitude * (c1 - c0), min(cell, width - x0));
+        }
+    }
+
+    void perlinRow(int y, int octave, const Octave &o, uint64_t key, vector<float> &knots, float *acc) const
+    {
+        int cell = o.cell;
+        int ix = originX / cell;
+        int iy = originY / cell + y / cell;
+        float fy = o.ramp[static_cast<size_t>(y % cell)];
+        float fv = o.fade[static_cast<size_t>(y % cell)];
+        int count = (width - 1) / cell + 2;
+        knots.resize(static_cast<size_t>(count) * 4);
+        for (int j = 0; j < count; ++j)
+        {
+            float *k = &knots[static_cast<size_t>(j) * 4];
+            latticeGradient(key, octave, ix + j, iy, k[0], k[1]);
+            latticeGradient(key, octave, ix + j, iy + 1, k[2], k[3]);
+        }
+        for (int j = 0; j * cell < width; ++j)
+        {
+            int x0 = j * cell;
+            const float *g0 = &knots[static_cast<size_t>(j) * 4];
+            const float *g1 = g0 + 4;
+            float line[8] = {
+                g0[0], g0[1] * fy,
+                g1[0], g1[1] * fy - g1[0],
+                g0[2], g0[3] * (fy - 1.0f),
+                g1[2], g1[3] * (fy - 1.0f) - g1[2]};
+            addGradient(acc + x0, o.ramp.data(), o.fade.data(), line, fv, o.amplitude, min(cell, width - x0));
+        }
+    }
+
+    template <typename Pool>
+    void build(uint64_t key, uint64_t start, int octaves, double persistence, NoiseMode mode, Pool &pool)
+    {
+        if (width <= 0 || height <= 0)
+        {
+            return;
+        }
+
+        vector<Octave> plan;
+        double amplitude = 1.0;
+        double totalAmplitude = 0.0;
+        for (int octave = 0; octave < octaves; ++octave)
+        {
+            Octave o;
+            o.cell = mode == NoiseMode::Classic ? (1 << octave) : max(1, kLatticeCell >> octave);
+            o.amplitude = static_cast<float>(amplitude);
+            o.ramp.resize(static_cast<size_t>(o.cell));
+            o.fade.resize(static_cast<size_t>(o.cell));
+            for (int k = 0; k < o.cell; ++k)
+            {
+                float t = static_cast<float>(k) / static_cast<float>(o.cell);
+                o.ramp[static_cast<size_t>(k)] = t;
+                o.fade[static_cast<size_t>(k)] = smooth(t);
+            }
+            plan.push_back(move(o));
+            totalAmplitude += amplitude;
+            amplitude *= persistence;
+        }
+
+        float scale = totalAmplitude > 0.0 ? static_cast<float>(1.0 / totalAmplitude) : 0.0f;
+        float offset = 0.0f;
+        if (mode == NoiseMode::Perlin)
+        {
+            scale *= 0.70710678f;
+            offset = 0.5f;
+        }
+
+        size_t bands = min(pool.size() * 4, static_cast<size_t>(height));
+        size_t rows = (static_cast<size_t>(height) + bands - 1) / bands;
+        pool.parallelFor(bands, [&](size_t b)
+                         {
+                             vector<float> acc(static_cast<size_t>(width));
+                             vector<float> knots;
+                             int y0 = static_cast<int>(b * rows);
+                             int y1 = min(height, static_cast<int>((b + 1) * rows));
+                             for (int y = y0; y < y1; ++y)
+                             {
+                                 fill(acc.begin(), acc.end(), 0.0f);
+                                 for (size_t octave = 0; octave < plan.size(); ++octave)
+                                 {
+                                     const Octave &o = plan[octave];
+                                     if (mode == NoiseMode::Classic)
+                                     {
+                                         classicRow(y, o, key, start, knots, acc.data());
+                                     }
+                                     else if (mode == NoiseMode::Value)
+                                     {
+                                         valueRow(y, static_cast<int>(octave), o, key, knots, acc.data());
+                                     }
+                                     else
+                                     {
+                                         perlinRow(y, static_cast<int>(octave), o, key, knots, acc.data());
+                                     }
+                                 }
+                                 scaleOffset(&values[static_cast<size_t>(y) * static_cast<size_t>(width)], acc.data(), scale, offset, width);
+                             }
+                         });
+    }
+
+public:
+    NoiseField(int w = 0, int h = 0)
+        : width(w), height(h), originX(0), originY(0), values(static_cast<size_t>(w * h), 0.0f)
+    {
+    }
+
+    static int latticeCell()
+    {
+        return kLatticeCell;
+    }
+
+    void setOrigin(int x, int y)
+    {
+        originX = x;
+        originY = y;
+    }
+
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        values.assign(static_cast<size_t>(w * h), 0.0f);
+    }
+
+    float &at(int x, int y)
+    {
+        return values[static_cast<size_t>(y * width + x)];
+    }
+
+    const float &at(int x, int y) const
+    {
+        return values[static_cast<size_t>(y * width + x)];
+    }
+
+    template <typename Out>
+    void save(Out &out) const
+    {
+        out.value(static_cast<int32_t>(width));
+        out.value(static_cast<int32_t>(height));
+        out.value(static_cast<int32_t>(originX));
+        out.value(static_cast<int32_t>(originY));
+        out.array(values);
+    }
+
+    template <typename In>
+    bool load(In &in)
+    {
+        int32_t w = 0;
+        int32_t h = 0;
+        int32_t ox = 0;
+        int32_t oy = 0;
+        if (!in.value(w) || !in.value(h) || !in.value(ox) || !in.value(oy) || w < 0 || h < 0 ||
+            !in.array(values, static_cast<size_t>(w) * static_cast<size_t>(h)))
+        {
+            return false;
+        }
+        width = w;
+        height = h;
+        originX = ox;
+        originY = oy;
+        return true;
+    }
+
+    int getWidth() const
+    {
+        return width;
+    }
+
+    int getHeight() const
+    {
+        return height;
+    }
+
+    void generate(RNG &rng, int octaves, double persistence, NoiseMode mode = NoiseMode::Classic)
+    {
+        InlineRunner runner;
+        generate(rng, octaves, persistence, mode, runner);
+    }
+
+    template <typename Pool>
+    void generate(RNG &rng, int octaves, double persistence, NoiseMode mode, Pool &pool)
+    {
+        if (width <= 0 || height <= 0)
+        {
+            return;
+        }
+        if (mode == NoiseMode::Classic)
+        {
+            uint64_t start = rng.counter;
+            rng.skip(values.size());
+            build(rng.key, start, octaves, persistence, mode, pool);
+        }
+        else
+        {
+            build(rng.next(), 0, octaves, persistence, mode, pool);
+        }
+    }
+
+    void generateLattice(uint64_t key, int octaves, double persistence, NoiseMode mode)
+    {
+        InlineRunner runner;
+        build(key, 0, octaves, persistence, mode == NoiseMode::Classic ? NoiseMode::Value : mode, runner);
+    }
+};
+
+CellType layoutType(double v)
+{
+    if (v < 0.12)
+    {
+        return CellType::Wall;
+    }
+    if (v > 0.88)
+    {
+        return CellType::MarkerC;
+    }
+    if (v > 0.72)
+    {
+        return CellType::MarkerB;
+    }
+    if (v > 0.55)
+    {
+        return CellType::MarkerA;
+    }
+    return CellType::Empty;
+}
+
+class ChunkMap
+{
+public:
+    static const int kChunkShift = 6;
+    static const int kChunkSize = 1 << kChunkShift;
+
+private:
+    struct Chunk
+    {
+        vector<CellType> types;
+        vector<CellValue> value1;
+        vector<pair<CellType, uint16_t>> packed;
+        bool modified;
+        bool compressed;
+        uint64_t lastUse;
+    };
+
+    unordered_map<uint64_t, Chunk> chunks;
+    uint64_t key;
+    int octaves;
+    double persistence;
+    NoiseMode mode;
+    size_t budget;
+    size_t resident;
+    size_t generated;
+    uint64_t clock;
+
+    static uint64_t chunkKey(int cx, int cy)
+    {
+        return static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32 | static_cast<uint32_t>(cy);
+    }
+
+    static size_t localIndex(const Vec2 &p)
+    {
+        return static_cast<size_t>(p.y & (kChunkSize - 1)) * kChunkSize + static_cast<size_t>(p.x & (kChunkSize - 1));
+    }
+
+    void generateValues(int cx, int cy, Chunk &c) const
+    {
+        NoiseField n(kChunkSize, kChunkSize);
+        n.setOrigin(cx * kChunkSize, cy * kChunkSize);
+        n.generateLattice(key, octaves, persistence, mode);
+        c.value1.resize(static_cast<size_t>(kChunkSize * kChunkSize));
+        for (int y = 0; y < kChunkSize; ++y)
+        {
+            for (int x = 0; x < kChunkSize; ++x)
+            {
+                c.value1[static_cast<size_t>(y * kChunkSize + x)] = n.at(x, y);
+            }
+        }
+    }
+
+    void pack(Chunk &c)
+    {
+        c.packed.clear();
+        for (CellType t : c.types)
+        {
+            if (!c.packed.empty() && c.packed.back().first == t && c.packed.back().second != UINT16_MAX)
+            {
+                ++c.packed.back().second;
+            }
+            else
+            {
+                c.packed.emplace_back(t, 1);
+            }
+        }
+        c.packed.shrink_to_fit();
+        vector<CellType>().swap(c.types);
+        vector<CellValue>().swap(c.value1);
+        c.compressed = true;
+        --resident;
+    }
+
+    void unpack(int cx, int cy, Chunk &c)
+    {
+        c.types.clear();
+        c.types.reserve(static_cast<size_t>(kChunkSize * kChunkSize));
+        for (const auto &run : c.packed)
+        {
+            c.types.insert(c.types.end(), run.second, run.first);
+        }
+        vector<pair<CellType, uint16_t>>().swap(c.packed);
+        generateValues(cx, cy, c);
+        c.compressed = false;
+        ++resident;
+    }
+
+    Chunk &fetch(const Vec2 &p)
+    {
+        int cx = p.x >> kChunkShift;
+        int cy = p.y >> kChunkShift;
+        auto it = chunks.find(chunkKey(cx, cy));
+        if (it == chunks.end())
+        {
+            Chunk c;
+            generateValues(cx, cy, c);
+            c.types.resize(c.value1.size());
+            for (size_t i = 0; i < c.value1.size(); ++i)
+            {
+                c.types[i] = layoutType(c.value1[i]);
+            }
+            c.modified = false;
+            c.compressed = false;
+            ++resident;
+            ++generated;
+            it = chunks.emplace(chunkKey(cx, cy), move(c)).first;
+        }
+        else if (it->second.compressed)
+        {
+            unpack(cx, cy, it->second);
+        }
+        it->second.lastUse = clock;
+        return it->second;
+    }
+
+public:
+    ChunkMap()
+        : key(0), octaves(5), persistence(0.5), mode(NoiseMode::Value), budget(64), resident(0), generated(0), clock(0)
+    {
+    }
+
+    void reset(uint64_t terrainKey, int noiseOctaves, double noisePersistence, NoiseMode noiseMode, size_t residentBudget)
+    {
+        chunks.clear();
+        key = terrainKey;
+        octaves = noiseOctaves;
+        persistence = noisePersistence;
+        mode = noiseMode;
+        budget = max<size_t>(residentBudget, 1);
+        resident = 0;
+        generated = 0;
+        clock = 0;
+    }
+
+    CellType type(const Vec2 &p)
+    {
+        return fetch(p).types[localIndex(p)];
+    }
+
+    CellValue value1(const Vec2 &p)
+    {
+        return fetch(p).value1[localIndex(p)];
+    }
+
+    void setType(const Vec2 &p, CellType t)
+    {
+        Chunk &c = fetch(p);
+        CellType &slot = c.types[localIndex(p)];
+        if (slot != t)
+        {
+            slot = t;
+            c.modified = true;
+        }
+    }
+
+    void loadRegion(Grid &grid, const Vec2 &origin)
+    {
+        ++clock;
+        for (int y = 0; y < grid.getHeight(); ++y)
+        {
+            GridRow row = grid.row(y);
+            int x = 0;
+            while (x < row.width)
+            {
+                Vec2 w = origin + Vec2(x, y);
+                const Chunk &c = fetch(w);
+                size_t i = localIndex(w);
+                int run = min(row.width - x, kChunkSize - (w.x & (kChunkSize - 1)));
+                for (int k = 0; k < run; ++k, ++x, ++i)
+                {
+                    grid.setType(Vec2(x, y), c.types[i]);
+                    row.value1[x] = c.value1[i];
+                    row.value2[x] = 0.0;
+                }
+            }
+        }
+        grid.markWallsChanged();
+        trim();
+    }
+
+    void storeRegion(const Grid &grid, const Vec2 &origin, int margin)
+    {
+        ++clock;
+        for (int y = margin; y < grid.getHeight() - margin; ++y)
+        {
+            for (int x = margin; x < grid.getWidth() - margin; ++x)
+            {
+                CellType t = grid.type(Vec2(x, y));
+                if (t == CellType::Trail || t == CellType::Signal || t == CellType::Source || t == CellType::Sink)
+                {
+                    continue;
+                }
+                setType(origin + Vec2(x, y), t);
+            }
+        }
+        trim();
+    }
+
+    void trim()
+    {
+        while (resident > budget)
+        {
+            auto victim = chunks.end();
+            for (auto it = chunks.begin(); it != chunks.end(); ++it)
+            {
+                if (!it->second.compressed && it->second.lastUse != clock && (victim == chunks.end() || it->second.lastUse < victim->second.lastUse))
+                {
+                    victim = it;
+                }
+            }
+            if (victim == chunks.end())
+            {
+                return;
+            }
+            if (victim->second.modified)
+            {
+                pack(victim->second);
+            }
+            else
+            {
+                chunks.erase(victim);
+                --resident;
+            }
+        }
+    }
+
+    size_t chunkCount() const
+    {
+        return chunks.size();
+    }
+
+    size_t residentCount() const
+    {
+        return resident;
+    }
+
+    size_t generatedCount() const
+    {
+        return generated;
+    }
+
+    size_t memoryBytes() const
+    {
+        size_t bytes = 0;
+        for (const auto &kv : chunks)
+        {
+            bytes += kv.second.types.capacity() * sizeof(CellType) + kv.second.value1.capacity() * sizeof(CellValue) +
+                     kv.second.packed.capacity() * sizeof(pair<CellType, uint16_t>);
+        }
+        return bytes;
+    }
+};
+
+class World;
+
+class Agent : public Entity
+{
+public:
+    Agent(EntityId id_, const Vec2 &pos, AgentColumns *home = nullptr)
+        : Entity(id_, pos, home)
+    {
+    }
+
+    void setSpeed(double s)
+    {
+        cols->speed[row] = s;
+    }
+
+    double getSpeed() const
+    {
+        return cols->speed[row];
+    }
+
+    const Vec2 &getVelocity() const
+    {
+        return cols->velocity[row];
+    }
+
+    void setVelocity(const Vec2 &v)
+    {
+        cols->velocity[row] = v;
+    }
+
+    double getPhase() const
+    {
+        return cols->phase[row];
+    }
+
+    RNG localRng(uint64_t seed, int tick, uint64_t purpose = 0) const
+    {
+        return RNG::forEntity(seed, id.key(), tick, purpose);
+    }
+
+    virtual AgentKind kind() const = 0;
+
+    virtual void initState(RNG &rng)
+    {
+        (void)rng;
+    }
+
+    virtual void onEvent(World &world, const Event &e) = 0;
+
+    virtual unsigned eventMask() const
+    {
+        return 0;
+    }
+
+    template <typename Ctx>
+    static void stepPosition(Ctx &world, AgentColumns &c, size_t r, double dt);
+
+    void stepPosition(World &world, double dt)
+    {
+        stepPosition(world, *cols, row, dt);
+    }
+
+    virtual ~Agent() {}
+};
+
+class Wanderer : public Agent
+{
+public:
+    static const AgentKind Kind = AgentKind::Wanderer;
+
+    Wanderer(EntityId id_, const Vec2 &pos, AgentColumns *home = nullptr)
+        : Agent(id_, pos, home)
+    {
+        setSpeed(1.0);
+    }
+
+    void initState(RNG &rng) override
+    {
+        cols->phase[row] = rng.realRange(0.0, 1000.0);
+    }
+
+    template <typename Ctx>
+    static void updateRow(Ctx &world, AgentColumns &c, size_t r, double dt);
+
+    void update(World &world, double dt) override
+    {
+        updateRow(world, *cols, row, dt);
+    }
+
+    AgentKind kind() const override
+    {
+        return Kind;
+    }
+
+    char glyph() const override
+    {
+        return 'w';
+    }
+
+    void onEvent(World &world, const Event &e) override;
+};
+
+class Seeker : public Agent
+{
+public:
+    static const AgentKind Kind = AgentKind::Seeker;
+
+    Seeker(EntityId id_, const Vec2 &pos, AgentColumns *home = nullptr)
+        : Agent(id_, pos, home)
+    {
+        setSpeed(2.0);
+    }
+
+    void setTarget(const Vec2 &t)
+    {
+        cols->target[row] = t;
+        cols->hasTarget[row] = 1;
+    }
+
+    const Vec2 &getTarget() const
+    {
+        return cols->target[row];
+    }
+
+    bool hasTarget() const
+    {
+        return cols->hasTarget[row] != 0;
+    }
+
+    template <typename Ctx>
+    static void updateRow(Ctx &world, AgentColumns &c, size_t r, double dt);
+
+    template <typename Ctx>
+    static void updateRows(Ctx &world, AgentColumns &c, const uint32_t *rows, size_t n, double dt);
+
+    void update(World &world, double dt) override
+    {
+        updateRow(world, *cols, row, dt);
+    }
+
+    AgentKind kind() const override
+    {
+        return Kind;
+    }
+
+    char glyph() const override
+    {
+        return 's';
+    }
+
+    void onEvent(World &world, const Event &e) override;
+
+    unsigned eventMask() const override
+    {
+        return eventBit(EventType::Ping);
+    }
+};
+
+class TrailMaker : public Agent
+{
+public:
+    static const AgentKind Kind = AgentKind::TrailMaker;
+
+    TrailMaker(EntityId id_, const Vec2 &pos, AgentColumns *home = nullptr)
+        : Agent(id_, pos, home)
+    {
+        setSpeed(1.5);
+    }
+
+    template <typename Ctx>
+    static void updateRow(Ctx &world, AgentColumns &c, size_t r, double dt);
+
+    template <typename Ctx>
+    static void updateRows(Ctx &world, AgentColumns &c, const uint32_t *rows, size_t n, double dt);
+
+    void update(World &world, double dt) override
+    {
+        updateRow(world, *cols, row, dt);
+    }
+
+    AgentKind kind() const override
+    {
+        return Kind;
+    }
+
+    char glyph() const override
+    {
+        return 't';
+    }
+
+    void onEvent(World &world, const Event &e) override;
+};
+
+class SignalSource : public Agent
+{
+public:
+    static const AgentKind Kind = AgentKind::SignalSource;
+
+    SignalSource(EntityId id_, const Vec2 &pos, AgentColumns *home = nullptr)
+        : Agent(id_, pos, home)
+    {
+        setSpeed(0.0);
+        cols->cooldown[row] = 1.0;
+        cols->timer[row] = 0.0;
+    }
+
+    template <typename Ctx>
+    static void updateRow(Ctx &world, AgentColumns &c, size_t r, double dt);
+
+    void update(World &world, double dt) override
+    {
+        updateRow(world, *cols, row, dt);
+    }
+
+    AgentKind kind() const override
+    {
+        return Kind;
+    }
+
+    char glyph() const override
+    {
+        return 'o';
+    }
+
+    void onEvent(World &world, const Event &e) override;
+};
+
+class SignalSink : public Agent
+{
+public:
+    static const AgentKind Kind = AgentKind::SignalSink;
+
+    SignalSink(EntityId id_, const Vec2 &pos, AgentColumns *home = nullptr)
+        : Agent(id_, pos, home)
+    {
+        setSpeed(0.0);
+    }
+
+    template <typename Ctx>
+    static void updateRow(Ctx &world, AgentColumns &c, size_t r, double dt)
+    {
+        (void)world;
+        (void)c;
+        (void)r;
+        (void)dt;
+    }
+
+    void update(World &world, double dt) override
+    {
+        updateRow(world, *cols, row, dt);
+    }
+
+    AgentKind kind() const override
+    {
+        return Kind;
+    }
+
+    char glyph() const override
+    {
+        return 'x';
+    }
+
+    void onEvent(World &world, const Event &e) override;
+
+    unsigned eventMask() const override
+    {
+        return eventBit(EventType::Arrive);
+    }
+};
+
+enum class ProfilePhase
+{
+    Tick,
+    EventFlip,
+    EventDispatch,
+    Wanderers,
+    Seekers,
+    TrailMakers,
+    SignalSources,
+    SignalSinks,
+    TiledAgents,
+    Unmanaged,
+    RemoveDead,
+    Evaporate,
+    Render,
+    Count
+};
+
+enum class ProfileCounter
+{
+    EventsDispatched,
+    AgentsUpdated,
+    EntitiesRemoved,
+    DecayingCells,
+    BytesRendered,
+    Count
+};
+
+const char *profilePhaseName(ProfilePhase p)
+{
+    static const char *names[] = {
+        "tick",
+        "event.flip",
+        "event.dispatch",
+        "agents.wanderer",
+        "agents.seeker",
+        "agents.trailmaker",
+        "agents.signalsource",
+        "agents.signalsink",
+        "agents.tiled",
+        "unmanaged",
+        "removeDead",
+        "evaporateTrails",
+        "render"};
+    return names[static_cast<size_t>(p)];
+}
+
+const char *profileCounterName(ProfileCounter c)
+{
+    static const char *names[] = {
+        "events dispatched",
+        "agents updated",
+        "entities removed",
+        "decaying cells",
+        "bytes rendered"};
+    return names[static_cast<size_t>(c)];
+}
+
+class Profiler
+{
+public:
+    static const int kBuckets = 64 * 4;
+
+    struct PhaseStats
+    {
+        uint64_t count;
+        uint64_t totalNs;
+        uint64_t maxNs;
+        uint32_t buckets[kBuckets];
+    };
+
+    struct TraceEvent
+    {
+        ProfilePhase phase;
+        uint64_t startNs;
+        uint64_t durNs;
+    };
+
+private:
+    PhaseStats phases[static_cast<size_t>(ProfilePhase::Count)];
+    uint64_t counters[static_cast<size_t>(ProfileCounter::Count)];
+    vector<TraceEvent> trace;
+    size_t traceLimit;
+    uint64_t droppedTrace;
+    chrono::steady_clock::time_point epoch;
+
+    static int bucketOf(uint64_t ns)
+    {
+        if (ns < 4)
+        {
+            return static_cast<int>(ns);
+        }
+        int log = 63 - __builtin_clzll(ns);
+        return min(kBuckets - 1, log * 4 + static_cast<int>((ns >> (log - 2)) & 3));
+    }
+
+    static double bucketMidNs(int b)
+    {
+        if (b < 4)
+        {
+            return b;
+        }
+        int log = b / 4;
+        double lo = ldexp(1.0 + (b % 4) / 4.0, log);
+        return lo + ldexp(0.125, log);
+    }
+
+    // Shared by every thread's profiler so merged traces line up
+    static chrono::steady_clock::time_point processEpoch()
+    {
+        static const chrono::steady_clock::time_point t = chrono::steady_clock::now();
+        return t;
+    }
+
+public:
+    Profiler() : traceLimit(1 << 20), droppedTrace(0), epoch(processEpoch())
+    {
+        reset();
+    }
+
+    // One per thread, so Worlds stepped on different threads never share
+    // counters; combine them afterwards with merge().
+    static Profiler &instance()
+    {
+        static thread_local Profiler profiler;
+        return profiler;
+    }
+
+    void merge(const Profiler &other)
+    {
+        for (size_t i = 0; i < static_cast<size_t>(ProfilePhase::Count); ++i)
+        {
+            PhaseStats &s = phases[i];
+            const PhaseStats &o = other.phases[i];
+            s.count += o.count;
+            s.totalNs += o.totalNs;
+            s.maxNs = max(s.maxNs, o.maxNs);
+            for (int b = 0; b < kBuckets; ++b)
+            {
+                s.buckets[b] += o.buckets[b];
+            }
+        }
+        for (size_t i = 0; i < static_cast<size_t>(ProfileCounter::Count); ++i)
+        {
+            counters[i] += other.counters[i];
+        }
+        size_t room = traceLimit - min(traceLimit, trace.size());
+        size_t take = min(room, other.trace.size());
+        trace.insert(trace.end(), other.trace.begin(), other.trace.begin() + static_cast<ptrdiff_t>(take));
+        droppedTrace += other.droppedTrace + (other.trace.size() - take);
+    }
+
+    uint64_t now() const
+    {
+        return static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - epoch).count());
+    }
+
+    void record(ProfilePhase p, uint64_t start, uint64_t end)
+    {
+        uint64_t ns = end - start;
+        PhaseStats &s = phases[static_cast<size_t>(p)];
+        ++s.count;
+        s.totalNs += ns;
+        s.maxNs = max(s.maxNs, ns);
+        ++s.buckets[bucketOf(ns)];
+        if (trace.size() < traceLimit)
+        {
+            trace.push_back(TraceEvent{p, start, ns});
+        }
+        else
+        {
+            ++droppedTrace;
+        }
+    }
+
+    void count(ProfileCounter c, uint64_t n)
+    {
+        counters[static_cast<size_t>(c)] += n;
+    }
+
+    void reset()
+    {
+        memset(phases, 0, sizeof(phases));
+        memset(counters, 0, sizeof(counters));
+        trace.clear();
+        droppedTrace = 0;
+    }
+
+    double percentileNs(ProfilePhase p, double q) const
+    {
+        const PhaseStats &s = phases[static_cast<size_t>(p)];
+        if (s.count == 0)
+        {
+            return 0.0;
+        }
+        uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(s.count - 1));
+        uint64_t seen = 0;
+        for (int b = 0; b < kBuckets; ++b)
+        {
+            seen += s.buckets[b];
+            if (seen > rank)
+            {
+                return min(bucketMidNs(b), static_cast<double>(s.maxNs));
+            }
+        }
+        return static_cast<double>(s.maxNs);
+    }
+
+    void report(ostream &os) const
+    {
+#if !defined(SIM_PROFILE)
+        os << "profiling is compiled out; rebuild with -DSIM_PROFILE\n";
+#endif
+        uint64_t ticks = phases[static_cast<size_t>(ProfilePhase::Tick)].count;
+        os << left << setw(22) << "phase" << right << setw(10) << "calls" << setw(12) << "mean us"
+           << setw(12) << "p50 us" << setw(12) << "p99 us" << setw(12) << "max us" << "\n";
+        for (size_t i = 0; i < static_cast<size_t>(ProfilePhase::Count); ++i)
+        {
+            const PhaseStats &s = phases[i];
+            if (s.count == 0)
+            {
+                continue;
+            }
+            ProfilePhase p = static_cast<ProfilePhase>(i);
+            os << left << setw(22) << profilePhaseName(p) << right << setw(10) << s.count << fixed << setprecision(2)
+               << setw(12) << s.totalNs / 1000.0 / static_cast<double>(s.count)
+               << setw(12) << percentileNs(p, 0.50) / 1000.0
+               << setw(12) << percentileNs(p, 0.99) / 1000.0
+               << setw(12) << s.maxNs / 1000.0 << defaultfloat << "\n";
+        }
+        for (size_t i = 0; i < static_cast<size_t>(ProfileCounter::Count); ++i)
+        {
+            if (counters[i] == 0)
+            {
+                continue;
+            }
+            os << left << setw(22) << profileCounterName(static_cast<ProfileCounter>(i)) << right << setw(10) << counters[i];
+            if (ticks > 0)
+            {
+                os << "  (" << static_cast<double>(counters[i]) / static_cast<double>(ticks) << " per tick)";
+            }
+            os << "\n";
+        }
+        os << "trace events: " << trace.size() << (droppedTrace > 0 ? " (" + to_string(droppedTrace) + " dropped)" : string()) << "\n";
+    }
+
+    bool exportTrace(const string &path) const
+    {
+        ofstream out(path);
+        if (!out)
+        {
+            return false;
+        }
+        out << "{\"traceEvents\":[";
+        out << fixed << setprecision(3);
+        for (size_t i = 0; i < trace.size(); ++i)
+        {
+            const TraceEvent &e = trace[i];
+            out << (i == 0 ? "\n" : ",\n") << "{\"name\":\"" << profilePhaseName(e.phase) << "\",\"ph\":\"X\",\"ts\":"
+                << e.startNs / 1000.0 << ",\"dur\":" << e.durNs / 1000.0 << ",\"pid\":1,\"tid\":1}";
+        }
+        out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+        return static_cast<bool>(out);
+    }
+};
+
+class ProfileScope
+{
+    ProfilePhase phase;
+    uint64_t start;
+
+public:
+    explicit ProfileScope(ProfilePhase p) : phase(p), start(Profiler::instance().now()) {}
+
+    ~ProfileScope()
+    {
+        Profiler &profiler = Profiler::instance();
+        profiler.record(phase, start, profiler.now());
+    }
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+};
+
+#if defined(SIM_PROFILE)
+#define PROFILE_JOIN_INNER(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN_INNER(a, b)
+#define PROFILE_SCOPE(phase) ProfileScope PROFILE_JOIN(profileScope, __LINE__)(ProfilePhase::phase)
+#define PROFILE_COUNT(counter, n) Profiler::instance().count(ProfileCounter::counter, static_cast<uint64_t>(n))
+#else
+#define PROFILE_SCOPE(phase) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)sizeof(n))
+#endif
+
+class EntityPool
+{
+    static const size_t kBlockSlots = 256;
+    static const size_t kSlotBytes = 64;
+
+    struct alignas(max_align_t) SlotStorage
+    {
+        unsigned char bytes[kSlotBytes];
+    };
+
+    struct Slot
+    {
+        Entity *entity;
+        Agent *agent;
+        uint32_t generation;
+        uint32_t nextFree;
+    };
+
+    vector<Slot> slots;
+    vector<unique_ptr<SlotStorage[]>> blocks;
+    uint32_t freeHead;
+    size_t live;
+
+    void *storageFor(uint32_t index)
+    {
+        return blocks[index / kBlockSlots][index % kBlockSlots].bytes;
+    }
+
+    uint32_t acquire()
+    {
+        if (freeHead != 0)
+        {
+            uint32_t index = freeHead;
+            freeHead = slots[index].nextFree;
+            return index;
+        }
+        uint32_t index = static_cast<uint32_t>(slots.size());
+        slots.push_back(Slot{nullptr, nullptr, 0, 0});
+        if (index / kBlockSlots >= blocks.size())
+        {
+            blocks.emplace_back(new SlotStorage[kBlockSlots]);
+        }
+        return index;
+    }
+
+    template <typename T, typename... Args>
+    T *construct(uint32_t index, Args &&...args)
+    {
+        static_assert(sizeof(T) <= kSlotBytes && alignof(T) <= alignof(SlotStorage), "entity type does not fit a pool slot");
+        Slot &s = slots[index];
+        T *obj = new (storageFor(index)) T(EntityId(index, s.generation), forward<Args>(args)...);
+        s.entity = obj;
+        s.agent = dynamic_cast<Agent *>(static_cast<Entity *>(obj));
+        ++live;
+        return obj;
+    }
+
+    const Slot *find(EntityId id) const
+    {
+        if (id.index == 0 || id.index >= slots.size())
+        {
+            return nullptr;
+        }
+        const Slot &s = slots[id.index];
+        return (s.entity && s.generation == id.generation) ? &s : nullptr;
+    }
+
+public:
+    EntityPool()
+        : freeHead(0), live(0)
+    {
+        slots.push_back(Slot{nullptr, nullptr, 0, 0});
+    }
+
+    EntityPool(const EntityPool &) = delete;
+    EntityPool &operator=(const EntityPool &) = delete;
+
+    ~EntityPool()
+    {
+        clear();
+    }
+
+    template <typename T, typename... Args>
+    T *create(Args &&...args)
+    {
+        return construct<T>(acquire(), forward<Args>(args)...);
+    }
+
+    template <typename T, typename... Args>
+    T *createAt(EntityId id, Args &&...args)
+    {
+        if (id.index == 0 || id.index >= slots.size() || slots[id.index].entity || slots[id.index].generation != id.generation)
+        {
+            return nullptr;
+        }
+        return construct<T>(id.index, forward<Args>(args)...);
+    }
+
+    void release(EntityId id)
+    {
+        if (!find(id))
+        {
+            return;
+        }
+        Slot &s = slots[id.index];
+        s.entity->~Entity();
+        s.entity = nullptr;
+        s.agent = nullptr;
+        ++s.generation;
+        s.nextFree = freeHead;
+        freeHead = id.index;
+        --live;
+    }
+
+    void clear()
+    {
+        for (size_t i = 1; i < slots.size(); ++i)
+        {
+            if (slots[i].entity)
+            {
+                slots[i].entity->~Entity();
+            }
+        }
+        slots.resize(1);
+        freeHead = 0;
+        live = 0;
+    }
+
+    template <typename Out>
+    void saveSlots(Out &out) const
+    {
+        vector<uint32_t> generations;
+        vector<uint32_t> freeList;
+        generations.reserve(slots.size());
+        for (const Slot &s : slots)
+        {
+            generations.push_back(s.generation);
+        }
+        for (uint32_t i = freeHead; i != 0; i = slots[i].nextFree)
+        {
+            freeList.push_back(i);
+        }
+        out.array(generations);
+        out.array(freeList);
+    }
+
+    bool restoreSlots(const vector<uint32_t> &generations, const vector<uint32_t> &freeList)
+    {
+        for (uint32_t i : freeList)
+        {
+            if (i == 0 || i >= generations.size())
+            {
+                return false;
+            }
+        }
+        clear();
+        slots.assign(max(generations.size(), size_t(1)), Slot{nullptr, nullptr, 0, 0});
+        for (size_t i = 0; i < generations.size(); ++i)
+        {
+            slots[i].generation = generations[i];
+        }
+        while (blocks.size() * kBlockSlots < slots.size())
+        {
+            blocks.emplace_back(new SlotStorage[kBlockSlots]);
+        }
+        for (size_t k = freeList.size(); k-- > 0;)
+        {
+            slots[freeList[k]].nextFree = freeHead;
+            freeHead = freeList[k];
+        }
+        return true;
+    }
+
+    Entity *get(EntityId id) const
+    {
+        const Slot *s = find(id);
+        return s ? s->entity : nullptr;
+    }
+
+    Agent *agent(EntityId id) const
+    {
+        const Slot *s = find(id);
+        return s ? s->agent : nullptr;
+    }
+
+    size_t size() const
+    {
+        return live;
+    }
+
+    size_t capacity() const
+    {
+        return slots.size() - 1;
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const
+    {
+        for (size_t i = 1; i < slots.size(); ++i)
+        {
+            if (slots[i].entity)
+            {
+                fn(*slots[i].entity);
+            }
+        }
+    }
+};
+
+class AgentStore
+{
+    AgentColumns columns[static_cast<size_t>(AgentKind::Count)];
+    vector<uint32_t> batchRows;
+
+    template <typename K>
+    static void runKernel(World &world, AgentColumns &c, double dt)
+    {
+        for (size_t r = 0; r < c.size(); ++r)
+        {
+            if (c.alive[r])
+            {
+                K::updateRow(world, c, r, dt);
+            }
+        }
+    }
+
+    template <typename K>
+    void runBatchKernel(World &world, AgentColumns &c, double dt)
+    {
+        batchRows.clear();
+        for (size_t r = 0; r < c.size(); ++r)
+        {
+            if (c.alive[r])
+            {
+                batchRows.push_back(static_cast<uint32_t>(r));
+            }
+        }
+        K::updateRows(world, c, batchRows.data(), batchRows.size(), dt);
+    }
+
+public:
+    AgentColumns &of(AgentKind k)
+    {
+        return columns[static_cast<size_t>(k)];
+    }
+
+    const AgentColumns &of(AgentKind k) const
+    {
+        return columns[static_cast<size_t>(k)];
+    }
+
+    void adopt(Agent &agent)
+    {
+        AgentColumns &dst = of(agent.kind());
+        if (&agent.storage() == &dst)
+        {
+            return;
+        }
+        size_t r = dst.pushFrom(agent.storage(), agent.storageRow());
+        agent.bindStorage(&dst, r);
+    }
+
+    size_t size() const
+    {
+        size_t n = 0;
+        for (const auto &c : columns)
+        {
+            n += c.size();
+        }
+        return n;
+    }
+
+    size_t deadCount() const
+    {
+        size_t n = 0;
+        for (const auto &c : columns)
+        {
+            n += c.dead;
+        }
+        return n;
+    }
+
+    void removeDead(vector<EntityId> &removed)
+    {
+        for (auto &c : columns)
+        {
+            if (c.dead == 0)
+            {
+                continue;
+            }
+            size_t w = 0;
+            for (size_t r = 0; r < c.size(); ++r)
+            {
+                if (!c.alive[r])
+                {
+                    removed.push_back(c.id[r]);
+                    continue;
+                }
+                if (w != r)
+                {
+                    c.moveRow(r, w);
+                    c.facade[w]->bindStorage(&c, w);
+                }
+                ++w;
+            }
+            c.truncate(w);
+            c.dead = 0;
+        }
+    }
+
+    void clear()
+    {
+        for (auto &c : columns)
+        {
+            c.clear();
+        }
+    }
+
+    void update(World &world, double dt)
+    {
+        {
+            PROFILE_SCOPE(Wanderers);
+            runKernel<Wanderer>(world, of(AgentKind::Wanderer), dt);
+        }
+        {
+            PROFILE_SCOPE(Seekers);
+            runBatchKernel<Seeker>(world, of(AgentKind::Seeker), dt);
+        }
+        {
+            PROFILE_SCOPE(TrailMakers);
+            runBatchKernel<TrailMaker>(world, of(AgentKind::TrailMaker), dt);
+        }
+        {
+            PROFILE_SCOPE(SignalSources);
+            runKernel<SignalSource>(world, of(AgentKind::SignalSource), dt);
+        }
+        {
+            PROFILE_SCOPE(SignalSinks);
+            runKernel<SignalSink>(world, of(AgentKind::SignalSink), dt);
+        }
+    }
+};
+
+class EventRouter
+{
+    vector<Agent *> subscribers[static_cast<size_t>(EventType::Count)];
+    size_t delivered;
+
+    static Agent *resolve(const EntityPool &pool, EntityId id)
+    {
+        Agent *a = pool.agent(id);
+        return (a && a->isAlive()) ? a : nullptr;
+    }
+
+public:
+    EventRouter()
+        : delivered(0)
+    {
+    }
+
+    void clear()
+    {
+        for (auto &list : subscribers)
+        {
+            list.clear();
+        }
+    }
+
+    void add(Agent *agent)
+    {
+        unsigned mask = agent->eventMask();
+        for (size_t t = 0; t < static_cast<size_t>(EventType::Count); ++t)
+        {
+            if (mask & (1u << t))
+            {
+                subscribers[t].push_back(agent);
+            }
+        }
+    }
+
+    void pruneDead()
+    {
+        for (auto &list : subscribers)
+        {
+            list.erase(remove_if(list.begin(), list.end(),
+                                 [](const Agent *a)
+                                 { return !a->isAlive(); }),
+                       list.end());
+        }
+    }
+
+    size_t subscriberCount(EventType t) const
+    {
+        return subscribers[static_cast<size_t>(t)].size();
+    }
+
+    size_t getDelivered() const
+    {
+        return delivered;
+    }
+
+    void dispatch(World &world, const SpatialIndex &spatial, const EntityPool &pool, const Event &e)
+    {
+        if (e.to.valid())
+        {
+            if (Agent *a = resolve(pool, e.to))
+            {
+                a->onEvent(world, e);
+                ++delivered;
+            }
+            return;
+        }
+
+        unsigned bit = eventBit(e.type);
+        if (e.radius > 0)
+        {
+            spatial.forEachInRadius(e.pos, e.radius, [&](const SpatialIndex::Entry &entry)
+                                    {
+                                        Agent *a = resolve(pool, entry.id);
+                                        if (a && (a->eventMask() & bit))
+                                        {
+                                            a->onEvent(world, e);
+                                            ++delivered;
+                                        }
+                                    });
+            return;
+        }
+
+        for (Agent *a : subscribers[static_cast<size_t>(e.type)])
+        {
+            if (a->isAlive())
+            {
+                a->onEvent(world, e);
+                ++delivered;
+            }
+        }
+    }
+};
+
+class Recorder
+{
+public:
+    struct Entry
+    {
+        int32_t tick;
+        EntityId entity;
+        Vec2 pos;
+        PayloadId payload;
+        EventType type;
+    };
+
+private:
+    static const size_t kDefaultCapacity = 1 << 16;
+
+    vector<Entry> ring;
+    size_t mask;
+    atomic<size_t> head;
+    atomic<size_t> tail;
+    bool enabled;
+    bool packed;
+    uint64_t recorded;
+    uint64_t dropped;
+    string path;
+    ofstream out;
+    atomic<uint64_t> bytesWritten;
+    vector<unsigned char> scratch;
+    Entry last;
+    thread writer;
+    mutex m;
+    condition_variable wake;
+    condition_variable flushed;
+    bool stopping;
+    uint64_t flushRequested;
+    uint64_t flushCompleted;
+
+    void putVarint(uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            scratch.push_back(static_cast<unsigned char>(v | 0x80));
+            v >>= 7;
+        }
+        scratch.push_back(static_cast<unsigned char>(v));
+    }
+
+    void putSigned(int64_t v)
+    {
+        putVarint((static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+    }
+
+    template <typename T>
+    void putRaw(const T &v)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(&v);
+        scratch.insert(scratch.end(), p, p + sizeof(T));
+    }
+
+    void encode(const Entry &e)
+    {
+        if (packed)
+        {
+            putSigned(static_cast<int64_t>(e.tick) - last.tick);
+            scratch.push_back(static_cast<unsigned char>(e.type));
+            putVarint(e.entity.index);
+            putVarint(e.entity.generation);
+            putVarint(e.payload);
+            putSigned(static_cast<int64_t>(e.pos.x) - last.pos.x);
+            putSigned(static_cast<int64_t>(e.pos.y) - last.pos.y);
+            last = e;
+        }
+        else
+        {
+            putRaw(e.tick);
+            putRaw(e.entity.index);
+            putRaw(e.entity.generation);
+            putRaw(static_cast<int32_t>(e.pos.x));
+            putRaw(static_cast<int32_t>(e.pos.y));
+            putRaw(e.payload);
+            putRaw(static_cast<uint8_t>(e.type));
+        }
+    }
+
+    void drain()
+    {
+        size_t t = tail.load(memory_order_relaxed);
+        size_t h = head.load(memory_order_acquire);
+        if (t == h)
+        {
+            return;
+        }
+        scratch.clear();
+        for (; t != h; ++t)
+        {
+            encode(ring[t & mask]);
+        }
+        tail.store(t, memory_order_release);
+        out.write(reinterpret_cast<const char *>(scratch.data()), static_cast<streamsize>(scratch.size()));
+        bytesWritten.fetch_add(scratch.size(), memory_order_relaxed);
+    }
+
+    void writerLoop()
+    {
+        unique_lock<mutex> lock(m);
+        for (;;)
+        {
+            wake.wait_for(lock, chrono::milliseconds(20), [&]
+                          { return stopping || flushRequested != flushCompleted ||
+                                   head.load(memory_order_acquire) - tail.load(memory_order_relaxed) >= (mask + 1) / 2; });
+            uint64_t request = flushRequested;
+            bool finishing = stopping;
+            lock.unlock();
+            drain();
+            if (request != flushCompleted || finishing)
+            {
+                out.flush();
+            }
+            lock.lock();
+            if (request != flushCompleted)
+            {
+                flushCompleted = request;
+                flushed.notify_all();
+            }
+            if (finishing && head.load(memory_order_acquire) == tail.load(memory_order_relaxed))
+            {
+                return;
+            }
+        }
+    }
+
+public:
+    explicit Recorder(size_t capacity = kDefaultCapacity)
+        : mask(1), head(0), tail(0), enabled(false), packed(false), recorded(0), dropped(0), bytesWritten(0),
+          last(), stopping(false), flushRequested(0), flushCompleted(0)
+    {
+        while (mask + 1 < capacity)
+        {
+            mask = (mask << 1) | 1;
+        }
+    }
+
+    Recorder(const Recorder &) = delete;
+    Recorder &operator=(const Recorder &) = delete;
+
+    ~Recorder()
+    {
+        stop();
+    }
+
+    bool start(const string &file, bool pack)
+    {
+        stop();
+        out.open(file, ios::binary | ios::trunc);
+        if (!out)
+        {
+            return false;
+        }
+        ring.resize(mask + 1);
+        path = file;
+        packed = pack;
+        recorded = 0;
+        dropped = 0;
+        last = Entry();
+        head.store(0, memory_order_relaxed);
+        tail.store(0, memory_order_relaxed);
+        const char header[8] = {'S', 'I', 'M', 'R', 'E', 'C', 1, static_cast<char>(packed ? 1 : 0)};
+        out.write(header, sizeof(header));
+        bytesWritten.store(sizeof(header), memory_order_relaxed);
+        stopping = false;
+        flushRequested = 0;
+        flushCompleted = 0;
+        writer = thread(&Recorder::writerLoop, this);
+        enabled = true;
+        return true;
+    }
+
+    void stop()
+    {
+        if (!writer.joinable())
+        {
+            return;
+        }
+        enabled = false;
+        {
+            lock_guard<mutex> lock(m);
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+        out.close();
+    }
+
+    void flush()
+    {
+        if (!writer.joinable())
+        {
+            return;
+        }
+        unique_lock<mutex> lock(m);
+        uint64_t request = ++flushRequested;
+        wake.notify_one();
+        flushed.wait(lock, [&]
+                     { return flushCompleted >= request; });
+    }
+
+    bool isEnabled() const
+    {
+        return enabled;
+    }
+
+    bool isPacked() const
+    {
+        return packed;
+    }
+
+    const string &getPath() const
+    {
+        return path;
+    }
+
+    uint64_t getRecorded() const
+    {
+        return recorded;
+    }
+
+    uint64_t getDropped() const
+    {
+        return dropped;
+    }
+
+    uint64_t getBytesWritten() const
+    {
+        return bytesWritten.load(memory_order_relaxed);
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+    void log(int tick, const Event &e)
+    {
+        if (!enabled)
+        {
+            return;
+        }
+        size_t h = head.load(memory_order_relaxed);
+        if (h - tail.load(memory_order_acquire) > mask)
+        {
+            ++dropped;
+            return;
+        }
+        Entry &slot = ring[h & mask];
+        slot.tick = tick;
+        slot.entity = e.from;
+        slot.pos = e.pos;
+        slot.payload = e.payload;
+        slot.type = e.type;
+        head.store(h + 1, memory_order_release);
+        ++recorded;
+        if (h - tail.load(memory_order_relaxed) == (mask + 1) / 2)
+        {
+            wake.notify_one();
+        }
+    }
+};
+
+// Whole-token numeric parsing for console arguments and command-line flags:
+// empty input, trailing characters and out-of-range values are rejected.
+bool parseNumber(const string &s, long long &out)
+{
+    if (s.empty() || isspace(static_cast<unsigned char>(s[0])))
+    {
+        return false;
+    }
+    char *end = nullptr;
+    errno = 0;
+    long long v = strtoll(s.c_str(), &end, 10);
+    if (errno == ERANGE || *end != '\0')
+    {
+        return false;
+    }
+    out = v;
+    return true;
+}
+
+bool parseNumber(const string &s, int &out)
+{
+    long long v = 0;
+    if (!parseNumber(s, v) || v < numeric_limits<int>::min() || v > numeric_limits<int>::max())
+    {
+        return false;
+    }
+    out = static_cast<int>(v);
+    return true;
+}
+
+bool parseNumber(const string &s, unsigned &out)
+{
+    long long v = 0;
+    if (!parseNumber(s, v) || v < 0 || v > numeric_limits<unsigned>::max())
+    {
+        return false;
+    }
+    out = static_cast<unsigned>(v);
+    return true;
+}
+
+bool parseNumber(const string &s, double &out)
+{
+    if (s.empty() || isspace(static_cast<unsigned char>(s[0])))
+    {
+        return false;
+    }
+    char *end = nullptr;
+    errno = 0;
+    double v = strtod(s.c_str(), &end);
+    if (errno == ERANGE || *end != '\0' || !std::isfinite(v))
+    {
+        return false;
+    }
+    out = v;
+    return true;
+}
+
+struct Command
+{
+    string name;
+    vector<string> args;
+};
+
+class CommandParser
+{
+public:
+    static Command parse(const string &line)
+    {
+        Command cmd;
+        string token;
+        istringstream iss(line);
+        if (!(iss >> cmd.name))
+        {
+            cmd.name.clear();
+            return cmd;
+        }
+        while (iss >> token)
+        {
+            cmd.args.push_back(token);
+        }
+        return cmd;
+    }
+};
+
+class TerminalRenderer
+{
+    vector<string> front;
+    vector<string> back;
+    string out;
+    bool fullRepaint;
+    double frameCap;
+    chrono::high_resolution_clock::time_point lastFrame;
+    size_t lastBytes;
+
+    void moveTo(size_t row, size_t col)
+    {
+        out += "\x1b[";
+        out += to_string(row + 1);
+        out += ';';
+        out += to_string(col + 1);
+        out += 'H';
+    }
+
+    void diffRow(size_t y, const string &was, const string &now)
+    {
+        const size_t kMergeGap = 6;
+        size_t common = min(was.size(), now.size());
+        size_t x = 0;
+        while (x < common)
+        {
+            if (was[x] == now[x])
+            {
+                ++x;
+                continue;
+            }
+            size_t end = x + 1;
+            size_t gap = 0;
+            while (end < common && gap < kMergeGap)
+            {
+                gap = was[end] == now[end] ? gap + 1 : 0;
+                ++end;
+            }
+            end -= gap;
+            moveTo(y, x);
+            out.append(now, x, end - x);
+            x = end;
+        }
+        if (now.size() > common)
+        {
+            moveTo(y, common);
+            out.append(now, common, string::npos);
+        }
+        else if (was.size() > common)
+        {
+            moveTo(y, common);
+            out += "\x1b[K";
+        }
+    }
+
+public:
+    TerminalRenderer()
+        : fullRepaint(true), frameCap(0.0), lastBytes(0)
+    {
+    }
+
+    vector<string> &frame(size_t rows)
+    {
+        back.resize(rows);
+        return back;
+    }
+
+    void invalidate()
+    {
+        fullRepaint = true;
+    }
+
+    void setFrameCap(double fps)
+    {
+        frameCap = max(fps, 0.0);
+    }
+
+    double getFrameCap() const
+    {
+        return frameCap;
+    }
+
+    size_t getLastBytes() const
+    {
+        return lastBytes;
+    }
+
+    bool frameDue() const
+    {
+        if (frameCap <= 0.0 || fullRepaint)
+        {
+            return true;
+        }
+        double elapsed = chrono::duration<double>(chrono::high_resolution_clock::now() - lastFrame).count();
+        return elapsed >= 1.0 / frameCap;
+    }
+
+    void present(ostream &os)
+    {
+        out.clear();
+        if (fullRepaint)
+        {
+            out += "\x1b[H";
+            for (const string &line : back)
+            {
+                out += line;
+                out += "\x1b[K\n";
+            }
+            out += "\x1b[J";
+            fullRepaint = false;
+        }
+        else
+        {
+            for (size_t y = 0; y < back.size(); ++y)
+            {
+                diffRow(y, y < front.size() ? front[y] : string(), back[y]);
+            }
+            for (size_t y = back.size(); y < front.size(); ++y)
+            {
+                moveTo(y, 0);
+                out += "\x1b[K";
+            }
+            moveTo(back.size(), 0);
+        }
+        os.write(out.data(), static_cast<streamsize>(out.size()));
+        os.flush();
+        lastBytes = out.size();
+        front.swap(back);
+        lastFrame = chrono::high_resolution_clock::now();
+    }
+};
+
+template <typename T>
+class SpscQueue
+{
+    vector<T> slots;
+    size_t mask;
+    atomic<size_t> head;
+    atomic<size_t> tail;
+
+public:
+    explicit SpscQueue(size_t capacity)
+        : mask(0), head(0), tail(0)
+    {
+        size_t n = 2;
+        while (n < capacity)
+        {
+            n <<= 1;
+        }
+        slots.resize(n);
+        mask = n - 1;
+    }
+
+    bool push(T &&v)
+    {
+        size_t h = head.load(memory_order_relaxed);
+        if (h - tail.load(memory_order_acquire) > mask)
+        {
+            return false;
+        }
+        slots[h & mask] = std::move(v);
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+
+    bool pop(T &out)
+    {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t == head.load(memory_order_acquire))
+        {
+            return false;
+        }
+        out = std::move(slots[t & mask]);
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return tail.load(memory_order_acquire) == head.load(memory_order_acquire);
+    }
+};
+
+struct FrameSnapshot
+{
+    int tick;
+    bool paused;
+    vector<string> lines;
+};
+
+class FrameMailbox
+{
+    mutex m;
+    condition_variable ready;
+    shared_ptr<const FrameSnapshot> latest;
+    uint64_t version;
+    bool closed;
+
+public:
+    FrameMailbox()
+        : version(0), closed(false)
+    {
+    }
+
+    void publish(shared_ptr<const FrameSnapshot> frame)
+    {
+        {
+            lock_guard<mutex> lock(m);
+            latest = std::move(frame);
+            ++version;
+        }
+        ready.notify_one();
+    }
+
+    void close()
+    {
+        {
+            lock_guard<mutex> lock(m);
+            closed = true;
+        }
+        ready.notify_all();
+    }
+
+    // As wait, but gives up after `timeout` and leaves `out` untouched; false once closed.
+    bool waitFor(uint64_t &seen, shared_ptr<const FrameSnapshot> &out, chrono::milliseconds timeout)
+    {
+        unique_lock<mutex> lock(m);
+        ready.wait_for(lock, timeout, [&]
+                       { return closed || version != seen; });
+        if (version != seen)
+        {
+            seen = version;
+            out = latest;
+            return true;
+        }
+        return !closed;
+    }
+
+    // Blocks until a frame newer than `seen` is published; false once closed.
+    bool wait(uint64_t &seen, shared_ptr<const FrameSnapshot> &out)
+    {
+        unique_lock<mutex> lock(m);
+        ready.wait(lock, [&]
+                   { return closed || version != seen; });
+        if (version == seen)
+        {
+            return false;
+        }
+        seen = version;
+        out = latest;
+        return true;
+    }
+};
+
+class ThreadPool
+{
+    vector<thread> workers;
+    mutex m;
+    condition_variable wake;
+    condition_variable done;
+    function<void(size_t)> job;
+    size_t taskCount;
+    atomic<size_t> nextTask;
+    size_t busy;
+    uint64_t generation;
+    bool stopping;
+
+    void drain()
+    {
+        for (;;)
+        {
+            size_t t = nextTask.fetch_add(1, memory_order_relaxed);
+            if (t >= taskCount)
+            {
+                return;
+            }
+            job(t);
+        }
+    }
+
+    void workerLoop()
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            {
+                unique_lock<mutex> lock(m);
+                wake.wait(lock, [&]
+                          { return stopping || generation != seen; });
+                if (stopping)
+                {
+                    return;
+                }
+                seen = generation;
+            }
+            drain();
+            {
+                lock_guard<mutex> lock(m);
+                if (--busy == 0)
+                {
+                    done.notify_one();
+                }
+            }
+        }
+    }
+
+    void stop()
+    {
+        {
+            lock_guard<mutex> lock(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &t : workers)
+        {
+            t.join();
+        }
+        workers.clear();
+        stopping = false;
+    }
+
+public:
+    explicit ThreadPool(size_t threads = 1)
+        : taskCount(0), nextTask(0), busy(0), generation(0), stopping(false)
+    {
+        resize(threads);
+    }
+
+    ~ThreadPool()
+    {
+        stop();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void resize(size_t threads)
+    {
+        stop();
+        for (size_t i = 1; i < max<size_t>(threads, 1); ++i)
+        {
+            workers.emplace_back([this]
+                                 { workerLoop(); });
+        }
+    }
+
+    size_t size() const
+    {
+        return workers.size() + 1;
+    }
+
+    template <typename F>
+    void parallelFor(size_t n, F &&fn)
+    {
+        if (workers.empty() || n <= 1)
+        {
+            for (size_t t = 0; t < n; ++t)
+            {
+                fn(t);
+            }
+            return;
+        }
+        {
+            lock_guard<mutex> lock(m);
+            job = [&fn](size_t t)
+            { fn(t); };
+            taskCount = n;
+            nextTask.store(0, memory_order_relaxed);
+            busy = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+        drain();
+        unique_lock<mutex> lock(m);
+        done.wait(lock, [&]
+                  { return busy == 0; });
+        job = nullptr;
+    }
+};
+
+struct GridWrite
+{
+    Vec2 pos;
+    CellType type;
+};
+
+struct TickBuffer
+{
+    vector<GridWrite> writes;
+    vector<Event> events;
+    vector<SpatialIndex::Entry> moves;
+    vector<uint32_t> rows;
+
+    void clear()
+    {
+        writes.clear();
+        events.clear();
+        moves.clear();
+        rows.clear();
+    }
+};
+
+inline void ageCell(CellType t, CellValue &value1, CellValue &value2)
+{
+    if (t == CellType::Trail || t == CellType::Signal)
+    {
+        value2 += 0.02;
+    }
+    else
+    {
+        value1 *= 0.999;
+    }
+}
+
+void benchmarkGridIteration(int size, ostream &os)
+{
+    Grid grid(size, size);
+    grid.forEach([&](const Vec2 &p, size_t i)
+                 {
+                     grid.setType(i, (p.x + p.y) % 7 == 0 ? CellType::Trail : CellType::Empty);
+                     grid.value1(i) = 1.0;
+                 });
+    ThreadPool pool(max(thread::hardware_concurrency(), 1u));
+    const int passes = 10;
+    double cells = static_cast<double>(size) * static_cast<double>(size) * passes;
+
+    auto run = [&](const char *name, auto &&pass)
+    {
+        pass();
+        auto t0 = chrono::high_resolution_clock::now();
+        for (int i = 0; i < passes; ++i)
+        {
+            pass();
+        }
+        double ns = chrono::duration<double, nano>(chrono::high_resolution_clock::now() - t0).count();
+        os << "  " << left << setw(22) << name << right << fixed << setprecision(3) << ns / cells << " ns/cell\n";
+    };
+
+    os << "grid iteration " << size << "x" << size << ", " << passes << " passes, "
+       << grid.memoryBytes() / grid.cellCount() << "." << (grid.memoryBytes() * 10 / grid.cellCount()) % 10 << " bytes/cell:\n";
+    run("std::function visitor", [&]
+        {
+            function<void(const Vec2 &, size_t)> fn = [&](const Vec2 &, size_t i)
+            { ageCell(grid.type(i), grid.value1(i), grid.value2(i)); };
+            grid.forEach(fn);
+        });
+    run("template visitor", [&]
+        { grid.forEach([&](const Vec2 &, size_t i)
+                       { ageCell(grid.type(i), grid.value1(i), grid.value2(i)); }); });
+    auto rowKernel = [](int, GridRow row)
+    {
+        for (int x = 0; x < row.width; ++x)
+        {
+            ageCell(row.type[x], row.value1[x], row.value2[x]);
+        }
+    };
+    run("row spans", [&]
+        { grid.forEachRow(rowKernel); });
+    run("parallel rows", [&]
+        { grid.parallelForEachRow(pool, rowKernel); });
+    os << defaultfloat << "  (" << pool.size() << " threads, checksum " << grid.value1(Vec2(size / 2, size / 2)) << ")\n";
+}
+
+// Shares generated noise between worlds that would build an identical field:
+// same generator state, size and parameters. Used by sweeps, where many runs
+// differ only in entity counts.
+class NoiseCache
+{
+    struct Entry
+    {
+        uint64_t key;
+        uint64_t counter;
+        int width;
+        int height;
+        int octaves;
+        double persistence;
+        NoiseMode mode;
+        shared_ptr<const NoiseField> field;
+        RNG after;
+        bool ready;
+    };
+
+    mutex m;
+    condition_variable built;
+    deque<Entry> entries;
+    size_t maxEntries;
+    uint64_t hits;
+    uint64_t misses;
+
+    Entry *find(const RNG &rng, int w, int h, int octaves, double persistence, NoiseMode mode)
+    {
+        for (Entry &e : entries)
+        {
+            if (e.key == rng.key && e.counter == rng.counter && e.width == w && e.height == h &&
+                e.octaves == octaves && e.persistence == persistence && e.mode == mode)
+            {
+                return &e;
+            }
+        }
+        return nullptr;
+    }
+
+public:
+    explicit NoiseCache(size_t maxEntries_ = 64)
+        : maxEntries(max<size_t>(maxEntries_, 1)), hits(0), misses(0)
+    {
+    }
+
+    // Fills `out` (already sized) and advances `rng` exactly as NoiseField::generate would.
+    template <typename Pool>
+    void generate(NoiseField &out, RNG &rng, int octaves, double persistence, NoiseMode mode, Pool &pool)
+    {
+        int w = out.getWidth();
+        int h = out.getHeight();
+        {
+            unique_lock<mutex> lock(m);
+            Entry *e = find(rng, w, h, octaves, persistence, mode);
+            if (e)
+            {
+                while (!e->ready)
+                {
+                    built.wait(lock);
+                    e = find(rng, w, h, octaves, persistence, mode);
+                    if (!e)
+                    {
+                        break;
+                    }
+                }
+            }
+            if (e)
+            {
+                ++hits;
+                out = *e->field;
+                rng = e->after;
+                return;
+            }
+            ++misses;
+            if (entries.size() >= maxEntries)
+            {
+                auto victim = find_if(entries.begin(), entries.end(), [](const Entry &x)
+                                      { return x.ready; });
+                if (victim != entries.end())
+                {
+                    entries.erase(victim);
+                }
+            }
+            entries.push_back(Entry{rng.key, rng.counter, w, h, octaves, persistence, mode, nullptr, rng, false});
+        }
+
+        uint64_t key = rng.key;
+        uint64_t counter = rng.counter;
+        out.generate(rng, octaves, persistence, mode, pool);
+        shared_ptr<const NoiseField> field = make_shared<NoiseField>(out);
+        {
+            lock_guard<mutex> lock(m);
+            RNG before(key, counter);
+            Entry *e = find(before, w, h, octaves, persistence, mode);
+            e->field = std::move(field);
+            e->after = rng;
+            e->ready = true;
+        }
+        built.notify_all();
+    }
+
+    uint64_t getHits()
+    {
+        lock_guard<mutex> lock(m);
+        return hits;
+    }
+
+    uint64_t getMisses()
+    {
+        lock_guard<mutex> lock(m);
+        return misses;
+    }
+};
+
+struct WorldConfig
+{
+    int width;
+    int height;
+    int wanderers;
+    int seekers;
+    int trails;
+    int sources;
+    int sinks;
+    int pingRadius;
+    int threads;
+    NoiseMode noiseMode;
+    bool streaming;
+    int chunkBudget;
+    unsigned seed;
+};
+
+static const uint64_t kSpawnStream = 0x5EED5EED5EED5EEDull;
+static const uint64_t kTerrainStream = 0x7E77A1117E77A111ull;
+
+static const char kSnapshotMagic[8] = {'S', 'I', 'M', 'S', 'N', 'A', 'P', '\0'};
+static const uint32_t kSnapshotVersion = 1;
+
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t cellValueBytes;
+    WorldConfig config;
+    int32_t tick;
+    int32_t originX;
+    int32_t originY;
+    uint64_t rngKey;
+    uint64_t rngCounter;
+};
+
+class SnapshotWriter
+{
+    ofstream out;
+    size_t offset;
+
+public:
+    explicit SnapshotWriter(const string &path)
+        : out(path, ios::binary | ios::trunc), offset(0)
+    {
+    }
+
+    bool good() const
+    {
+        return static_cast<bool>(out);
+    }
+
+    size_t size() const
+    {
+        return offset;
+    }
+
+    void bytes(const void *data, size_t n)
+    {
+        static const char zeros[8] = {};
+        out.write(static_cast<const char *>(data), static_cast<streamsize>(n));
+        size_t pad = (8 - ((offset + n) & 7)) & 7;
+        out.write(zeros, static_cast<streamsize>(pad));
+        offset += n + pad;
+    }
+
+    template <typename T>
+    void value(const T &v)
+    {
+        bytes(&v, sizeof(T));
+    }
+
+    template <typename T>
+    void array(const vector<T> &v)
+    {
+        value(static_cast<uint64_t>(v.size()));
+        bytes(v.data(), v.size() * sizeof(T));
+    }
+};
+
+class SnapshotReader
+{
+    const unsigned char *data;
+    size_t length;
+    size_t offset;
+    bool ok;
+
+public:
+    SnapshotReader(const unsigned char *d, size_t n)
+        : data(d), length(n), offset(0), ok(true)
+    {
+    }
+
+    bool good() const
+    {
+        return ok;
+    }
+
+    bool bytes(void *dst, size_t n)
+    {
+        if (!ok || length - offset < n)
+        {
+            ok = false;
+            return false;
+        }
+        if (n > 0)
+        {
+            memcpy(dst, data + offset, n);
+        }
+        offset = min(length, offset + n + ((8 - (n & 7)) & 7));
+        return true;
+    }
+
+    template <typename T>
+    bool value(T &v)
+    {
+        return bytes(&v, sizeof(T));
+    }
+
+    template <typename T>
+    bool array(vector<T> &v, size_t expected = numeric_limits<size_t>::max())
+    {
+        uint64_t n = 0;
+        if (!value(n) || (expected != numeric_limits<size_t>::max() && n != expected) || n > (length - offset) / sizeof(T))
+        {
+            ok = false;
+            return false;
+        }
+        v.resize(static_cast<size_t>(n));
+        return bytes(v.data(), static_cast<size_t>(n) * sizeof(T));
+    }
+};
+
+class MappedFile
+{
+    const unsigned char *data;
+    size_t length;
+    bool mapped;
+    vector<unsigned char> buffer;
+
+public:
+    MappedFile()
+        : data(nullptr), length(0), mapped(false)
+    {
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if (mapped)
+        {
+            munmap(const_cast<unsigned char *>(data), length);
+        }
+#endif
+    }
+
+    bool open(const string &path)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void *p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+        {
+            return false;
+        }
+        data = static_cast<const unsigned char *>(p);
+        length = static_cast<size_t>(st.st_size);
+        mapped = true;
+        return true;
+#else
+        ifstream in(path, ios::binary);
+        if (!in)
+        {
+            return false;
+        }
+        buffer.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        data = buffer.data();
+        length = buffer.size();
+        return length > 0;
+#endif
+    }
+
+    const unsigned char *bytes() const
+    {
+        return data;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+};
+
+// Encodes the world for remote viewers as length-prefixed frames: a little-endian
+// u32 payload size, then 'K' (keyframe) or 'D' (delta), then varints.
+//   K: tick, width, height, cell runs (count, type byte) covering the grid,
+//      entity count, then per entity index, generation, glyph byte, x, y.
+//   D: tick, then four counted sections built against the previous frame:
+//      cell runs (gap since the last run, length, raw type bytes), deaths
+//      (index), spawns (index, generation, glyph, x, y) and moves (index,
+//      zigzag dx, zigzag dy).
+class DeltaEncoder
+{
+    struct Tracked
+    {
+        uint32_t generation;
+        Vec2 pos;
+        uint64_t seen;
+    };
+
+    vector<CellType> shadow;
+    int width;
+    int height;
+    vector<Tracked> tracked;
+    uint64_t stamp;
+    string cells;
+    string deaths;
+    string spawns;
+    string moves;
+
+    static void putVarint(string &out, uint64_t v)
+    {
+        while (v >= 0x80)
+        {
+            out += static_cast<char>(v | 0x80);
+            v >>= 7;
+        }
+        out += static_cast<char>(v);
+    }
+
+    static void putSigned(string &out, int64_t v)
+    {
+        putVarint(out, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+    }
+
+    static void begin(string &out, char kind, int tick)
+    {
+        out.assign(4, '\0');
+        out += kind;
+        putVarint(out, static_cast<uint64_t>(max(tick, 0)));
+    }
+
+    static void finish(string &out)
+    {
+        uint32_t n = static_cast<uint32_t>(out.size() - 4);
+        for (int b = 0; b < 4; ++b)
+        {
+            out[static_cast<size_t>(b)] = static_cast<char>((n >> (8 * b)) & 0xFF);
+        }
+    }
+
+    Tracked &track(EntityId id)
+    {
+        if (id.index >= tracked.size())
+        {
+            tracked.resize(id.index + 1, Tracked{0, Vec2(0, 0), 0});
+        }
+        return tracked[id.index];
+    }
+
+    static void putSpawn(string &out, const Entity &e)
+    {
+        putVarint(out, e.getId().index);
+        putVarint(out, e.getId().generation);
+        out += e.glyph();
+        putVarint(out, static_cast<uint64_t>(static_cast<uint32_t>(e.getPos().x)));
+        putVarint(out, static_cast<uint64_t>(static_cast<uint32_t>(e.getPos().y)));
+    }
+
+public:
+    DeltaEncoder()
+        : width(0), height(0), stamp(1)
+    {
+    }
+
+    bool hasBaseline() const
+    {
+        return !shadow.empty();
+    }
+
+    void reset()
+    {
+        shadow.clear();
+        tracked.clear();
+        width = 0;
+        height = 0;
+    }
+
+    // Writes a full frame and makes it the baseline for the next delta.
+    void keyframe(int tick, const Grid &grid, const EntityPool &pool, string &out)
+    {
+        begin(out, 'K', tick);
+        width = grid.getWidth();
+        height = grid.getHeight();
+        putVarint(out, static_cast<uint64_t>(width));
+        putVarint(out, static_cast<uint64_t>(height));
+        size_t n = grid.cellCount();
+        shadow.resize(n);
+        size_t i = 0;
+        while (i < n)
+        {
+            CellType t = grid.type(i);
+            size_t run = 1;
+            shadow[i] = t;
+            while (i + run < n && grid.type(i + run) == t)
+            {
+                shadow[i + run] = t;
+                ++run;
+            }
+            putVarint(out, run);
+            out += static_cast<char>(t);
+            i += run;
+        }
+
+        ++stamp;
+        spawns.clear();
+        uint64_t count = 0;
+        pool.forEach([&](const Entity &e)
+                     {
+                         if (!e.isAlive())
+                         {
+                             return;
+                         }
+                         track(e.getId()) = Tracked{e.getId().generation, e.getPos(), stamp};
+                         putSpawn(spawns, e);
+                         ++count;
+                     });
+        putVarint(out, count);
+        out += spawns;
+        finish(out);
+    }
+
+    // Writes the changes since the last frame; false when there is no
+    // compatible baseline and a keyframe must be sent instead.
+    bool delta(int tick, const Grid &grid, const EntityPool &pool, string &out)
+    {
+        if (shadow.empty() || grid.getWidth() != width || grid.getHeight() != height)
+        {
+            return false;
+        }
+        const size_t kMergeGap = 3;
+        begin(out, 'D', tick);
+
+        cells.clear();
+        uint64_t runs = 0;
+        size_t n = shadow.size();
+        size_t last = 0;
+        size_t i = 0;
+        while (i < n)
+        {
+            if (grid.type(i) == shadow[i])
+            {
+                ++i;
+                continue;
+            }
+            size_t end = i + 1;
+            size_t gap = 0;
+            while (end < n && gap < kMergeGap)
+            {
+                gap = grid.type(end) == shadow[end] ? gap + 1 : 0;
+                ++end;
+            }
+            end -= gap;
+            putVarint(cells, i - last);
+            putVarint(cells, end - i);
+            for (size_t k = i; k < end; ++k)
+            {
+                shadow[k] = grid.type(k);
+                cells += static_cast<char>(shadow[k]);
+            }
+            ++runs;
+            last = end;
+            i = end;
+        }
+        putVarint(out, runs);
+        out += cells;
+
+        uint64_t prev = stamp++;
+        deaths.clear();
+        spawns.clear();
+        moves.clear();
+        uint64_t deathCount = 0;
+        uint64_t spawnCount = 0;
+        uint64_t moveCount = 0;
+        pool.forEach([&](const Entity &e)
+                     {
+                         if (!e.isAlive())
+                         {
+                             return;
+                         }
+                         EntityId id = e.getId();
+                         Tracked &t = track(id);
+                         bool wasLive = t.seen == prev;
+                         if (wasLive && t.generation == id.generation)
+                         {
+                             const Vec2 &p = e.getPos();
+                             if (p != t.pos)
+                             {
+                                 putVarint(moves, id.index);
+                                 putSigned(moves, static_cast<int64_t>(p.x) - t.pos.x);
+                                 putSigned(moves, static_cast<int64_t>(p.y) - t.pos.y);
+                                 ++moveCount;
+                                 t.pos = p;
+                             }
+                         }
+                         else
+                         {
+                             if (wasLive)
+                             {
+                                 putVarint(deaths, id.index);
+                                 ++deathCount;
+                             }
+                             putSpawn(spawns, e);
+                             ++spawnCount;
+                             t.generation = id.generation;
+                             t.pos = e.getPos();
+                         }
+                         t.seen = stamp;
+                     });
+        for (size_t k = 0; k < tracked.size(); ++k)
+        {
+            if (tracked[k].seen == prev)
+            {
+                putVarint(deaths, k);
+                ++deathCount;
+            }
+        }
+        putVarint(out, deathCount);
+        out += deaths;
+        putVarint(out, spawnCount);
+        out += spawns;
+        putVarint(out, moveCount);
+        out += moves;
+        finish(out);
+        return true;
+    }
+};
+
+// Publishes encoded frames to TCP viewers from a network thread. The sim thread
+// only encodes and hands frames over a lock-free queue, so slow or stalled
+// viewers never block World::stepTick; a viewer that falls too far behind is
+// cut back to the next keyframe instead.
+class DeltaServer
+{
+    typedef shared_ptr<const string> Frame;
+
+    struct Client
+    {
+        int fd;
+        deque<Frame> pending;
+        size_t offset;
+        size_t queuedBytes;
+        bool synced;
+    };
+
+    static const size_t kMaxClientBytes = 8 << 20;
+
+    DeltaEncoder encoder;
+    SpscQueue<Frame> outbox;
+    thread net;
+    atomic<bool> stopping;
+    atomic<bool> keyframeWanted;
+    atomic<size_t> clientCount;
+    atomic<uint64_t> bytesSent;
+    uint64_t framesPublished;
+    uint64_t framesDropped;
+    int listenFd;
+    int port;
+    string scratch;
+
+#if defined(__unix__) || defined(__APPLE__)
+    static void closeClient(Client &c)
+    {
+        ::close(c.fd);
+        c.fd = -1;
+    }
+
+    void enqueue(Client &c, const Frame &f)
+    {
+        bool key = (*f)[4] == 'K';
+        if (key)
+        {
+            c.synced = true;
+        }
+        if (!c.synced)
+        {
+            return;
+        }
+        if (c.queuedBytes + f->size() > kMaxClientBytes)
+        {
+            // Keep a partially written frame so the byte stream stays aligned.
+            while (c.pending.size() > (c.offset > 0 ? 1u : 0u))
+            {
+                c.queuedBytes -= c.pending.back()->size();
+                c.pending.pop_back();
+            }
+            c.synced = key;
+            if (!key)
+            {
+                keyframeWanted.store(true, memory_order_relaxed);
+                return;
+            }
+        }
+        c.pending.push_back(f);
+        c.queuedBytes += f->size();
+    }
+
+    void flush(Client &c)
+    {
+        while (!c.pending.empty())
+        {
+            const string &f = *c.pending.front();
+#if defined(MSG_NOSIGNAL)
+            ssize_t n = send(c.fd, f.data() + c.offset, f.size() - c.offset, MSG_NOSIGNAL);
+#else
+            ssize_t n = send(c.fd, f.data() + c.offset, f.size() - c.offset, 0);
+#endif
+            if (n < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                {
+                    closeClient(c);
+                }
+                return;
+            }
+            bytesSent.fetch_add(static_cast<uint64_t>(n), memory_order_relaxed);
+            c.offset += static_cast<size_t>(n);
+            if (c.offset < f.size())
+            {
+                return;
+            }
+            c.queuedBytes -= f.size();
+            c.offset = 0;
+            c.pending.pop_front();
+        }
+    }
+
+    void netLoop()
+    {
+        vector<Client> clients;
+        vector<pollfd> fds;
+        while (!stopping.load(memory_order_acquire))
+        {
+            Frame f;
+            while (outbox.pop(f))
+            {
+                for (Client &c : clients)
+                {
+                    enqueue(c, f);
+                }
+            }
+            for (Client &c : clients)
+            {
+                flush(c);
+            }
+            clients.erase(remove_if(clients.begin(), clients.end(), [](const Client &c)
+                                    { return c.fd < 0; }),
+                          clients.end());
+            clientCount.store(clients.size(), memory_order_relaxed);
+
+            fds.clear();
+            fds.push_back(pollfd{listenFd, POLLIN, 0});
+            for (const Client &c : clients)
+            {
+                fds.push_back(pollfd{c.fd, static_cast<short>(POLLIN | (c.pending.empty() ? 0 : POLLOUT)), 0});
+            }
+            if (poll(fds.data(), static_cast<nfds_t>(fds.size()), 10) <= 0)
+            {
+                continue;
+            }
+            for (size_t k = 1; k < fds.size(); ++k)
+            {
+                Client &c = clients[k - 1];
+                if (fds[k].revents & (POLLERR | POLLHUP | POLLNVAL))
+                {
+                    closeClient(c);
+                    continue;
+                }
+                if (fds[k].revents & POLLIN)
+                {
+                    char sink[256];
+                    ssize_t n = recv(c.fd, sink, sizeof(sink), 0);
+                    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                    {
+                        closeClient(c);
+                        continue;
+                    }
+                }
+                if (fds[k].revents & POLLOUT)
+                {
+                    flush(c);
+                }
+            }
+            if (fds[0].revents & POLLIN)
+            {
+                int fd = accept(listenFd, nullptr, nullptr);
+                if (fd >= 0)
+                {
+                    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#if defined(SO_NOSIGPIPE)
+                    int one = 1;
+                    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+                    clients.push_back(Client{fd, deque<Frame>(), 0, 0, false});
+                    clientCount.store(clients.size(), memory_order_relaxed);
+                    keyframeWanted.store(true, memory_order_relaxed);
+                }
+            }
+        }
+        for (Client &c : clients)
+        {
+            closeClient(c);
+        }
+        clientCount.store(0, memory_order_relaxed);
+    }
+#endif
+
+public:
+    DeltaServer()
+        : outbox(256), stopping(false), keyframeWanted(false), clientCount(0), bytesSent(0),
+          framesPublished(0), framesDropped(0), listenFd(-1), port(0)
+    {
+    }
+
+    DeltaServer(const DeltaServer &) = delete;
+    DeltaServer &operator=(const DeltaServer &) = delete;
+
+    ~DeltaServer()
+    {
+        stop();
+    }
+
+    bool start(int port_)
+    {
+        stop();
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+        {
+            return false;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(static_cast<uint16_t>(port_));
+        if (::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, 16) != 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        socklen_t len = sizeof(addr);
+        getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        listenFd = fd;
+        port = ntohs(addr.sin_port);
+        encoder.reset();
+        stopping.store(false, memory_order_relaxed);
+        net = thread([this]
+                     { netLoop(); });
+        return true;
+#else
+        (void)port_;
+        return false;
+#endif
+    }
+
+    void stop()
+    {
+        if (!net.joinable())
+        {
+            return;
+        }
+        stopping.store(true, memory_order_release);
+        net.join();
+#if defined(__unix__) || defined(__APPLE__)
+        ::close(listenFd);
+#endif
+        listenFd = -1;
+        port = 0;
+        Frame f;
+        while (outbox.pop(f))
+        {
+        }
+    }
+
+    bool isRunning() const
+    {
+        return net.joinable();
+    }
+
+    // Called by the sim thread once per tick; does nothing until a viewer attaches.
+    void publish(int tick, const Grid &grid, const EntityPool &pool)
+    {
+        if (!net.joinable())
+        {
+            return;
+        }
+        if (clientCount.load(memory_order_relaxed) == 0 && !keyframeWanted.load(memory_order_relaxed))
+        {
+            encoder.reset();
+            return;
+        }
+        if (keyframeWanted.exchange(false, memory_order_relaxed) || !encoder.delta(tick, grid, pool, scratch))
+        {
+            encoder.keyframe(tick, grid, pool, scratch);
+        }
+        if (outbox.push(make_shared<const string>(scratch)))
+        {
+            ++framesPublished;
+        }
+        else
+        {
+            ++framesDropped;
+            keyframeWanted.store(true, memory_order_relaxed);
+        }
+    }
+
+    int getPort() const
+    {
+        return port;
+    }
+
+    size_t getClientCount() const
+    {
+        return clientCount.load(memory_order_relaxed);
+    }
+
+    uint64_t getFramesPublished() const
+    {
+        return framesPublished;
+    }
+
+    uint64_t getFramesDropped() const
+    {
+        return framesDropped;
+    }
+
+    uint64_t getBytesSent() const
+    {
+        return bytesSent.load(memory_order_relaxed);
+    }
+};
+
+struct AgentRef
+{
+    uint32_t kind;
+    uint32_t row;
+};
+
+class World
+{
+    Grid grid;
+    NoiseField noise;
+    ChunkMap chunks;
+    Vec2 viewOrigin;
+    RNG rng;
+    PathfindingService pathing;
+    HierarchicalPathfinder hpa;
+    EntityPool entities;
+    vector<Entity *> unmanaged;
+    vector<EntityId> removedIds;
+    AgentStore agents;
+    SpatialIndex spatial;
+    ActiveCellSet decaying;
+    EventRouter router;
+    EventQueue events;
+    Recorder recorder;
+    DeltaServer viewers;
+    int tick;
+    WorldConfig config;
+    CellIndex cells;
+    bool running;
+    bool redrawRequired;
+    double timeAccum;
+    double timestep;
+    int maxCatchUp;
+    uint64_t droppedTicks;
+    bool showOverlay;
+    bool showNoise;
+    bool showIds;
+    bool advancedMode;
+    vector<Vec2> debugPath;
+    vector<string> commandOutput;
+    TerminalRenderer renderer;
+    ThreadPool pool;
+    int tileShift;
+    vector<TickBuffer> tileBuffers;
+    vector<uint32_t> tileStart;
+    vector<uint32_t> tileCursor;
+    vector<AgentRef> tileOrder;
+    vector<Vec2> flowGoals;
+    NoiseCache *noiseCache;
+    uint64_t dispatched[static_cast<size_t>(EventType::Count)];
+
+    void stepAgentsParallel(double dt);
+    void collectFlowGoals();
+
+public:
+    World()
+        : grid(0, 0),
+          noise(0, 0),
+          rng(),
+          tick(0),
+          running(true),
+          redrawRequired(true),
+          timeAccum(0.0),
+          timestep(0.1),
+          maxCatchUp(5),
+          droppedTicks(0),
+          showOverlay(true),
+          showNoise(false),
+          showIds(false),
+          advancedMode(true),
+          tileShift(5),
+          noiseCache(nullptr)
+    {
+        memset(dispatched, 0, sizeof(dispatched));
+        grid.attachIndex(&cells);
+        config.width = 60;
+        config.height = 24;
+        config.wanderers = 12;
+        config.seekers = 4;
+        config.trails = 6;
+        config.sources = 4;
+        config.sinks = 4;
+        config.pingRadius = 0;
+        config.threads = 0;
+        config.noiseMode = NoiseMode::Classic;
+        config.streaming = false;
+        config.chunkBudget = 64;
+        config.seed = static_cast<unsigned>(chrono::high_resolution_clock::now().time_since_epoch().count());
+    }
+
+    void init()
+    {
+        pool.resize(static_cast<size_t>(max(config.threads, 1)));
+        rng.seed(config.seed);
+        grid.resize(config.width, config.height);
+        spatial.resize(config.width, config.height);
+        decaying.resize(config.width, config.height);
+        grid.fill(CellType::Empty);
+        buildTerrain();
+        spawnEntities();
+    }
+
+    void buildTerrain()
+    {
+        if (config.streaming)
+        {
+            noise.resize(0, 0);
+            chunks.reset(splitmix64(config.seed ^ kTerrainStream), 5, 0.5, config.noiseMode, static_cast<size_t>(max(config.chunkBudget, 1)));
+            loadWindow();
+        }
+        else
+        {
+            noise.resize(config.width, config.height);
+            if (noiseCache)
+            {
+                noiseCache->generate(noise, rng, 5, 0.5, config.noiseMode, pool);
+            }
+            else
+            {
+                noise.generate(rng, 5, 0.5, config.noiseMode, pool);
+            }
+            generateLayout();
+        }
+    }
+
+    void loadWindow()
+    {
+        chunks.loadRegion(grid, viewOrigin);
+        int w = grid.getWidth();
+        int h = grid.getHeight();
+        for (int x = 0; x < w; ++x)
+        {
+            grid.setType(Vec2(x, 0), CellType::Wall);
+            grid.setType(Vec2(x, h - 1), CellType::Wall);
+        }
+        for (int y = 0; y < h; ++y)
+        {
+            grid.setType(Vec2(0, y), CellType::Wall);
+            grid.setType(Vec2(w - 1, y), CellType::Wall);
+        }
+    }
+
+    // Entities keep their world position across a pan: anything still under the
+    // window is translated into it, anything left behind is re-homed to the
+    // nearest interior cell (or a free cell when that one is a wall). Seeker
+    // targets that leave the window are dropped and picked afresh.
+    void panWindow(const Vec2 &d)
+    {
+        chunks.storeRegion(grid, viewOrigin, 1);
+        viewOrigin = viewOrigin + d;
+        debugPath.clear();
+        decaying.clear();
+        loadWindow();
+        for (size_t k = 0; k < static_cast<size_t>(AgentKind::Count); ++k)
+        {
+            AgentKind kind = static_cast<AgentKind>(k);
+            AgentColumns &c = agents.of(kind);
+            for (size_t r = 0; r < c.size(); ++r)
+            {
+                if (!c.alive[r])
+                {
+                    continue;
+                }
+                c.position[r] = rehome(c.position[r] - d);
+                spatial.move(c.id[r], c.position[r]);
+                c.target[r] = c.target[r] - d;
+                c.hasTarget[r] = c.hasTarget[r] && insideWindow(c.target[r]);
+                if (kind == AgentKind::SignalSource)
+                {
+                    grid.setType(c.position[r], CellType::Source);
+                }
+                else if (kind == AgentKind::SignalSink)
+                {
+                    grid.setType(c.position[r], CellType::Sink);
+                }
+            }
+        }
+        for (Entity *e : unmanaged)
+        {
+            e->setPos(rehome(e->getPos() - d));
+            spatial.move(e->getId(), e->getPos());
+        }
+        requestRedraw();
+    }
+
+    bool insideWindow(const Vec2 &p) const
+    {
+        return p.x >= 1 && p.y >= 1 && p.x < grid.getWidth() - 1 && p.y < grid.getHeight() - 1;
+    }
+
+    Vec2 rehome(const Vec2 &p)
+    {
+        Vec2 q(min(max(p.x, 1), grid.getWidth() - 2), min(max(p.y, 1), grid.getHeight() - 2));
+        return grid.isWall(q) ? randomEmptyCell() : q;
+    }
+
+    // Window-relative cell lookup; in streaming mode cells outside the window
+    // come from the chunk store, which generates their chunk on first touch.
+    CellType cellType(const Vec2 &p)
+    {
+        if (grid.inBounds(p))
+        {
+            return grid.type(p);
+        }
+        return config.streaming ? chunks.type(viewOrigin + p) : CellType::Wall;
+    }
+
+    void generateLayout()
+    {
+        int w = grid.getWidth();
+        int h = grid.getHeight();
+        grid.forEachRow([&](int y, GridRow row)
+                        {
+                            for (int x = 0; x < row.width; ++x)
+                            {
+                                double v = noise.at(x, y);
+                                bool border = y == 0 || y == h - 1 || x == 0 || x == w - 1;
+                                grid.setType(Vec2(x, y), border ? CellType::Wall : layoutType(v));
+                                row.value1[x] = v;
+                                row.value2[x] = 0.0;
+                            }
+                        });
+        grid.markWallsChanged();
+    }
+
+    void spawnEntities()
+    {
+        for (int i = 0; i < config.wanderers; ++i)
+        {
+            Vec2 p = randomEmptyCell();
+            spawn<Wanderer>(p);
+        }
+        for (int i = 0; i < config.seekers; ++i)
+        {
+            Vec2 p = randomEmptyCell();
+            spawn<Seeker>(p);
+        }
+        for (int i = 0; i < config.trails; ++i)
+        {
+            Vec2 p = randomEmptyCell();
+            spawn<TrailMaker>(p);
+        }
+        for (int i = 0; i < config.sources; ++i)
+        {
+            Vec2 p = randomEmptyCell();
+            spawn<SignalSource>(p);
+            grid.setType(p, CellType::Source);
+        }
+        for (int i = 0; i < config.sinks; ++i)
+        {
+            Vec2 p = randomEmptyCell();
+            spawn<SignalSink>(p);
+            grid.setType(p, CellType::Sink);
+        }
+    }
+
+    Vec2 randomEmptyCell()
+    {
+        if (cells.size(CellIndex::Set::Free) == 0)
+        {
+            return Vec2(1, 1);
+        }
+        return cells.pick(CellIndex::Set::Free, rng);
+    }
+
+    template <typename T>
+    EntityId spawn(const Vec2 &p)
+    {
+        T *agent = entities.create<T>(p, &agents.of(T::Kind));
+        spatial.insert(agent->getId(), p);
+        RNG spawnRng = agent->localRng(config.seed, tick, kSpawnStream);
+        agent->initState(spawnRng);
+        router.add(agent);
+        return agent->getId();
+    }
+
+    template <typename T>
+    EntityId spawnUnmanaged(const Vec2 &p)
+    {
+        T *e = entities.create<T>(p);
+        spatial.insert(e->getId(), p);
+        unmanaged.push_back(e);
+        return e->getId();
+    }
+
+    Entity *resolve(EntityId id) const
+    {
+        return entities.get(id);
+    }
+
+    void despawn(EntityId id)
+    {
+        if (Entity *e = entities.get(id))
+        {
+            e->kill();
+        }
+    }
+
+    const SpatialIndex &getSpatialIndex() const
+    {
+        return spatial;
+    }
+
+    void onEntityMoved(EntityId id, const Vec2 &pos)
+    {
+        spatial.move(id, pos);
+    }
+
+    const AgentStore &getAgents() const
+    {
+        return agents;
+    }
+
+    void entitiesNear(const Vec2 &p, int radius, vector<EntityId> &out) const
+    {
+        spatial.queryRadius(p, radius, out);
+    }
+
+    void entitiesInRect(const Vec2 &lo, const Vec2 &hi, vector<EntityId> &out) const
+    {
+        spatial.queryRect(lo, hi, out);
+    }
+
+    bool isOccupied(const Vec2 &p) const
+    {
+        return spatial.countAt(p) > 0;
+    }
+
+    RNG &random()
+    {
+        return rng;
+    }
+
+    RNG agentRng(EntityId id) const
+    {
+        return RNG::forEntity(config.seed, id.key(), tick);
+    }
+
+    Grid &getGrid()
+    {
+        return grid;
+    }
+
+    const Grid &getGrid() const
+    {
+        return grid;
+    }
+
+    EventQueue &getEvents()
+    {
+        return events;
+    }
+
+    const EventQueue &getEvents() const
+    {
+        return events;
+    }
+
+    Recorder &getRecorder()
+    {
+        return recorder;
+    }
+
+    DeltaServer &getViewers()
+    {
+        return viewers;
+    }
+
+    bool isRunning() const
+    {
+        return running;
+    }
+
+    WorldConfig &getConfig()
+    {
+        return config;
+    }
+
+    size_t agentCount() const
+    {
+        return agents.size();
+    }
+
+    void setNoiseCache(NoiseCache *cache)
+    {
+        noiseCache = cache;
+    }
+
+    uint64_t eventsDispatched(EventType t) const
+    {
+        return dispatched[static_cast<size_t>(t)];
+    }
+
+    // Fraction of non-wall cells currently holding a trail.
+    double trailCoverage() const
+    {
+        size_t open = 0;
+        size_t trails = 0;
+        for (size_t i = 0; i < grid.cellCount(); ++i)
+        {
+            CellType t = grid.type(i);
+            open += t != CellType::Wall;
+            trails += t == CellType::Trail;
+        }
+        return open > 0 ? static_cast<double>(trails) / static_cast<double>(open) : 0.0;
+    }
+
+    void requestRedraw()
+    {
+        redrawRequired = true;
+    }
+
+    // Something other than the renderer wrote to the terminal; repaint in full.
+    void invalidateDisplay()
+    {
+        renderer.invalidate();
+        redrawRequired = true;
+    }
+
+    // Shown under the frame so command replies survive the next repaint.
+    void setCommandOutput(const string &text)
+    {
+        static const size_t kMaxLines = 8;
+        size_t width = max<size_t>(80, static_cast<size_t>(grid.getWidth()));
+        commandOutput.clear();
+        stringstream ss(text);
+        string line;
+        while (getline(ss, line))
+        {
+            if (line.size() > width)
+            {
+                line.resize(width);
+            }
+            commandOutput.push_back(line);
+        }
+        if (commandOutput.size() > kMaxLines)
+        {
+            commandOutput.erase(commandOutput.begin(), commandOutput.end() - static_cast<ptrdiff_t>(kMaxLines));
+        }
+        redrawRequired = true;
+    }
+
+    template <typename... Args>
+    void broadcast(Args &&...args)
+    {
+        events.emplace(std::forward<Args>(args)...);
+    }
+
+    void step(double dt)
+    {
+        if (!running)
+        {
+            return;
+        }
+
+        timeAccum += dt;
+        int steps = 0;
+        while (timeAccum >= timestep)
+        {
+            if (steps == maxCatchUp)
+            {
+                // Too far behind after a stall: drop the backlog instead of spiralling.
+                double behind = floor(timeAccum / timestep);
+                droppedTicks += static_cast<uint64_t>(behind);
+                timeAccum -= behind * timestep;
+                break;
+            }
+            timeAccum -= timestep;
+            stepTick();
+            ++steps;
+        }
+    }
+
+    void stepTick()
+    {
+        PROFILE_SCOPE(Tick);
+        tick++;
+        {
+            PROFILE_SCOPE(EventFlip);
+            events.flip();
+        }
+
+        {
+            PROFILE_SCOPE(EventDispatch);
+            PROFILE_COUNT(EventsDispatched, events.getEvents().size());
+            for (const Event &e : events.getEvents())
+            {
+                router.dispatch(*this, spatial, entities, e);
+                recorder.log(tick, e);
+                ++dispatched[static_cast<size_t>(e.type)];
+            }
+        }
+
+        PROFILE_COUNT(AgentsUpdated, agents.size());
+        if (config.threads > 0)
+        {
+            PROFILE_SCOPE(TiledAgents);
+            stepAgentsParallel(timestep);
+        }
+        else
+        {
+            collectFlowGoals();
+            pathing.retain(grid, flowGoals);
+            agents.update(*this, timestep);
+        }
+        if (!unmanaged.empty())
+        {
+            PROFILE_SCOPE(Unmanaged);
+            for (Entity *e : unmanaged)
+            {
+                if (e->isAlive())
+                {
+                    e->update(*this, timestep);
+                }
+            }
+        }
+
+        if (agents.deadCount() > 0 || !unmanaged.empty())
+        {
+            PROFILE_SCOPE(RemoveDead);
+            size_t before = entities.size();
+            removeDeadEntities();
+            PROFILE_COUNT(EntitiesRemoved, before - entities.size());
+        }
+
+        {
+            PROFILE_SCOPE(Evaporate);
+            PROFILE_COUNT(DecayingCells, decaying.size());
+            evaporateTrails();
+        }
+        viewers.publish(tick, grid, entities);
+        redrawRequired = true;
+    }
+
+    void removeDeadEntities()
+    {
+        router.pruneDead();
+        removedIds.clear();
+        unmanaged.erase(remove_if(unmanaged.begin(), unmanaged.end(),
+                                  [&](const Entity *e)
+                                  {
+                                      if (e->isAlive())
+                                      {
+                                          return false;
+                                      }
+                                      removedIds.push_back(e->getId());
+                                      return true;
+                                  }),
+                        unmanaged.end());
+        agents.removeDead(removedIds);
+        for (EntityId id : removedIds)
+        {
+            spatial.remove(id);
+            entities.release(id);
+        }
+    }
+
+    void evaporateTrails()
+    {
+        decaying.retainIf([&](const Vec2 &p)
+                          {
+                              size_t i = grid.indexOf(p);
+                              CellType t = grid.type(i);
+                              if (t != CellType::Trail && t != CellType::Signal)
+                              {
+                                  return false;
+                              }
+                              CellValue &age = grid.value2(i);
+                              age += 0.02;
+                              if (age >= 1.0)
+                              {
+                                  grid.setType(i, CellType::Empty);
+                                  age = 0.0;
+                                  return false;
+                              }
+                              return true;
+                          });
+    }
+
+    bool needsRedraw() const
+    {
+        return redrawRequired;
+    }
+
+    void composeFrame(vector<string> &lines) const
+    {
+        size_t gridRows = static_cast<size_t>(grid.getHeight());
+        size_t overlayRows = showOverlay ? 3 : 0;
+        lines.resize(gridRows + overlayRows + commandOutput.size());
+        copy(commandOutput.begin(), commandOutput.end(), lines.begin() + static_cast<ptrdiff_t>(gridRows + overlayRows));
+        for (size_t y = 0; y < gridRows; ++y)
+        {
+            lines[y].assign(static_cast<size_t>(grid.getWidth()), ' ');
+        }
+
+        grid.forEach([&](const Vec2 &p, size_t i)
+                     {
+                         char ch = ' ';
+                         if (showNoise)
+                         {
+                             double v = grid.value1(i);
+                             if (v < 0.2)
+                                 ch = ' ';
+                             else if (v < 0.4)
+                                 ch = '.';
+                             else if (v < 0.6)
+                                 ch = '-';
+                             else if (v < 0.8)
+                                 ch = '+';
+                             else
+                                 ch = '#';
+                         }
+                         else
+                         {
+                             ch = cellTypeToChar(grid.type(i));
+                         }
+
+                         lines[static_cast<size_t>(p.y)][static_cast<size_t>(p.x)] = ch;
+                     });
+
+        for (const auto &nodePos : debugPath)
+        {
+            if (grid.inBounds(nodePos))
+            {
+                lines[static_cast<size_t>(nodePos.y)][static_cast<size_t>(nodePos.x)] = '@';
+            }
+        }
+
+        entities.forEach([&](const Entity &e)
+                         {
+                             if (e.isAlive())
+                             {
+                                 Vec2 p = e.getPos();
+                                 if (grid.inBounds(p))
+                                 {
+                                     lines[static_cast<size_t>(p.y)][static_cast<size_t>(p.x)] = e.glyph();
+                                 }
+                             }
+                         });
+
+        if (showOverlay)
+        {
+            ostringstream status;
+            status << "tick: " << tick
+                   << " entities: " << entities.size()
+                   << " running: " << (running ? "yes" : "no")
+                   << " mode: " << (advancedMode ? "advanced" : "basic")
+                   << " overlay: " << (showOverlay ? "on" : "off")
+                   << " noise: " << (showNoise ? "on" : "off")
+                   << " ids: " << (showIds ? "on" : "off");
+            lines[gridRows].clear();
+            lines[gridRows + 1] = status.str();
+            lines[gridRows + 2] = "commands: [p]ause/[r]esume, [q]uit, [n]oise, [o]verlay, [c]lear path, "
+                                  "[a]dv mode, [s]ave log <file>, [g]enerate path, [?]help";
+        }
+    }
+
+    void render(ostream &os)
+    {
+        if (!redrawRequired || !renderer.frameDue())
+        {
+            return;
+        }
+        PROFILE_SCOPE(Render);
+        composeFrame(renderer.frame(0));
+        renderer.present(os);
+        PROFILE_COUNT(BytesRendered, renderer.getLastBytes());
+        redrawRequired = false;
+    }
+
+    shared_ptr<const FrameSnapshot> captureFrame()
+    {
+        PROFILE_SCOPE(Render);
+        shared_ptr<FrameSnapshot> frame = make_shared<FrameSnapshot>();
+        frame->tick = tick;
+        frame->paused = !running;
+        composeFrame(frame->lines);
+        redrawRequired = false;
+        return frame;
+    }
+
+    // Called from the render thread; the caller serialises access to the renderer.
+    bool presentFrame(const FrameSnapshot &frame, ostream &os)
+    {
+        if (!renderer.frameDue())
+        {
+            return false;
+        }
+        renderer.frame(frame.lines.size()) = frame.lines;
+        renderer.present(os);
+        return true;
+    }
+
+    void handleCommand(const Command &cmd)
+    {
+        if (cmd.name.empty())
+        {
+            return;
+        }
+
+        if (cmd.name == "q" || cmd.name == "quit" || cmd.name == "exit")
+        {
+            running = false;
+        }
+        else if (cmd.name == "p" || cmd.name == "pause")
+        {
+            running = false;
+        }
+        else if (cmd.name == "r" || cmd.name == "resume")
+        {
+            running = true;
+        }
+        else if (cmd.name == "overlay" || cmd.name == "o")
+        {
+            showOverlay = !showOverlay;
+            requestRedraw();
+        }
+        else if (cmd.name == "noisemode")
+        {
+            if (!cmd.args.empty())
+            {
+                const string &m = cmd.args[0];
+                if (m == "classic")
+                    config.noiseMode = NoiseMode::Classic;
+                else if (m == "value")
+                    config.noiseMode = NoiseMode::Value;
+                else if (m == "perlin")
+                    config.noiseMode = NoiseMode::Perlin;
+                auto t0 = chrono::high_resolution_clock::now();
+                regenerate();
+                double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - t0).count();
+                cout << "regenerated in " << ms << " ms\n";
+            }
+            cout << "noise mode: " << noiseModeName(config.noiseMode) << "\n";
+        }
+        else if (cmd.name == "stream")
+        {
+            if (!cmd.args.empty())
+            {
+                config.streaming = cmd.args[0] == "on";
+                viewOrigin = Vec2(0, 0);
+                regenerate();
+            }
+            cout << "streaming: " << (config.streaming ? "on" : "off") << " view origin: " << viewOrigin << "\n";
+        }
+        else if (cmd.name == "pan")
+        {
+            if (!config.streaming)
+            {
+                cout << "pan needs streaming mode ('stream on')\n";
+            }
+            else
+            {
+                Vec2 d;
+                if (cmd.args.size() < 2 || !parseNumber(cmd.args[0], d.x) || !parseNumber(cmd.args[1], d.y))
+                {
+                    cout << "usage: pan <dx> <dy>\n";
+                }
+                else
+                {
+                    panWindow(d);
+                    cout << "view origin: " << viewOrigin << "\n";
+                }
+            }
+        }
+        else if (cmd.name == "chunks")
+        {
+            cout << "chunks: " << chunks.chunkCount() << " resident: " << chunks.residentCount()
+                 << " generated: " << chunks.generatedCount() << " bytes: " << chunks.memoryBytes() << "\n";
+        }
+        else if (cmd.name == "noise" || cmd.name == "n")
+        {
+            showNoise = !showNoise;
+            requestRedraw();
+        }
+        else if (cmd.name == "ids" || cmd.name == "i")
+        {
+            showIds = !showIds;
+            requestRedraw();
+        }
+        else if (cmd.name == "rec" || cmd.name == "record")
+        {
+            if (recorder.isEnabled())
+            {
+                recorder.stop();
+                cout << "recording stopped: " << recorder.getRecorded() << " records (" << recorder.getDropped()
+                     << " dropped), " << recorder.getBytesWritten() << " bytes in " << recorder.getPath() << "\n";
+            }
+            else
+            {
+                string file = cmd.args.empty() ? "sim.rec" : cmd.args[0];
+                bool pack = cmd.args.size() >= 2 && cmd.args[1] == "packed";
+                if (recorder.start(file, pack))
+                {
+                    cout << "recording " << (pack ? "packed " : "") << "events to " << file << "\n";
+                }
+                else
+                {
+                    cout << "could not open " << file << "\n";
+                }
+            }
+        }
+        else if (cmd.name == "serve")
+        {
+            int port = 0;
+            if (!cmd.args.empty() && cmd.args[0] == "off")
+            {
+                viewers.stop();
+            }
+            else if (!cmd.args.empty() && (!parseNumber(cmd.args[0], port) || port < 0 || port > 65535))
+            {
+                cout << "usage: serve [port|off]\n";
+            }
+            else if (!cmd.args.empty() && !viewers.start(port))
+            {
+                cout << "could not listen on port " << cmd.args[0] << "\n";
+            }
+            if (viewers.isRunning())
+            {
+                cout << "serving deltas on port " << viewers.getPort() << ": " << viewers.getClientCount() << " viewers, "
+                     << viewers.getFramesPublished() << " frames (" << viewers.getFramesDropped() << " dropped), "
+                     << viewers.getBytesSent() << " bytes sent\n";
+            }
+            else
+            {
+                cout << "not serving (start with serve <port>)\n";
+            }
+        }
+        else if (cmd.name == "save" || cmd.name == "s")
+        {
+            if (recorder.isEnabled())
+            {
+                recorder.flush();
+                cout << "flushed " << recorder.getRecorded() << " records (" << recorder.getBytesWritten() << " bytes) to "
+                     << recorder.getPath() << "\n";
+            }
+            else
+            {
+                cout << "not recording (start with rec [file])\n";
+            }
+        }
+        else if (cmd.name == "snapshot")
+        {
+            if (!cmd.args.empty())
+            {
+                auto t0 = chrono::high_resolution_clock::now();
+                if (saveSnapshot(cmd.args[0]))
+                {
+                    double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - t0).count();
+                    cout << "snapshot of tick " << tick << " written to " << cmd.args[0] << " in " << ms << " ms\n";
+                }
+                else
+                {
+                    cout << "could not write snapshot " << cmd.args[0] << "\n";
+                }
+            }
+        }
+        else if (cmd.name == "load")
+        {
+            if (!cmd.args.empty())
+            {
+                auto t0 = chrono::high_resolution_clock::now();
+                if (loadSnapshot(cmd.args[0]))
+                {
+                    double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - t0).count();
+                    cout << "loaded tick " << tick << " (" << entities.size() << " entities) from " << cmd.args[0] << " in " << ms << " ms\n";
+                }
+                else
+                {
+                    cout << "could not load snapshot " << cmd.args[0] << "\n";
+                }
+            }
+        }
+        else if (cmd.name == "paths")
+        {
+            cout << "cached flow fields: " << pathing.fieldCount()
+                 << " (" << pathing.fieldBytes() / 1024 << " KB, " << pathing.buildCount() << " builds)"
+                 << " hpa nodes: " << hpa.nodeCount()
+                 << " hpa chunk rebuilds: " << hpa.getRebuiltChunks() << "\n";
+        }
+        else if (cmd.name == "hpath")
+        {
+            generateHierarchicalPath();
+        }
+        else if (cmd.name == "wall")
+        {
+            Vec2 p;
+            if (cmd.args.size() < 2 || !parseNumber(cmd.args[0], p.x) || !parseNumber(cmd.args[1], p.y))
+            {
+                cout << "usage: wall <x> <y>\n";
+            }
+            else
+            {
+                setWall(p, cellType(p) != CellType::Wall);
+            }
+        }
+        else if (cmd.name == "regen")
+        {
+            regenerate();
+        }
+        else if (cmd.name == "seed")
+        {
+            unsigned seed = 0;
+            if (!cmd.args.empty() && !parseNumber(cmd.args[0], seed))
+            {
+                cout << "usage: seed <n>\n";
+            }
+            else if (!cmd.args.empty())
+            {
+                config.seed = seed;
+                rng.seed(config.seed);
+                tick = 0;
+                timeAccum = 0.0;
+                events.clear();
+                regenerate();
+            }
+            cout << "seed: " << config.seed << "\n";
+        }
+        else if (cmd.name == "threads")
+        {
+            int n = 0;
+            if (!cmd.args.empty() && !parseNumber(cmd.args[0], n))
+            {
+                cout << "usage: threads [n]\n";
+            }
+            else if (!cmd.args.empty())
+            {
+                config.threads = max(0, n);
+                pool.resize(static_cast<size_t>(max(config.threads, 1)));
+            }
+            cout << "threads: " << config.threads << (config.threads == 0 ? " (sequential)" : " (tiled parallel)") << "\n";
+        }
+        else if (cmd.name == "gridbench")
+        {
+            int n = 2048;
+            if (!cmd.args.empty() && !parseNumber(cmd.args[0], n))
+            {
+                cout << "usage: gridbench [n]\n";
+            }
+            else
+            {
+                benchmarkGridIteration(max(1, n), cout);
+            }
+        }
+        else if (cmd.name == "fps")
+        {
+            double cap = 0.0;
+            if (!cmd.args.empty() && !parseNumber(cmd.args[0], cap))
+            {
+                cout << "usage: fps [n]\n";
+            }
+            else if (!cmd.args.empty())
+            {
+                renderer.setFrameCap(cap);
+            }
+            cout << "frame cap: " << renderer.getFrameCap() << (renderer.getFrameCap() <= 0.0 ? " (uncapped)" : " fps")
+                 << ", last frame " << renderer.getLastBytes() << " bytes\n";
+        }
+        else if (cmd.name == "stats")
+        {
+            if (!cmd.args.empty() && cmd.args[0] == "reset")
+            {
+                Profiler::instance().reset();
+            }
+            Profiler::instance().report(cout);
+        }
+        else if (cmd.name == "trace")
+        {
+            if (!cmd.args.empty())
+            {
+                bool ok = Profiler::instance().exportTrace(cmd.args[0]);
+                cout << (ok ? "wrote trace to " : "cannot write ") << cmd.args[0] << "\n";
+            }
+        }
+        else if (cmd.name == "hash")
+        {
+            cout << "tick " << tick << " state hash: " << hex << stateHash() << dec << "\n";
+        }
+        else if (cmd.name == "catchup")
+        {
+            int n = 0;
+            if (!cmd.args.empty() && !parseNumber(cmd.args[0], n))
+            {
+                cout << "usage: catchup [n]\n";
+            }
+            else if (!cmd.args.empty())
+            {
+                maxCatchUp = max(1, n);
+            }
+            cout << "catch-up limit: " << maxCatchUp << " ticks per frame, " << droppedTicks << " ticks dropped\n";
+        }
+        else if (cmd.name == "step")
+        {
+            int n = 1;
+            if (!cmd.args.empty() && !parseNumber(cmd.args[0], n))
+            {
+                cout << "usage: step [n]\n";
+            }
+            else
+            {
+                for (int i = 0; i < n; ++i)
+                {
+                    step(timestep);
+                }
+            }
+        }
+        else if (cmd.name == "who" || cmd.name == "w")
+        {
+            Vec2 p;
+            int r = 0;
+            if (cmd.args.size() < 2 || !parseNumber(cmd.args[0], p.x) || !parseNumber(cmd.args[1], p.y) ||
+                (cmd.args.size() >= 3 && (!parseNumber(cmd.args[2], r) || r < 0)))
+            {
+                cout << "usage: who <x> <y> [r]\n";
+            }
+            else
+            {
+                vector<EntityId> found;
+                entitiesNear(p, r, found);
+                cout << "entities within " << r << " of " << p << ":";
+                for (EntityId id : found)
+                {
+                    cout << " " << id;
+                }
+                cout << "\n";
+            }
+        }
+        else if (cmd.name == "radius")
+        {
+            int n = 0;
+            if (!cmd.args.empty() && !parseNumber(cmd.args[0], n))
+            {
+                cout << "usage: radius [n]\n";
+            }
+            else if (!cmd.args.empty())
+            {
+                config.pingRadius = max(0, n);
+            }
+            cout << "ping radius: " << config.pingRadius << (config.pingRadius == 0 ? " (unbounded)" : "") << "\n";
+        }
+        else if (cmd.name == "help" || cmd.name == "?")
+        {
+            cout << "basic commands:\n";
+            cout << "  q/quit/exit     - stop\n";
+            cout << "  p/pause         - pause\n";
+            cout << "  r/resume        - resume\n";
+            cout << "  overlay/o       - toggle overlay\n";
+            cout << "  noise/n         - toggle noise mode\n";
+            cout << "  noisemode [m]   - terrain noise: classic, value or perlin (regenerates)\n";
+            cout << "  stream [on|off] - lazily generated chunked world seen through the grid window\n";
+            cout << "  pan <dx> <dy>   - move the streaming window; edits stay in the chunk store, entities move with the world\n";
+            cout << "  chunks          - show chunk store residency and memory\n";
+            cout << "  ids/i           - toggle ids\n";
+            cout << "  regen           - regenerate world\n";
+            cout << "  step [n]        - step n ticks (default 1)\n";
+            cout << "  catchup [n]     - most ticks run per frame after a stall (excess time is dropped)\n";
+            cout << "  rec/record [file] [packed] - toggle streaming event records to file (default sim.rec)\n";
+            cout << "  save/s          - flush the recording to disk\n";
+            cout << "  serve [port|off] - stream per-tick binary deltas to TCP viewers\n";
+            cout << "  snapshot <file> - write a binary snapshot of the world\n";
+            cout << "  load <file>     - restore a snapshot written by 'snapshot'\n";
+            cout << "  g/genpath       - generate a path between source and sink\n";
+            cout << "  c/clear         - clear path\n";
+            cout << "  w/who <x> <y> [r] - list entities within r of a cell\n";
+            cout << "  radius [n]      - ping/arrive delivery radius (0 = all subscribers)\n";
+            cout << "  seed <n>        - reseed and regenerate the world\n";
+            cout << "  threads [n]     - 0 = sequential step, n >= 1 = deterministic tiled step on n threads\n";
+            cout << "  hash            - print a checksum of the world state\n";
+            cout << "  stats [reset]   - per-phase tick timings and counters (build with -DSIM_PROFILE)\n";
+            cout << "  trace <file>    - export recorded phases as Chrome trace / Perfetto JSON\n";
+            cout << "  fps [n]         - cap terminal redraws at n frames per second (0 = every frame)\n";
+            cout << "  paths           - show cached flow fields and hierarchy stats\n";
+            cout << "  gridbench [n]   - time grid iteration strategies on an n x n grid\n";
+            cout << "  hpath           - hierarchical path between a source and a sink\n";
+            cout << "  wall <x> <y>    - toggle a wall cell (outside the window in streaming mode too)\n";
+        }
+        else if (cmd.name == "genpath" || cmd.name == "g")
+        {
+            generatePathBetweenSourceAndSink();
+        }
+        else if (cmd.name == "clear" || cmd.name == "c")
+        {
+            debugPath.clear();
+            requestRedraw();
+        }
+        else if (cmd.name == "mode" || cmd.name == "a")
+        {
+            advancedMode = !advancedMode;
+            requestRedraw();
+        }
+    }
+
+    void regenerate()
+    {
+        debugPath.clear();
+        router.clear();
+        unmanaged.clear();
+        entities.clear();
+        agents.clear();
+        spatial.clear();
+        decaying.clear();
+        grid.fill(CellType::Empty);
+        buildTerrain();
+        spawnEntities();
+        requestRedraw();
+    }
+
+    bool saveSnapshot(const string &path) const
+    {
+        SnapshotWriter out(path);
+        if (!out.good())
+        {
+            return false;
+        }
+        SnapshotHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, kSnapshotMagic, sizeof(h.magic));
+        h.version = kSnapshotVersion;
+        h.cellValueBytes = static_cast<uint32_t>(sizeof(CellValue));
+        h.config = config;
+        h.tick = tick;
+        h.originX = viewOrigin.x;
+        h.originY = viewOrigin.y;
+        h.rngKey = rng.key;
+        h.rngCounter = rng.counter;
+        out.value(h);
+        grid.save(out);
+        noise.save(out);
+        entities.saveSlots(out);
+        for (size_t k = 0; k < static_cast<size_t>(AgentKind::Count); ++k)
+        {
+            agents.of(static_cast<AgentKind>(k)).save(out);
+        }
+        spatial.save(out);
+        events.save(out);
+        return out.good();
+    }
+
+    bool loadSnapshot(const string &path)
+    {
+        MappedFile file;
+        if (!file.open(path))
+        {
+            return false;
+        }
+        SnapshotReader in(file.bytes(), file.size());
+        SnapshotHeader h;
+        if (!in.value(h) || memcmp(h.magic, kSnapshotMagic, sizeof(h.magic)) != 0 || h.version != kSnapshotVersion ||
+            h.cellValueBytes != sizeof(CellValue))
+        {
+            return false;
+        }
+        Grid loadedGrid;
+        NoiseField loadedNoise(0, 0);
+        vector<uint32_t> generations;
+        vector<uint32_t> freeList;
+        AgentColumns loaded[static_cast<size_t>(AgentKind::Count)];
+        SpatialIndex loadedSpatial;
+        EventQueue loadedEvents;
+        if (!loadedGrid.load(in) || !loadedNoise.load(in) || !in.array(generations) || !in.array(freeList))
+        {
+            return false;
+        }
+        for (auto &c : loaded)
+        {
+            if (!c.load(in))
+            {
+                return false;
+            }
+        }
+        loadedSpatial.resize(loadedGrid.getWidth(), loadedGrid.getHeight());
+        if (!loadedSpatial.load(in, generations.size()) || !loadedEvents.load(in) ||
+            !validSnapshot(h, loadedGrid, loadedNoise, generations, freeList, loaded))
+        {
+            return false;
+        }
+
+        // Everything below was validated above, so the live world is only
+        // replaced once the whole snapshot is known to be good.
+        debugPath.clear();
+        router.clear();
+        unmanaged.clear();
+        entities.clear();
+        agents.clear();
+        entities.restoreSlots(generations, freeList);
+        config = h.config;
+        tick = h.tick;
+        viewOrigin = Vec2(h.originX, h.originY);
+        rng = RNG(h.rngKey, h.rngCounter);
+        pool.resize(static_cast<size_t>(max(config.threads, 1)));
+        grid.swapContents(loadedGrid);
+        noise = move(loadedNoise);
+        spatial = move(loadedSpatial);
+        events = move(loadedEvents);
+        if (config.streaming)
+        {
+            chunks.reset(splitmix64(config.seed ^ kTerrainStream), 5, 0.5, config.noiseMode, static_cast<size_t>(max(config.chunkBudget, 1)));
+            chunks.storeRegion(grid, viewOrigin, 1);
+        }
+        for (size_t k = 0; k < static_cast<size_t>(AgentKind::Count); ++k)
+        {
+            AgentKind kind = static_cast<AgentKind>(k);
+            const AgentColumns &src = loaded[k];
+            for (size_t r = 0; r < src.size(); ++r)
+            {
+                Agent *agent = restoreAgent(kind, src.id[r], src.position[r]);
+                AgentColumns &dst = agent->storage();
+                size_t row = agent->storageRow();
+                dst.velocity[row] = src.velocity[r];
+                dst.speed[row] = src.speed[r];
+                dst.phase[row] = src.phase[r];
+                dst.target[row] = src.target[r];
+                dst.hasTarget[row] = src.hasTarget[r];
+                dst.cooldown[row] = src.cooldown[r];
+                dst.timer[row] = src.timer[r];
+                if (!src.alive[r])
+                {
+                    agent->kill();
+                }
+                router.add(agent);
+            }
+        }
+        decaying.resize(grid.getWidth(), grid.getHeight());
+        grid.forEach([&](const Vec2 &p, size_t i)
+                     {
+                         CellType t = grid.type(i);
+                         if (t == CellType::Trail || t == CellType::Signal)
+                         {
+                             decaying.insert(p);
+                         }
+                     });
+        requestRedraw();
+        return true;
+    }
+
+    static const int kMaxSnapshotThreads = 1024;
+
+    // Checks what the section loaders cannot see on their own: the header config
+    // against the grid and noise planes, the free list, and every agent id against
+    // its slot generation (once each) with its position inside the grid.
+    static bool validSnapshot(const SnapshotHeader &h, const Grid &g, const NoiseField &n, const vector<uint32_t> &generations,
+                              const vector<uint32_t> &freeList, const AgentColumns *loaded)
+    {
+        const WorldConfig &c = h.config;
+        unsigned char streaming = 0;
+        memcpy(&streaming, &c.streaming, 1);
+        int mode = static_cast<int>(c.noiseMode);
+        if (streaming > 1 || mode < static_cast<int>(NoiseMode::Classic) || mode > static_cast<int>(NoiseMode::Perlin) ||
+            c.width != g.getWidth() || c.height != g.getHeight() || c.width < 3 || c.height < 3 ||
+            c.threads < 0 || c.threads > kMaxSnapshotThreads || c.wanderers < 0 || c.seekers < 0 || c.trails < 0 ||
+            c.sources < 0 || c.sinks < 0 || c.pingRadius < 0 || c.chunkBudget < 1 || h.tick < 0)
+        {
+            return false;
+        }
+        bool noiseMatches = n.getWidth() == g.getWidth() && n.getHeight() == g.getHeight();
+        if (!noiseMatches && !(streaming && n.getWidth() == 0 && n.getHeight() == 0))
+        {
+            return false;
+        }
+        vector<uint8_t> taken(generations.size(), 0);
+        for (uint32_t i : freeList)
+        {
+            if (i == 0 || i >= generations.size() || taken[i])
+            {
+                return false;
+            }
+            taken[i] = 1;
+        }
+        for (size_t k = 0; k < static_cast<size_t>(AgentKind::Count); ++k)
+        {
+            const AgentColumns &src = loaded[k];
+            for (size_t r = 0; r < src.size(); ++r)
+            {
+                EntityId id = src.id[r];
+                if (id.index == 0 || id.index >= generations.size() || taken[id.index] ||
+                    generations[id.index] != id.generation || !g.inBounds(src.position[r]) ||
+                    (src.hasTarget[r] && !g.inBounds(src.target[r])))
+                {
+                    return false;
+                }
+                taken[id.index] = 1;
+            }
+        }
+        return true;
+    }
+
+    Agent *restoreAgent(AgentKind kind, EntityId id, const Vec2 &p)
+    {
+        switch (kind)
+        {
+        case AgentKind::Wanderer:
+            return entities.createAt<Wanderer>(id, p, &agents.of(kind));
+        case AgentKind::Seeker:
+            return entities.createAt<Seeker>(id, p, &agents.of(kind));
+        case AgentKind::TrailMaker:
+            return entities.createAt<TrailMaker>(id, p, &agents.of(kind));
+        case AgentKind::SignalSource:
+            return entities.createAt<SignalSource>(id, p, &agents.of(kind));
+        case AgentKind::SignalSink:
+            return entities.createAt<SignalSink>(id, p, &agents.of(kind));
+        default:
+            return nullptr;
+        }
+    }
+
+    uint64_t stateHash() const
+    {
+        uint64_t h = 1469598103934665603ull;
+        auto mix = [&](uint64_t v)
+        {
+            h = (h ^ v) * 1099511628211ull;
+        };
+        auto mixDouble = [&](double d)
+        {
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            mix(bits);
+        };
+        mix(static_cast<uint64_t>(tick));
+        for (int y = 0; y < grid.getHeight(); ++y)
+        {
+            for (int x = 0; x < grid.getWidth(); ++x)
+            {
+                Vec2 p(x, y);
+                mix(static_cast<uint64_t>(grid.type(p)));
+                mixDouble(grid.value2(p));
+            }
+        }
+        for (size_t k = 0; k < static_cast<size_t>(AgentKind::Count); ++k)
+        {
+            const AgentColumns &c = agents.of(static_cast<AgentKind>(k));
+            for (size_t r = 0; r < c.size(); ++r)
+            {
+                mix(c.id[r].key());
+                mix((static_cast<uint64_t>(static_cast<uint32_t>(c.position[r].x)) << 32) | static_cast<uint32_t>(c.position[r].y));
+                mix((static_cast<uint64_t>(static_cast<uint32_t>(c.velocity[r].x)) << 32) | static_cast<uint32_t>(c.velocity[r].y));
+                mix((static_cast<uint64_t>(static_cast<uint32_t>(c.target[r].x)) << 32) | static_cast<uint32_t>(c.target[r].y));
+                mix(c.alive[r] | (c.hasTarget[r] << 1));
+                mixDouble(c.phase[r]);
+                mixDouble(c.timer[r]);
+            }
+        }
+        for (const Event &e : events.getEvents())
+        {
+            mix(static_cast<uint64_t>(e.type));
+            mix(e.from.key());
+        }
+        return h;
+    }
+
+    void generatePathBetweenSourceAndSink()
+    {
+        if (cells.size(CellIndex::Set::Source) == 0 || cells.size(CellIndex::Set::Sink) == 0)
+        {
+            return;
+        }
+
+        Vec2 s = cells.pick(CellIndex::Set::Source, rng);
+        Vec2 t = cells.pick(CellIndex::Set::Sink, rng);
+
+        vector<Vec2> path;
+        bool ok = pathing.flowPath(grid, s, t, path);
+        if (ok)
+        {
+            debugPath = path;
+            requestRedraw();
+        }
+    }
+
+    void generateHierarchicalPath()
+    {
+        if (cells.size(CellIndex::Set::Source) == 0 || cells.size(CellIndex::Set::Sink) == 0)
+        {
+            return;
+        }
+
+        Vec2 s = cells.pick(CellIndex::Set::Source, rng);
+        Vec2 t = cells.pick(CellIndex::Set::Sink, rng);
+
+        vector<Vec2> path;
+        auto t0 = chrono::high_resolution_clock::now();
+        bool ok = hpa.findPath(grid, s, t, path);
+        double us = chrono::duration<double, micro>(chrono::high_resolution_clock::now() - t0).count();
+        cout << "hpath " << s << " -> " << t << ": " << (ok ? path.size() : 0) << " cells in " << us << " us\n";
+        if (ok)
+        {
+            debugPath = path;
+            requestRedraw();
+        }
+    }
+
+    void addTrailAt(const Vec2 &p)
+    {
+        if (grid.inBounds(p))
+        {
+            size_t i = grid.indexOf(p);
+            CellType t = grid.type(i);
+            if (t == CellType::Empty || t == CellType::MarkerA || t == CellType::MarkerB || t == CellType::MarkerC)
+            {
+                grid.setType(i, CellType::Trail);
+                grid.value2(i) = 0.0;
+                decaying.insert(p);
+            }
+        }
+    }
+
+    void addSignalAt(const Vec2 &p)
+    {
+        if (grid.inBounds(p))
+        {
+            size_t i = grid.indexOf(p);
+            CellType t = grid.type(i);
+            if (t == CellType::Empty || t == CellType::Trail)
+            {
+                grid.setType(i, CellType::Signal);
+                grid.value2(i) = 0.0;
+                decaying.insert(p);
+            }
+        }
+    }
+
+    PathfindingService &getPathing()
+    {
+        return pathing;
+    }
+
+    bool findPathHierarchical(const Vec2 &from, const Vec2 &to, vector<Vec2> &out)
+    {
+        return hpa.findPath(grid, from, to, out);
+    }
+
+    void setWall(const Vec2 &p, bool wall)
+    {
+        if (!grid.inBounds(p))
+        {
+            if (config.streaming)
+            {
+                chunks.setType(viewOrigin + p, wall ? CellType::Wall : CellType::Empty);
+                chunks.trim();
+            }
+            return;
+        }
+        if (grid.isWall(p) == wall)
+        {
+            return;
+        }
+        grid.setType(p, wall ? CellType::Wall : CellType::Empty);
+        grid.markWallsChanged();
+        hpa.noteWallChange(p, grid.getWallVersion());
+        requestRedraw();
+    }
+
+    bool flowDirection(const Vec2 &from, const Vec2 &goal, Vec2 &outDir)
+    {
+        return PathfindingService::stepAlong(grid, pathing.flowField(grid, goal), from, outDir);
+    }
+
+    const PathfindingService::FlowField *flowFieldFor(const Vec2 &goal)
+    {
+        return &pathing.flowField(grid, goal);
+    }
+
+    RNG &rowStream(const AgentColumns &c, size_t r)
+    {
+        (void)c;
+        (void)r;
+        return rng;
+    }
+
+    Vec2 randomSource(RNG &r) const
+    {
+        if (cells.size(CellIndex::Set::Source) == 0)
+        {
+            return Vec2(1, 1);
+        }
+        return cells.pick(CellIndex::Set::Source, r);
+    }
+
+    Vec2 randomSink(RNG &r) const
+    {
+        if (cells.size(CellIndex::Set::Sink) == 0)
+        {
+            return Vec2(1, 1);
+        }
+        return cells.pick(CellIndex::Set::Sink, r);
+    }
+
+    Vec2 randomSource()
+    {
+        return randomSource(rng);
+    }
+
+    Vec2 randomSink()
+    {
+        return randomSink(rng);
+    }
+
+    int getTick() const
+    {
+        return tick;
+    }
+
+    bool isAdvancedMode() const
+    {
+        return advancedMode;
+    }
+
+    bool isShowIds() const
+    {
+        return showIds;
+    }
+
+    int getPingRadius() const
+    {
+        return config.pingRadius;
+    }
+};
+
+class TileContext
+{
+    World &world;
+    TickBuffer &buffer;
+    RNG agentStream;
+
+public:
+    TileContext(World &w, TickBuffer &b)
+        : world(w), buffer(b), agentStream(0, 0)
+    {
+    }
+
+    void setAgent(const AgentColumns &c, size_t r)
+    {
+        agentStream = world.agentRng(c.id[r]);
+    }
+
+    RNG &rowStream(const AgentColumns &c, size_t r)
+    {
+        setAgent(c, r);
+        return agentStream;
+    }
+
+    RNG agentRng(EntityId id) const
+    {
+        return world.agentRng(id);
+    }
+
+    const Grid &getGrid() const
+    {
+        return world.getGrid();
+    }
+
+    bool isAdvancedMode() const
+    {
+        return world.isAdvancedMode();
+    }
+
+    int getPingRadius() const
+    {
+        return world.getPingRadius();
+    }
+
+    RNG &random()
+    {
+        return agentStream;
+    }
+
+    Vec2 randomSink()
+    {
+        return world.randomSink(agentStream);
+    }
+
+    bool flowDirection(const Vec2 &from, const Vec2 &goal, Vec2 &outDir)
+    {
+        const PathfindingService::FlowField *f = world.getPathing().findField(world.getGrid(), goal);
+        return f && PathfindingService::stepAlong(world.getGrid(), *f, from, outDir);
+    }
+
+    const PathfindingService::FlowField *flowFieldFor(const Vec2 &goal) const
+    {
+        return world.getPathing().findField(world.getGrid(), goal);
+    }
+
+    template <typename... Args>
+    void broadcast(Args &&...args)
+    {
+        buffer.events.emplace_back(std::forward<Args>(args)...);
+    }
+
+    void addTrailAt(const Vec2 &p)
+    {
+        buffer.writes.push_back(GridWrite{p, CellType::Trail});
+    }
+
+    void addSignalAt(const Vec2 &p)
+    {
+        buffer.writes.push_back(GridWrite{p, CellType::Signal});
+    }
+
+    void onEntityMoved(EntityId id, const Vec2 &pos)
+    {
+        buffer.moves.push_back(SpatialIndex::Entry{id, pos});
+    }
+};
+
+// Every sink plus any other cell a Seeker is heading for; one flow field each
+void World::collectFlowGoals()
+{
+    cells.collect(CellIndex::Set::Sink, flowGoals);
+    size_t sinks = flowGoals.size();
+    const AgentColumns &seekers = agents.of(AgentKind::Seeker);
+    for (size_t r = 0; r < seekers.size(); ++r)
+    {
+        if (seekers.alive[r] && seekers.hasTarget[r] &&
+            !(grid.inBounds(seekers.target[r]) && grid.type(seekers.target[r]) == CellType::Sink) &&
+            find(flowGoals.begin() + static_cast<ptrdiff_t>(sinks), flowGoals.end(), seekers.target[r]) == flowGoals.end())
+        {
+            flowGoals.push_back(seekers.target[r]);
+        }
+    }
+}
+
+void World::stepAgentsParallel(double dt)
+{
+    int side = 1 << tileShift;
+    int tilesX = max(1, (grid.getWidth() + side - 1) / side);
+    int tilesY = max(1, (grid.getHeight() + side - 1) / side);
+    size_t tileCount = static_cast<size_t>(tilesX * tilesY);
+    if (tileBuffers.size() != tileCount)
+    {
+        tileBuffers.assign(tileCount, TickBuffer());
+    }
+
+    auto tileOf = [&](const Vec2 &p)
+    {
+        int tx = min(max(p.x, 0) >> tileShift, tilesX - 1);
+        int ty = min(max(p.y, 0) >> tileShift, tilesY - 1);
+        return static_cast<size_t>(ty * tilesX + tx);
+    };
+
+    collectFlowGoals();
+    pathing.prepare(grid, flowGoals);
+
+    tileStart.assign(tileCount + 1, 0);
+    for (size_t k = 0; k < static_cast<size_t>(AgentKind::Count); ++k)
+    {
+        const AgentColumns &c = agents.of(static_cast<AgentKind>(k));
+        for (size_t r = 0; r < c.size(); ++r)
+        {
+            if (c.alive[r])
+            {
+                ++tileStart[tileOf(c.position[r]) + 1];
+            }
+        }
+    }
+    for (size_t t = 0; t < tileCount; ++t)
+    {
+        tileStart[t + 1] += tileStart[t];
+    }
+    tileOrder.resize(tileStart[tileCount]);
+    tileCursor.assign(tileStart.begin(), tileStart.end() - 1);
+    for (size_t k = 0; k < static_cast<size_t>(AgentKind::Count); ++k)
+    {
+        const AgentColumns &c = agents.of(static_cast<AgentKind>(k));
+        for (size_t r = 0; r < c.size(); ++r)
+        {
+            if (c.alive[r])
+            {
+                tileOrder[tileCursor[tileOf(c.position[r])]++] = AgentRef{static_cast<uint32_t>(k), static_cast<uint32_t>(r)};
+            }
+        }
+    }
+
+    pool.parallelFor(tileCount, [&](size_t t)
+                     {
+                         TickBuffer &buf = tileBuffers[t];
+                         buf.clear();
+                         TileContext ctx(*this, buf);
+                         for (uint32_t i = tileStart[t]; i < tileStart[t + 1];)
+                         {
+                             const AgentRef &ref = tileOrder[i];
+                             AgentKind kind = static_cast<AgentKind>(ref.kind);
+                             AgentColumns &c = agents.of(kind);
+                             if (kind == AgentKind::Seeker || kind == AgentKind::TrailMaker)
+                             {
+                                 buf.rows.clear();
+                                 for (; i < tileStart[t + 1] && tileOrder[i].kind == ref.kind; ++i)
+                                 {
+                                     if (c.alive[tileOrder[i].row])
+                                     {
+                                         buf.rows.push_back(tileOrder[i].row);
+                                     }
+                                 }
+                                 if (kind == AgentKind::Seeker)
+                                 {
+                                     Seeker::updateRows(ctx, c, buf.rows.data(), buf.rows.size(), dt);
+                                 }
+                                 else
+                                 {
+                                     TrailMaker::updateRows(ctx, c, buf.rows.data(), buf.rows.size(), dt);
+                                 }
+                                 continue;
+                             }
+                             ++i;
+                             size_t r = ref.row;
+                             if (!c.alive[r])
+                             {
+                                 continue;
+                             }
+                             ctx.setAgent(c, r);
+                             switch (kind)
+                             {
+                             case AgentKind::Wanderer:
+                                 Wanderer::updateRow(ctx, c, r, dt);
+                                 break;
+                             case AgentKind::SignalSource:
+                                 SignalSource::updateRow(ctx, c, r, dt);
+                                 break;
+                             case AgentKind::SignalSink:
+                                 SignalSink::updateRow(ctx, c, r, dt);
+                                 break;
+                             default:
+                                 break;
+                             }
+                         } });
+
+    for (TickBuffer &buf : tileBuffers)
+    {
+        for (const SpatialIndex::Entry &m : buf.moves)
+        {
+            spatial.move(m.id, m.pos);
+        }
+        for (const GridWrite &w : buf.writes)
+        {
+            if (w.type == CellType::Signal)
+            {
+                addSignalAt(w.pos);
+            }
+            else
+            {
+                addTrailAt(w.pos);
+            }
+        }
+        for (const Event &e : buf.events)
+        {
+            events.push(e);
+        }
+    }
+}
+
+template <typename Ctx>
+void Agent::stepPosition(Ctx &world, AgentColumns &c, size_t r, double dt)
+{
+    Vec2 pos = c.position[r];
+
+    double dx = c.velocity[r].x * dt * c.speed[r];
+    double dy = c.velocity[r].y * dt * c.speed[r];
+
+    if (std::abs(dx) >= 1.0 || std::abs(dy) >= 1.0)
+    {
+        int stepCount = static_cast<int>(max(std::abs(dx), std::abs(dy)));
+        double stepX = dx / stepCount;
+        double stepY = dy / stepCount;
+        double fx = pos.x;
+        double fy = pos.y;
+        for (int i = 0; i < stepCount; ++i)
+        {
+            fx += stepX;
+            fy += stepY;
+            Vec2 candidate(static_cast<int>(std::round(fx)), static_cast<int>(std::round(fy)));
+            if (candidate != pos && world.getGrid().inBounds(candidate))
+            {
+                if (!world.getGrid().isWall(candidate))
+                {
+                    pos = candidate;
+                }
+            }
+        }
+    }
+    else
+    {
+        int mx = 0;
+        int my = 0;
+        if (std::abs(dx) >= 0.5)
+            mx = (dx > 0 ? 1 : -1);
+        if (std::abs(dy) >= 0.5)
+            my = (dy > 0 ? 1 : -1);
+        Vec2 candidate = pos + Vec2(mx, my);
+        if (world.getGrid().inBounds(candidate))
+        {
+            if (!world.getGrid().isWall(candidate))
+            {
+                pos = candidate;
+            }
+        }
+    }
+
+    if (pos != c.position[r])
+    {
+        c.position[r] = pos;
+        world.onEntityMoved(c.id[r], pos);
+    }
+    world.addTrailAt(pos);
+}
+
+template <typename Ctx>
+void Wanderer::updateRow(Ctx &world, AgentColumns &c, size_t r, double dt)
+{
+    c.phase[r] += dt;
+    RNG rng = world.agentRng(c.id[r]);
+    if (rng.chance(0.15))
+    {
+        int dir = rng.intInRange(0, 3);
+        Vec2 &velocity = c.velocity[r];
+        if (dir == 0)
+            velocity = Vec2(1, 0);
+        else if (dir == 1)
+            velocity = Vec2(-1, 0);
+        else if (dir == 2)
+            velocity = Vec2(0, 1);
+        else
+            velocity = Vec2(0, -1);
+    }
+    stepPosition(world, c, r, dt);
+}
+
+void Wanderer::onEvent(World &world, const Event &e)
+{
+    (void)world;
+    (void)e;
+}
+
+template <typename Ctx>
+void Seeker::updateRow(Ctx &world, AgentColumns &c, size_t r, double dt)
+{
+    Vec2 &target = c.target[r];
+    if (!c.hasTarget[r])
+    {
+        target = world.randomSink();
+        c.hasTarget[r] = 1;
+    }
+
+    Vec2 pos = c.position[r];
+    Vec2 diff(target.x - pos.x, target.y - pos.y);
+
+    if (diff.x == 0 && diff.y == 0)
+    {
+        c.hasTarget[r] = 0;
+        world.broadcast(EventType::Arrive, c.id[r], EntityId(0), kNoPayload, pos, world.getPingRadius());
+    }
+    else if (world.flowDirection(pos, target, c.velocity[r]))
+    {
+        stepPosition(world, c, r, dt);
+    }
+    else
+    {
+        int bestDx = 0;
+        int bestDy = 0;
+        if (std::abs(diff.x) > std::abs(diff.y))
+        {
+            if (diff.x > 0)
+                bestDx = 1;
+            else if (diff.x < 0)
+                bestDx = -1;
+        }
+        else
+        {
+            if (diff.y > 0)
+                bestDy = 1;
+            else if (diff.y < 0)
+                bestDy = -1;
+        }
+        c.velocity[r] = Vec2(bestDx, bestDy);
+        stepPosition(world, c, r, dt);
+    }
+}
+
+template <typename Ctx>
+void Seeker::updateRows(Ctx &world, AgentColumns &c, const uint32_t *rows, size_t n, double dt)
+{
+    static const size_t kBatch = 64;
+    static const Vec2 dirs[4] = {
+        Vec2(1, 0),
+        Vec2(-1, 0),
+        Vec2(0, 1),
+        Vec2(0, -1)};
+    const float unreachable = static_cast<float>(PathfindingService::kUnreachable);
+    const size_t lanes = static_cast<size_t>(FloatLanes::width);
+    const Grid &grid = world.getGrid();
+    const int w = grid.getWidth();
+
+    // Distances are copied out of the flow fields as each row is visited, since
+    // a later lazy build in the same batch may evict an earlier row's field.
+    bool idle[kBatch];
+    float here[kBatch];
+    float around[4][kBatch];
+    float choice[kBatch];
+
+    for (size_t start = 0; start < n; start += kBatch)
+    {
+        size_t m = min(kBatch, n - start);
+        size_t padded = (m + lanes - 1) / lanes * lanes;
+        for (size_t k = 0; k < m; ++k)
+        {
+            size_t r = rows[start + k];
+            world.rowStream(c, r);
+            Vec2 &target = c.target[r];
+            if (!c.hasTarget[r])
+            {
+                target = world.randomSink();
+                c.hasTarget[r] = 1;
+            }
+            Vec2 pos = c.position[r];
+            idle[k] = pos == target;
+            here[k] = 0.0f;
+            for (int d = 0; d < 4; ++d)
+            {
+                around[d][k] = unreachable;
+            }
+            if (idle[k])
+            {
+                c.hasTarget[r] = 0;
+                world.broadcast(EventType::Arrive, c.id[r], EntityId(0), kNoPayload, pos, world.getPingRadius());
+                continue;
+            }
+            const PathfindingService::FlowField *f = world.flowFieldFor(target);
+            if (!f || !grid.inBounds(pos))
+            {
+                continue;
+            }
+            here[k] = f->dist[static_cast<size_t>(pos.y * w + pos.x)];
+            for (int d = 0; d < 4; ++d)
+            {
+                Vec2 q = pos + dirs[d];
+                if (grid.inBounds(q))
+                {
+                    around[d][k] = f->dist[static_cast<size_t>(q.y * w + q.x)];
+                }
+            }
+        }
+        for (size_t k = m; k < padded; ++k)
+        {
+            here[k] = 0.0f;
+            for (int d = 0; d < 4; ++d)
+            {
+                around[d][k] = unreachable;
+            }
+        }
+
+        // Rows standing on the goal, off the field or on an unreachable cell
+        // keep pick == 4 and fall through to greedy steering, as in stepAlong.
+        for (size_t k = 0; k < padded; k += lanes)
+        {
+            FloatLanes best = FloatLanes::load(&here[k]);
+            FloatLanes pick = FloatLanes::broadcast(4.0f);
+            FloatLanes none = FloatLanes::broadcast(4.0f);
+            FloatLanes moving = lanesGreater(best, FloatLanes::broadcast(0.0f));
+            FloatLanes reachable = lanesLess(best, FloatLanes::broadcast(unreachable));
+            for (int d = 0; d < 4; ++d)
+            {
+                FloatLanes dq = FloatLanes::load(&around[d][k]);
+                FloatLanes take = lanesLess(dq, best);
+                best = lanesSelect(take, dq, best);
+                pick = lanesSelect(take, FloatLanes::broadcast(static_cast<float>(d)), pick);
+            }
+            pick = lanesSelect(moving, pick, none);
+            lanesSelect(reachable, pick, none).store(&choice[k]);
+        }
+
+        for (size_t k = 0; k < m; ++k)
+        {
+            if (idle[k])
+            {
+                continue;
+            }
+            size_t r = rows[start + k];
+            int pick = static_cast<int>(choice[k]);
+            if (pick < 4)
+            {
+                c.velocity[r] = dirs[pick];
+            }
+            else
+            {
+                int dx = c.target[r].x - c.position[r].x;
+                int dy = c.target[r].y - c.position[r].y;
+                bool horizontal = std::abs(dx) > std::abs(dy);
+                int sx = (dx > 0) - (dx < 0);
+                int sy = (dy > 0) - (dy < 0);
+                c.velocity[r] = Vec2(horizontal ? sx : 0, horizontal ? 0 : sy);
+            }
+        }
+
+        for (size_t k = 0; k < m; ++k)
+        {
+            if (!idle[k])
+            {
+                stepPosition(world, c, rows[start + k], dt);
+            }
+        }
+    }
+}
+
+void Seeker::onEvent(World &world, const Event &e)
+{
+    (void)world;
+    if (e.type == EventType::Ping)
+    {
+        if (world.random().chance(0.2))
+        {
+            setTarget(e.pos);
+        }
+    }
+}
+
+template <typename Ctx>
+void TrailMaker::updateRow(Ctx &world, AgentColumns &c, size_t r, double dt)
+{
+    Vec2 &velocity = c.velocity[r];
+    if (world.isAdvancedMode())
+    {
+        const Grid &grid = world.getGrid();
+        Vec2 pos = c.position[r];
+        double bestScore = -std::numeric_limits<double>::infinity();
+        Vec2 bestDir(0, 0);
+
+        static const Vec2 dirs[4] = {
+            Vec2(1, 0),
+            Vec2(-1, 0),
+            Vec2(0, 1),
+            Vec2(0, -1)};
+
+        for (const Vec2 &d : dirs)
+        {
+            Vec2 q = pos + d;
+            if (grid.inBounds(q))
+            {
+                size_t i = grid.indexOf(q);
+                CellType t = grid.type(i);
+                double score = 0.0;
+                if (t == CellType::MarkerA)
+                    score += 0.5;
+                if (t == CellType::MarkerB)
+                    score += 1.0;
+                if (t == CellType::MarkerC)
+                    score += 1.5;
+                if (t == CellType::Trail)
+                    score -= 0.2;
+                if (t == CellType::Signal)
+                    score += 0.3;
+                score += grid.value1(i) * 0.1;
+                score += world.random().realRange(-0.05, 0.05);
+
+                if (score > bestScore)
+                {
+                    bestScore = score;
+                    bestDir = d;
+                }
+            }
+        }
+
+        velocity = bestDir;
+    }
+    else
+    {
+        if (world.random().chance(0.4))
+        {
+            int dir = world.random().intInRange(0, 3);
+            if (dir == 0)
+                velocity = Vec2(1, 0);
+            else if (dir == 1)
+                velocity = Vec2(-1, 0);
+            else if (dir == 2)
+                velocity = Vec2(0, 1);
+            else
+                velocity = Vec2(0, -1);
+        }
+    }
+
+    stepPosition(world, c, r, dt);
+}
+
+template <typename Ctx>
+void TrailMaker::updateRows(Ctx &world, AgentColumns &c, const uint32_t *rows, size_t n, double dt)
+{
+    if (!world.isAdvancedMode())
+    {
+        for (size_t k = 0; k < n; ++k)
+        {
+            world.rowStream(c, rows[k]);
+            updateRow(world, c, rows[k], dt);
+        }
+        return;
+    }
+
+    // Scores are doubles, as in updateRow. The argmax runs on float copies, and
+    // any agent whose best two float scores lie within kTieMargin is re-decided
+    // in double. Float rounding moves a score by well under 1e-6 here, so every
+    // other pick is the one updateRow would make.
+    static const size_t kBatch = 64;
+    static const float kTieMargin = 1e-5f;
+    static const double typeScore[9] = {0.0, 0.0, 0.5, 1.0, 1.5, 0.0, 0.0, -0.2, 0.3};
+    static const Vec2 dirs[5] = {
+        Vec2(1, 0),
+        Vec2(-1, 0),
+        Vec2(0, 1),
+        Vec2(0, -1),
+        Vec2(0, 0)};
+    const size_t outside = std::numeric_limits<size_t>::max();
+    const double none = -std::numeric_limits<double>::infinity();
+    const float noneF = -std::numeric_limits<float>::infinity();
+    const size_t lanes = static_cast<size_t>(FloatLanes::width);
+    const Grid &grid = world.getGrid();
+
+    size_t cell[4][kBatch];
+    CellType seen[4][kBatch];
+    double base[4][kBatch];
+    double jitter[4][kBatch];
+    float scoreF[4][kBatch];
+    float choice[kBatch];
+    float gap[kBatch];
+
+    for (size_t start = 0; start < n; start += kBatch)
+    {
+        size_t m = min(kBatch, n - start);
+        size_t padded = (m + lanes - 1) / lanes * lanes;
+        for (size_t k = 0; k < m; ++k)
+        {
+            size_t r = rows[start + k];
+            RNG &rng = world.rowStream(c, r);
+            Vec2 pos = c.position[r];
+            for (int d = 0; d < 4; ++d)
+            {
+                Vec2 q = pos + dirs[d];
+                if (grid.inBounds(q))
+                {
+                    size_t i = grid.indexOf(q);
+                    cell[d][k] = i;
+                    seen[d][k] = grid.type(i);
+                    base[d][k] = typeScore[static_cast<size_t>(seen[d][k])] + grid.value1(i) * 0.1;
+                    jitter[d][k] = rng.realRange(-0.05, 0.05);
+                    scoreF[d][k] = static_cast<float>(base[d][k] + jitter[d][k]);
+                }
+                else
+                {
+                    cell[d][k] = outside;
+                    seen[d][k] = CellType::Wall;
+                    base[d][k] = none;
+                    jitter[d][k] = 0.0;
+                    scoreF[d][k] = noneF;
+                }
+            }
+        }
+        for (size_t k = m; k < padded; ++k)
+        {
+            for (int d = 0; d < 4; ++d)
+            {
+                scoreF[d][k] = noneF;
+            }
+        }
+
+        for (size_t k = 0; k < padded; k += lanes)
+        {
+            FloatLanes best = FloatLanes::broadcast(noneF);
+            FloatLanes second = FloatLanes::broadcast(noneF);
+            FloatLanes pick = FloatLanes::broadcast(4.0f);
+            for (int d = 0; d < 4; ++d)
+            {
+                FloatLanes score = FloatLanes::load(&scoreF[d][k]);
+                FloatLanes take = lanesGreater(score, best);
+                second = lanesSelect(take, best, lanesSelect(lanesGreater(score, second), score, second));
+                best = lanesSelect(take, score, best);
+                pick = lanesSelect(take, FloatLanes::broadcast(static_cast<float>(d)), pick);
+            }
+            pick.store(&choice[k]);
+            (best - second).store(&gap[k]);
+        }
+
+        // Trails laid earlier in this batch may have changed a neighbour's type;
+        // rescore those agents against the live grid so the result matches updateRow.
+        for (size_t k = 0; k < m; ++k)
+        {
+            size_t r = rows[start + k];
+            bool stale = false;
+            for (int d = 0; d < 4; ++d)
+            {
+                stale |= cell[d][k] != outside && grid.type(cell[d][k]) != seen[d][k];
+            }
+            int pick = static_cast<int>(choice[k]);
+            if (stale || gap[k] < kTieMargin)
+            {
+                double best = none;
+                pick = 4;
+                for (int d = 0; d < 4; ++d)
+                {
+                    if (cell[d][k] != outside)
+                    {
+                        size_t i = cell[d][k];
+                        double score = typeScore[static_cast<size_t>(grid.type(i))] + grid.value1(i) * 0.1 + jitter[d][k];
+                        if (score > best)
+                        {
+                            best = score;
+                            pick = d;
+                        }
+                    }
+                }
+            }
+            c.velocity[r] = dirs[pick];
+            stepPosition(world, c, r, dt);
+        }
+    }
+}
+
+void TrailMaker::onEvent(World &world, const Event &e)
+{
+    (void)world;
+    (void)e;
+}
+
+template <typename Ctx>
+void SignalSource::updateRow(Ctx &world, AgentColumns &c, size_t r, double dt)
+{
+    c.timer[r] += dt;
+    if (c.timer[r] >= c.cooldown[r])
+    {
+        c.timer[r] -= c.cooldown[r];
+        Vec2 pos = c.position[r];
+        world.addSignalAt(pos);
+        world.broadcast(EventType::Ping, c.id[r], EntityId(0), kSignalPayload, pos, world.getPingRadius());
+    }
+}
+
+void SignalSource::onEvent(World &world, const Event &e)
+{
+    (void)world;
+    (void)e;
+}
+
+void SignalSink::onEvent(World &world, const Event &e)
+{
+    if (e.type == EventType::Arrive)
+    {
+        (void)e;
+    }
+}
+
+class BenchState
+{
+    uint64_t iterations;
+    uint64_t remaining;
+    bool started;
+    double elapsedNs;
+    double items;
+    vector<pair<string, double>> counters;
+    chrono::high_resolution_clock::time_point mark;
+
+public:
+    explicit BenchState(uint64_t n)
+        : iterations(n), remaining(n), started(false), elapsedNs(0.0), items(0.0)
+    {
+    }
+
+    bool keepRunning()
+    {
+        if (!started)
+        {
+            started = true;
+            mark = chrono::high_resolution_clock::now();
+        }
+        if (remaining == 0)
+        {
+            pauseTiming();
+            return false;
+        }
+        --remaining;
+        return true;
+    }
+
+    void pauseTiming()
+    {
+        elapsedNs += chrono::duration<double, nano>(chrono::high_resolution_clock::now() - mark).count();
+    }
+
+    void resumeTiming()
+    {
+        mark = chrono::high_resolution_clock::now();
+    }
+
+    void setItemsProcessed(double n)
+    {
+        items = n;
+    }
+
+    // Extra per-case figures, reported after the timing columns and in the JSON.
+    void setCounter(const string &name, double v)
+    {
+        counters.emplace_back(name, v);
+    }
+
+    const vector<pair<string, double>> &getCounters() const
+    {
+        return counters;
+    }
+
+    uint64_t getIterations() const
+    {
+        return iterations;
+    }
+
+    double getElapsedNs() const
+    {
+        return elapsedNs;
+    }
+
+    double getItems() const
+    {
+        return items;
+    }
+};
+
+class BenchmarkSuite
+{
+    struct Case
+    {
+        string name;
+        function<void(BenchState &)> fn;
+    };
+
+    vector<Case> cases;
+
+public:
+    void add(const string &name, function<void(BenchState &)> fn)
+    {
+        cases.push_back(Case{name, move(fn)});
+    }
+
+    int run(const string &filter, double minSeconds, ostream &os, const string &jsonPath) const
+    {
+        ostringstream json;
+        json << "{\n  \"context\": {\"threads\": " << thread::hardware_concurrency() << "},\n  \"benchmarks\": [";
+        bool first = true;
+        os << left << setw(36) << "benchmark" << right << setw(14) << "ns/iter" << setw(12) << "iters" << setw(16) << "items/s" << "\n";
+        for (const Case &c : cases)
+        {
+            if (!filter.empty() && c.name.find(filter) == string::npos)
+            {
+                continue;
+            }
+            uint64_t n = 1;
+            double ns = 0.0;
+            double items = 0.0;
+            vector<pair<string, double>> counters;
+            for (;;)
+            {
+                BenchState state(n);
+                c.fn(state);
+                ns = state.getElapsedNs();
+                items = state.getItems();
+                counters = state.getCounters();
+                if (ns >= minSeconds * 1e9 || n >= (uint64_t(1) << 30))
+                {
+                    break;
+                }
+                double grow = ns > 0.0 ? minSeconds * 1e9 * 1.4 / ns : 10.0;
+                n = max(n + 1, static_cast<uint64_t>(static_cast<double>(n) * min(max(grow, 1.5), 10.0)));
+            }
+            double perIter = ns / static_cast<double>(n);
+            double itemsPerSec = ns > 0.0 ? items * 1e9 / ns : 0.0;
+            os << left << setw(36) << c.name << right << fixed << setprecision(1) << setw(14) << perIter << setw(12) << n;
+            if (items > 0.0)
+            {
+                os << setw(16) << setprecision(0) << itemsPerSec;
+            }
+            else
+            {
+                os << setw(16) << "-";
+            }
+            os << defaultfloat;
+            for (const auto &kv : counters)
+            {
+                os << "  " << kv.first << "=" << fixed << setprecision(0) << kv.second << defaultfloat;
+            }
+            os << "\n";
+            json << (first ? "\n" : ",\n") << "    {\"name\": \"" << c.name << "\", \"iterations\": " << n
+                 << ", \"real_time\": " << fixed << setprecision(1) << perIter << ", \"time_unit\": \"ns\"";
+            if (items > 0.0)
+            {
+                json << ", \"items_per_second\": " << setprecision(0) << itemsPerSec;
+            }
+            json << defaultfloat;
+            for (const auto &kv : counters)
+            {
+                json << ", \"" << kv.first << "\": " << fixed << setprecision(0) << kv.second << defaultfloat;
+            }
+            json << "}";
+            first = false;
+        }
+        json << "\n  ]\n}\n";
+        if (!jsonPath.empty())
+        {
+            ofstream out(jsonPath);
+            if (!out)
+            {
+                cerr << "cannot write " << jsonPath << "\n";
+                return 1;
+            }
+            out << json.str();
+        }
+        return 0;
+    }
+};
+
+Grid makeBenchGrid(int size, bool maze, uint64_t seed)
+{
+    Grid grid(size, size);
+    if (!maze)
+    {
+        grid.forEach([&](const Vec2 &p, size_t i)
+                     {
+                         bool border = p.x == 0 || p.y == 0 || p.x == size - 1 || p.y == size - 1;
+                         grid.setType(i, border ? CellType::Wall : CellType::Empty);
+                     });
+        return grid;
+    }
+    grid.fill(CellType::Wall);
+    RNG rng(splitmix64(seed), 0);
+    vector<Vec2> stack{Vec2(1, 1)};
+    grid.setType(Vec2(1, 1), CellType::Empty);
+    static const Vec2 dirs[4] = {
+        Vec2(2, 0),
+        Vec2(-2, 0),
+        Vec2(0, 2),
+        Vec2(0, -2)};
+    while (!stack.empty())
+    {
+        Vec2 p = stack.back();
+        Vec2 options[4];
+        int count = 0;
+        for (const Vec2 &d : dirs)
+        {
+            Vec2 q = p + d;
+            if (q.x > 0 && q.y > 0 && q.x < size - 1 && q.y < size - 1 && grid.isWall(q))
+            {
+                options[count++] = q;
+            }
+        }
+        if (count == 0)
+        {
+            stack.pop_back();
+            continue;
+        }
+        Vec2 q = options[rng.intInRange(0, count - 1)];
+        grid.setType(Vec2((p.x + q.x) / 2, (p.y + q.y) / 2), CellType::Empty);
+        grid.setType(q, CellType::Empty);
+        stack.push_back(q);
+    }
+    return grid;
+}
+
+Vec2 farthestOpenCell(const Grid &grid)
+{
+    for (int y = grid.getHeight() - 2; y > 0; --y)
+    {
+        for (int x = grid.getWidth() - 2; x > 0; --x)
+        {
+            if (!grid.isWall(Vec2(x, y)))
+            {
+                return Vec2(x, y);
+            }
+        }
+    }
+    return Vec2(1, 1);
+}
+
+unique_ptr<World> makeBenchWorld(int width, int height, int agents, int sources)
+{
+    unique_ptr<World> world = make_unique<World>();
+    WorldConfig &c = world->getConfig();
+    c.width = width;
+    c.height = height;
+    c.wanderers = agents * 6 / 10;
+    c.seekers = agents / 10;
+    c.trails = agents - c.wanderers - c.seekers;
+    c.sources = sources;
+    c.sinks = max(sources, 1);
+    c.seed = 12345;
+    world->init();
+    return world;
+}
+
+void registerBenchmarks(BenchmarkSuite &suite)
+{
+    for (int size : {64, 256})
+    {
+        for (bool maze : {false, true})
+        {
+            string name = string("aStar/") + (maze ? "maze/" : "open/") + to_string(size);
+            suite.add(name, [size, maze](BenchState &state)
+                      {
+                          Grid grid = makeBenchGrid(size, maze, 7);
+                          Vec2 goal = farthestOpenCell(grid);
+                          vector<Vec2> path;
+                          while (state.keepRunning())
+                          {
+                              Pathfinding::aStar(grid, Vec2(1, 1), goal, path);
+                          }
+                      });
+            suite.add("service/" + name.substr(6), [size, maze](BenchState &state)
+                      {
+                          Grid grid = makeBenchGrid(size, maze, 7);
+                          Vec2 goal = farthestOpenCell(grid);
+                          PathfindingService service;
+                          vector<Vec2> path;
+                          while (state.keepRunning())
+                          {
+                              service.findPath(grid, Vec2(1, 1), goal, path);
+                          }
+                      });
+        }
+    }
+
+    for (NoiseMode mode : {NoiseMode::Classic, NoiseMode::Value, NoiseMode::Perlin})
+    {
+        for (int size : {256, 1024})
+        {
+            suite.add(string("noise/") + noiseModeName(mode) + "/" + to_string(size), [mode, size](BenchState &state)
+                      {
+                          NoiseField noise(size, size);
+                          RNG rng(1, 0);
+                          while (state.keepRunning())
+                          {
+                              noise.generate(rng, 5, 0.5, mode);
+                          }
+                          state.setItemsProcessed(static_cast<double>(state.getIterations()) * size * size);
+                      });
+        }
+    }
+
+    for (int iterations : {4, 6})
+    {
+        suite.add("lsystem/" + to_string(iterations), [iterations](BenchState &state)
+                  {
+                      LSystem ls;
+                      ls.setAxiom("X");
+                      ls.addRule('X', "F+[[X]-X]-F[-FX]+X");
+                      ls.addRule('F', "FF");
+                      size_t length = 0;
+                      while (state.keepRunning())
+                      {
+                          length = ls.generate(iterations).size();
+                      }
+                      state.setItemsProcessed(static_cast<double>(state.getIterations()) * static_cast<double>(length));
+                  });
+    }
+
+    suite.add("lsystem/expand/10", [](BenchState &state)
+              {
+                  LSystem ls;
+                  ls.setAxiom("X");
+                  ls.addRule('X', "F+[[X]-X]-F[-FX]+X");
+                  ls.addRule('F', "FF");
+                  size_t symbols = 0;
+                  while (state.keepRunning())
+                  {
+                      ls.expand(10, [&](char c)
+                                { symbols += c != '\0'; });
+                  }
+                  state.setItemsProcessed(static_cast<double>(symbols));
+              });
+
+    suite.add("lsystem/at/24", [](BenchState &state)
+              {
+                  LSystem ls;
+                  ls.setAxiom("X");
+                  ls.addRule('X', "F+[[X]-X]-F[-FX]+X");
+                  ls.addRule('F', "FF");
+                  uint64_t n = ls.length(24);
+                  uint64_t index = 0;
+                  size_t walls = 0;
+                  size_t other = 0;
+                  while (state.keepRunning())
+                  {
+                      index = (index * 6364136223846793005ull + 1442695040888963407ull) % n;
+                      if (ls.at(24, index) == 'F')
+                      {
+                          ++walls;
+                      }
+                      else
+                      {
+                          ++other;
+                      }
+                  }
+                  state.setItemsProcessed(static_cast<double>(walls + other));
+              });
+
+    for (int trails : {1000, 50000})
+    {
+        suite.add("evaporateTrails/512/" + to_string(trails), [trails](BenchState &state)
+                  {
+                      unique_ptr<World> world = makeBenchWorld(512, 512, 0, 0);
+                      RNG rng(3, 0);
+                      uint64_t i = 0;
+                      while (state.keepRunning())
+                      {
+                          if (i++ % 40 == 0)
+                          {
+                              state.pauseTiming();
+                              for (int k = 0; k < trails; ++k)
+                              {
+                                  world->addTrailAt(Vec2(rng.intInRange(1, 510), rng.intInRange(1, 510)));
+                              }
+                              state.resumeTiming();
+                          }
+                          world->evaporateTrails();
+                      }
+                  });
+    }
+
+    for (int width : {60, 200})
+    {
+        suite.add("render/null/" + to_string(width), [width](BenchState &state)
+                  {
+                      unique_ptr<World> world = makeBenchWorld(width, width * 2 / 5, width, 4);
+                      ostream sink(nullptr);
+                      while (state.keepRunning())
+                      {
+                          world->stepTick();
+                          world->requestRedraw();
+                          world->render(sink);
+                      }
+                  });
+    }
+
+    for (int agents : {100, 1000, 10000})
+    {
+        for (int sources : {0, 16})
+        {
+            suite.add("step/" + to_string(agents) + "/sources:" + to_string(sources), [agents, sources](BenchState &state)
+                      {
+                          unique_ptr<World> world = makeBenchWorld(256, 256, agents, sources);
+                          while (state.keepRunning())
+                          {
+                              world->stepTick();
+                          }
+                          state.setItemsProcessed(static_cast<double>(state.getIterations()) * static_cast<double>(world->agentCount()));
+                      });
+        }
+    }
+
+    for (int threads : {0, 4})
+    {
+        for (AgentKind kind : {AgentKind::TrailMaker, AgentKind::Seeker})
+        {
+            string name = kind == AgentKind::TrailMaker ? "trailmakers" : "seekers";
+            suite.add("agents/" + name + "/10000/threads:" + to_string(threads), [kind, threads](BenchState &state)
+                      {
+                          unique_ptr<World> world = make_unique<World>();
+                          WorldConfig &c = world->getConfig();
+                          c.width = 256;
+                          c.height = 256;
+                          c.wanderers = 0;
+                          c.seekers = kind == AgentKind::Seeker ? 10000 : 0;
+                          c.trails = kind == AgentKind::TrailMaker ? 10000 : 0;
+                          c.sources = 0;
+                          c.sinks = 8;
+                          c.threads = threads;
+                          c.seed = 12345;
+                          world->init();
+                          world->stepTick();
+                          while (state.keepRunning())
+                          {
+                              world->stepTick();
+                          }
+                          state.setItemsProcessed(static_cast<double>(state.getIterations()) * static_cast<double>(world->agentCount()));
+                      });
+        }
+    }
+
+    for (int churn : {64, 1024})
+    {
+        suite.add("entities/churn/" + to_string(churn), [churn](BenchState &state)
+                  {
+                      unique_ptr<World> world = makeBenchWorld(256, 256, 1000, 0);
+                      deque<EntityId> spawned;
+                      while (state.keepRunning())
+                      {
+                          for (int k = 0; k < churn; ++k)
+                          {
+                              spawned.push_back(world->spawn<Wanderer>(world->randomEmptyCell()));
+                          }
+                          while (spawned.size() > static_cast<size_t>(churn) * 4)
+                          {
+                              world->despawn(spawned.front());
+                              spawned.pop_front();
+                          }
+                          world->removeDeadEntities();
+                      }
+                      state.setItemsProcessed(static_cast<double>(state.getIterations()) * churn);
+                  });
+    }
+
+    // log/ times only the producer side: each batch of 1024 is drained outside
+    // the timed region, so nothing is dropped. sustained/ includes the drain and
+    // so measures end-to-end recording throughput.
+    for (bool sustained : {false, true})
+    {
+        for (bool packed : {false, true})
+        {
+            suite.add(string("recorder/") + (sustained ? "sustained/" : "log/") + (packed ? "packed" : "raw"), [packed, sustained](BenchState &state)
+                      {
+                          Recorder recorder;
+                          recorder.start("/dev/null", packed);
+                          Event e(EventType::Ping, EntityId(1), EntityId(0), kSignalPayload, Vec2(3, 4));
+                          int tick = 0;
+                          while (state.keepRunning())
+                          {
+                              for (int k = 0; k < 1024; ++k)
+                              {
+                                  recorder.log(tick, e);
+                              }
+                              ++tick;
+                              if (!sustained)
+                              {
+                                  state.pauseTiming();
+                              }
+                              recorder.flush();
+                              if (!sustained)
+                              {
+                                  state.resumeTiming();
+                              }
+                          }
+                          recorder.stop();
+                          state.setItemsProcessed(static_cast<double>(recorder.getRecorded()));
+                          state.setCounter("dropped", static_cast<double>(recorder.getDropped()));
+                      });
+        }
+    }
+
+    for (int count : {64, 4096})
+    {
+        suite.add("eventQueue/pushFlip/" + to_string(count), [count](BenchState &state)
+                  {
+                      EventQueue queue;
+                      Event e(EventType::Ping, EntityId(1), EntityId(0), kSignalPayload, Vec2(3, 4));
+                      while (state.keepRunning())
+                      {
+                          for (int k = 0; k < count; ++k)
+                          {
+                              queue.push(e);
+                          }
+                          queue.flip();
+                      }
+                      state.setItemsProcessed(static_cast<double>(state.getIterations()) * count);
+                  });
+    }
+}
+
+struct SweepAxis
+{
+    string name;
+    vector<string> values;
+};
+
+struct RunOptions
+{
+    bool headless;
+    bool bench;
+    bool help;
+    int ticks;
+    string benchFilter;
+    string benchOut;
+    double benchMinTime;
+    string loadPath;
+    string recordPath;
+    vector<SweepAxis> sweep;
+    string sweepOut;
+    int jobs;
+    int servePort;
+};
+
+void printUsage(ostream &os)
+{
+    os << "usage: sim [--help] [--headless] [--ticks n] [--width n] [--height n] [--seed n] [--threads n]\n"
+       << "           [--wanderers n] [--seekers n] [--trails n] [--sources n] [--sinks n]\n"
+       << "           [--radius n] [--noise classic|value|perlin] [--stream] [--chunks n] [--load snapshot]\n"
+       << "           [--record file] [--serve port]\n"
+       << "           --record always writes packed (varint, delta-coded) records\n"
+       << "       sim --sweep name=values [--sweep ...] [--ticks n] [--jobs n] [--sweep-out file.csv|file.json]\n"
+       << "           values are a list (64,128) or a range (1..8, 0..100:25); names as the options above,\n"
+       << "           plus stream=off,on\n"
+       << "       sim --bench [--bench-filter text] [--bench-min-time sec] [--bench-out file.json]\n";
+}
+
+// Returns false for an unknown name or a value that does not parse.
+bool applyConfigOption(WorldConfig &config, const string &name, const string &value)
+{
+    int n = 0;
+    bool isInt = parseNumber(value, n);
+    if (name == "width" && isInt)
+        config.width = max(3, n);
+    else if (name == "height" && isInt)
+        config.height = max(3, n);
+    else if (name == "seed")
+        return parseNumber(value, config.seed);
+    else if (name == "threads" && isInt)
+        config.threads = max(0, n);
+    else if (name == "wanderers" && isInt)
+        config.wanderers = max(0, n);
+    else if (name == "seekers" && isInt)
+        config.seekers = max(0, n);
+    else if (name == "trails" && isInt)
+        config.trails = max(0, n);
+    else if (name == "sources" && isInt)
+        config.sources = max(0, n);
+    else if (name == "sinks" && isInt)
+        config.sinks = max(0, n);
+    else if (name == "radius" && isInt)
+        config.pingRadius = max(0, n);
+    else if (name == "chunks" && isInt)
+        config.chunkBudget = max(1, n);
+    else if (name == "stream" && (value == "on" || value == "off"))
+        config.streaming = value == "on";
+    else if (name == "noise" && value == "classic")
+        config.noiseMode = NoiseMode::Classic;
+    else if (name == "noise" && value == "value")
+        config.noiseMode = NoiseMode::Value;
+    else if (name == "noise" && value == "perlin")
+        config.noiseMode = NoiseMode::Perlin;
+    else
+        return false;
+    return true;
+}
+
+bool parseSweepAxis(const string &spec, SweepAxis &axis)
+{
+    size_t eq = spec.find('=');
+    if (eq == string::npos || eq == 0 || eq + 1 == spec.size())
+    {
+        return false;
+    }
+    axis.name = spec.substr(0, eq);
+    axis.values.clear();
+    string values = spec.substr(eq + 1);
+    size_t dots = values.find("..");
+    if (dots == string::npos)
+    {
+        stringstream ss(values);
+        string v;
+        while (getline(ss, v, ','))
+        {
+            if (!v.empty())
+            {
+                axis.values.push_back(v);
+            }
+        }
+        return !axis.values.empty();
+    }
+    size_t colon = values.find(':', dots);
+    long long lo = 0;
+    long long hi = 0;
+    long long stride = 1;
+    if (!parseNumber(values.substr(0, dots), lo) ||
+        !parseNumber(values.substr(dots + 2, colon == string::npos ? string::npos : colon - dots - 2), hi) ||
+        (colon != string::npos && !parseNumber(values.substr(colon + 1), stride)))
+    {
+        return false;
+    }
+    if (stride <= 0 || hi < lo || (hi - lo) / stride >= 100000)
+    {
+        return false;
+    }
+    for (long long v = lo; v <= hi; v += stride)
+    {
+        axis.values.push_back(to_string(v));
+    }
+    return true;
+}
+
+bool isKnownOption(const string &arg)
+{
+    static const char *const known[] = {"--width", "--height", "--seed", "--threads", "--wanderers", "--seekers",
+                                        "--trails", "--sources", "--sinks", "--radius", "--noise", "--chunks", "--ticks",
+                                        "--serve", "--bench-min-time", "--jobs"};
+    for (const char *k : known)
+    {
+        if (arg == k)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseOptions(int argc, char **argv, WorldConfig &config, RunOptions &opts)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--headless")
+        {
+            opts.headless = true;
+            continue;
+        }
+        if (arg == "--stream")
+        {
+            config.streaming = true;
+            continue;
+        }
+        if (arg == "--bench")
+        {
+            opts.bench = true;
+            continue;
+        }
+        if (arg == "--help" || arg == "-h")
+        {
+            opts.help = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            cerr << "missing value for " << arg << "\n";
+            return false;
+        }
+        string value = argv[++i];
+        int n = 0;
+        bool isInt = parseNumber(value, n);
+        if (arg.compare(0, 2, "--") == 0 && applyConfigOption(config, arg.substr(2), value))
+            continue;
+        if (arg == "--ticks" && isInt)
+            opts.ticks = max(0, n);
+        else if (arg == "--bench-filter")
+            opts.benchFilter = value;
+        else if (arg == "--bench-out")
+            opts.benchOut = value;
+        else if (arg == "--load")
+            opts.loadPath = value;
+        else if (arg == "--record")
+            opts.recordPath = value;
+        else if (arg == "--serve" && isInt && n >= 0 && n <= 65535)
+            opts.servePort = n;
+        else if (arg == "--bench-min-time" && parseNumber(value, opts.benchMinTime))
+            opts.benchMinTime = max(0.0, opts.benchMinTime);
+        else if (arg == "--sweep-out")
+            opts.sweepOut = value;
+        else if (arg == "--jobs" && isInt)
+            opts.jobs = max(0, n);
+        else if (arg == "--sweep")
         {
-            Cell &c = grid.at(p);
-            if (c.type == CellType::Empty || c.type == CellType::Trail)
+            SweepAxis axis;
+            WorldConfig probe = config;
+            bool ok = parseSweepAxis(value, axis);
+            for (size_t k = 0; ok && k < axis.values.size(); ++k)
             {
-                c.type = CellType::Signal;
-                c.value2 = 0.0;
+                ok = applyConfigOption(probe, axis.name, axis.values[k]);
             }
+            if (!ok)
+            {
+                cerr << "bad sweep axis " << value << "\n";
+                return false;
+            }
+            opts.sweep.push_back(axis);
         }
-    }
-
-    Vec2 randomSource() const
-    {
-        if (cachedSources.empty())
+        else if (isKnownOption(arg))
         {
-            return Vec2(1, 1);
+            cerr << "bad value for " << arg << ": " << value << "\n";
+            return false;
         }
-        return rng.choice(cachedSources);
-    }
-
-    Vec2 randomSink() const
-    {
-        if (cachedSinks.empty())
+        else
         {
-            return Vec2(1, 1);
+            cerr << "unknown option " << arg << " " << value << "\n";
+            return false;
         }
-        return rng.choice(cachedSinks);
     }
+    return true;
+}
 
-    int getTick() const
+long peakResidentKb()
+{
+#if defined(__APPLE__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<long>(usage.ru_maxrss / 1024);
+#elif defined(__unix__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<long>(usage.ru_maxrss);
+#else
+    return -1;
+#endif
+}
+
+bool startWorld(World &world, const RunOptions &opts)
+{
+    if (opts.loadPath.empty())
     {
-        return tick;
+        world.init();
     }
-
-    bool isAdvancedMode() const
+    else if (!world.loadSnapshot(opts.loadPath))
     {
-        return advancedMode;
+        cerr << "could not load snapshot " << opts.loadPath << "\n";
+        return false;
     }
-
-    bool isShowIds() const
+    // --record always writes the packed format; the console 'rec' command takes a
+    // "packed" argument instead.
+    if (!opts.recordPath.empty() && !world.getRecorder().start(opts.recordPath, true))
     {
-        return showIds;
+        cerr << "could not open recording " << opts.recordPath << "\n";
+        return false;
     }
-};
+    if (opts.servePort >= 0 && !world.getViewers().start(opts.servePort))
+    {
+        cerr << "could not listen on port " << opts.servePort << "\n";
+        return false;
+    }
+    return true;
+}
 
-void Agent::stepPosition(World &world, double dt)
+int runHeadless(World &world, const RunOptions &opts)
 {
-    Vec2 pos = getPos();
-    Vec2 targetPos = pos;
-
-    double dx = velocity.x * dt * speed;
-    double dy = velocity.y * dt * speed;
-
-    double accx = 0.0;
-    double accy = 0.0;
-
-    if (dx > 0.5)
-        accx = 1.0;
-    else if (dx < -0.5)
-        accx = -1.0;
-
-    if (dy > 0.5)
-        accy = 1.0;
-    else if (dy < -0.5)
-        accy = -1.0;
+    auto initStart = chrono::high_resolution_clock::now();
+    if (!startWorld(world, opts))
+    {
+        return 1;
+    }
+    double initMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - initStart).count();
 
-    if (std::abs(dx) >= 1.0 || std::abs(dy) >= 1.0)
+    vector<double> latencies;
+    latencies.reserve(static_cast<size_t>(opts.ticks));
+    double agentUpdates = 0.0;
+    auto start = chrono::high_resolution_clock::now();
+    for (int i = 0; i < opts.ticks; ++i)
     {
-        int stepCount = static_cast<int>(max(std::abs(dx), std::abs(dy)));
-        double stepX = dx / stepCount;
-        double stepY = dy / stepCount;
-        double fx = pos.x;
-        double fy = pos.y;
-        for (int i = 0; i < stepCount; ++i)
-        {
-            fx += stepX;
-            fy += stepY;
-            Vec2 candidate(static_cast<int>(std::round(fx)), static_cast<int>(std::round(fy)));
-            if (candidate != pos && world.getGrid().inBounds(candidate))
-            {
-                const Cell &c = world.getGrid().at(candidate);
-                if (c.type != CellType::Wall)
-                {
-                    pos = candidate;
-                }
-            }
-        }
+        agentUpdates += static_cast<double>(world.agentCount());
+        auto t0 = chrono::high_resolution_clock::now();
+        world.stepTick();
+        latencies.push_back(chrono::duration<double, milli>(chrono::high_resolution_clock::now() - t0).count());
     }
-    else
+    double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+    Recorder &recorder = world.getRecorder();
+    bool recording = recorder.isEnabled();
+    recorder.stop();
+
+    vector<double> sorted = latencies;
+    sort(sorted.begin(), sorted.end());
+    auto percentile = [&](double q)
     {
-        int mx = 0;
-        int my = 0;
-        if (std::abs(dx) >= 0.5)
-            mx = (dx > 0 ? 1 : -1);
-        if (std::abs(dy) >= 0.5)
-            my = (dy > 0 ? 1 : -1);
-        Vec2 candidate = pos + Vec2(mx, my);
-        if (world.getGrid().inBounds(candidate))
+        if (sorted.empty())
         {
-            const Cell &c = world.getGrid().at(candidate);
-            if (c.type != CellType::Wall)
-            {
-                pos = candidate;
-            }
+            return 0.0;
         }
-    }
-
-    setPos(pos);
-    world.addTrailAt(pos);
-}
-
-void Wanderer::update(World &world, double dt)
-{
-    phase += dt;
-    if (localRng.chance(0.15))
+        size_t idx = static_cast<size_t>(q * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[idx];
+    };
+
+    const WorldConfig &c = world.getConfig();
+    cout << fixed << setprecision(3)
+         << "{\"config\":{\"width\":" << c.width << ",\"height\":" << c.height
+         << ",\"wanderers\":" << c.wanderers << ",\"seekers\":" << c.seekers << ",\"trails\":" << c.trails
+         << ",\"sources\":" << c.sources << ",\"sinks\":" << c.sinks << ",\"seed\":" << c.seed
+         << ",\"threads\":" << c.threads << ",\"noise\":\"" << noiseModeName(c.noiseMode) << "\""
+         << ",\"streaming\":" << (c.streaming ? "true" : "false") << "}"
+         << ",\"ticks\":" << opts.ticks
+         << ",\"init_ms\":" << initMs
+         << ",\"seconds\":" << seconds
+         << ",\"ticks_per_sec\":" << (seconds > 0.0 ? opts.ticks / seconds : 0.0)
+         << ",\"agent_updates_per_sec\":" << (seconds > 0.0 ? agentUpdates / seconds : 0.0)
+         << ",\"tick_ms\":{\"p50\":" << percentile(0.50) << ",\"p99\":" << percentile(0.99)
+         << ",\"max\":" << (sorted.empty() ? 0.0 : sorted.back()) << "}"
+         << ",\"agents\":" << world.agentCount()
+         << ",\"peak_rss_kb\":" << peakResidentKb();
+    if (recording)
     {
-        int dir = localRng.intInRange(0, 3);
-        if (dir == 0)
-            velocity = Vec2(1, 0);
-        else if (dir == 1)
-            velocity = Vec2(-1, 0);
-        else if (dir == 2)
-            velocity = Vec2(0, 1);
-        else
-            velocity = Vec2(0, -1);
+        cout << ",\"record\":{\"packed\":" << (recorder.isPacked() ? "true" : "false")
+             << ",\"recorded\":" << recorder.getRecorded() << ",\"dropped\":" << recorder.getDropped()
+             << ",\"bytes\":" << recorder.getBytesWritten() << "}";
     }
-    stepPosition(world, dt);
+    cout << ",\"state_hash\":\"" << hex << world.stateHash() << dec << "\"}\n";
+    return 0;
 }
 
-void Wanderer::onEvent(World &world, const Event &e)
+bool isQuitCommand(const Command &cmd)
 {
-    (void)world;
-    (void)e;
+    return cmd.name == "q" || cmd.name == "quit" || cmd.name == "exit";
 }
 
-void Seeker::update(World &world, double dt)
+// Points a stream at another buffer for the lifetime of the object.
+class StreamRedirect
 {
-    if (!hasTarget)
-    {
-        target = world.randomSink();
-        hasTarget = true;
-    }
-
-    Vec2 pos = getPos();
-    Vec2 diff(target.x - pos.x, target.y - pos.y);
+    ostream &os;
+    streambuf *saved;
 
-    if (diff.x == 0 && diff.y == 0)
+public:
+    StreamRedirect(ostream &s, streambuf *to)
+        : os(s), saved(s.rdbuf(to))
     {
-        hasTarget = false;
-        world.broadcast(Event(EventType::Arrive, getId(), EntityId(0), "", pos));
     }
-    else
+
+    ~StreamRedirect()
     {
-        int bestDx = 0;
-        int bestDy = 0;
-        if (std::abs(diff.x) > std::abs(diff.y))
-        {
-            if (diff.x > 0)
-                bestDx = 1;
-            else if (diff.x < 0)
-                bestDx = -1;
-        }
-        else
-        {
-            if (diff.y > 0)
-                bestDy = 1;
-            else if (diff.y < 0)
-                bestDy = -1;
-        }
-        velocity = Vec2(bestDx, bestDy);
-        stepPosition(world, dt);
+        os.rdbuf(saved);
     }
-}
+};
 
-void Seeker::onEvent(World &world, const Event &e)
+// The calling thread runs the simulation at a fixed tick rate. Frames are
+// published to a render thread and typed commands arrive from an input thread,
+// so neither a slow terminal nor a half-typed command stalls the tick loop.
+int runInteractive(World &world, const RunOptions &opts)
 {
-    (void)world;
-    if (e.type == EventType::Ping)
+    if (!startWorld(world, opts))
     {
-        if (world.random().chance(0.2))
-        {
-            target = e.pos;
-            hasTarget = true;
-        }
+        return 1;
     }
-}
 
-void TrailMaker::update(World &world, double dt)
-{
-    if (world.isAdvancedMode())
-    {
-        const Grid &grid = world.getGrid();
-        Vec2 pos = getPos();
-        double bestScore = -std::numeric_limits<double>::infinity();
-        Vec2 bestDir(0, 0);
+    typedef chrono::steady_clock Clock;
+    SpscQueue<Command> commands(64);
+    FrameMailbox frames;
+    mutex console;
+    atomic<bool> inputDone(false);
+    atomic<bool> echoed(false);
 
-        static const Vec2 dirs[4] = {
-            Vec2(1, 0),
-            Vec2(-1, 0),
-            Vec2(0, 1),
-            Vec2(0, -1)};
+    cout << "\x1b[2J";
+    world.requestRedraw();
+    frames.publish(world.captureFrame());
 
-        for (const Vec2 &d : dirs)
+    thread renderer([&]
+                    {
+                        uint64_t seen = 0;
+                        shared_ptr<const FrameSnapshot> frame;
+                        bool pending = false;
+                        // A frame held back by the fps cap is retried until it goes
+                        // out, so the last frame before a pause still gets shown.
+                        while (pending ? frames.waitFor(seen, frame, chrono::milliseconds(10)) : frames.wait(seen, frame))
+                        {
+                            lock_guard<mutex> lock(console);
+                            pending = !world.presentFrame(*frame, cout);
+                            if (!pending && frame->paused)
+                            {
+                                cout << "\npaused. enter command (or 'q' to quit): " << flush;
+                            }
+                        } });
+
+    thread input([&]
+                 {
+                     string line;
+                     while (getline(cin, line))
+                     {
+                         // The terminal echoed the line and moved the cursor
+                         echoed.store(true, memory_order_release);
+                         Command cmd = CommandParser::parse(line);
+                         if (cmd.name.empty())
+                         {
+                             continue;
+                         }
+                         bool quit = isQuitCommand(cmd);
+                         while (!commands.push(std::move(cmd)))
+                         {
+                             this_thread::sleep_for(chrono::milliseconds(1));
+                         }
+                         if (quit)
+                         {
+                             break;
+                         }
+                     }
+                     inputDone.store(true, memory_order_release); });
+
+    const chrono::milliseconds poll(5);
+    Clock::time_point last = Clock::now();
+    bool quit = false;
+    string unshown; // Command replies not yet part of a published frame
+    while (!quit)
+    {
+        bool closed = inputDone.load(memory_order_acquire);
+        if (echoed.exchange(false, memory_order_acq_rel))
         {
-            Vec2 q = pos + d;
-            if (grid.inBounds(q))
+            lock_guard<mutex> lock(console);
+            world.invalidateDisplay();
+        }
+        Command cmd;
+        while (!quit && commands.pop(cmd))
+        {
+            Clock::time_point t0 = Clock::now();
+            quit = isQuitCommand(cmd);
+            ostringstream reply;
             {
-                const Cell &c = grid.at(q);
-                double score = 0.0;
-                if (c.type == CellType::MarkerA)
-                    score += 0.5;
-                if (c.type == CellType::MarkerB)
-                    score += 1.0;
-                if (c.type == CellType::MarkerC)
-                    score += 1.5;
-                if (c.type == CellType::Trail)
-                    score -= 0.2;
-                if (c.type == CellType::Signal)
-                    score += 0.3;
-                score += c.value1 * 0.1;
-                score += world.random().realRange(-0.05, 0.05);
-
-                if (score > bestScore)
+                lock_guard<mutex> lock(console);
                 {
-                    bestScore = score;
-                    bestDir = d;
+                    StreamRedirect out(cout, reply.rdbuf());
+                    StreamRedirect err(cerr, reply.rdbuf());
+                    world.handleCommand(cmd);
                 }
+                unshown += reply.str();
+                world.setCommandOutput(reply.str());
+                world.invalidateDisplay();
             }
+            // Commands such as "step 500" advance the world themselves; their
+            // run time is not simulated time to catch up on.
+            last += Clock::now() - t0;
+        }
+        if (quit || (closed && commands.empty()))
+        {
+            break;
         }
 
-        velocity = bestDir;
-    }
-    else
-    {
-        if (world.random().chance(0.4))
+        Clock::time_point now = Clock::now();
+        world.step(chrono::duration<double>(now - last).count());
+        last = now;
+        if (world.needsRedraw())
         {
-            int dir = world.random().intInRange(0, 3);
-            if (dir == 0)
-                velocity = Vec2(1, 0);
-            else if (dir == 1)
-                velocity = Vec2(-1, 0);
-            else if (dir == 2)
-                velocity = Vec2(0, 1);
-            else
-                velocity = Vec2(0, -1);
+            frames.publish(world.captureFrame());
+            unshown.clear();
         }
+        this_thread::sleep_for(poll);
     }
 
-    stepPosition(world, dt);
+    frames.close();
+    renderer.join();
+    input.join();
+    cout << unshown << flush;
+    return 0;
 }
 
-void TrailMaker::onEvent(World &world, const Event &e)
+struct SweepResult
 {
-    (void)world;
-    (void)e;
-}
+    uint64_t arrivals;
+    double trailCoverage;
+    double seconds;
+    uint64_t stateHash;
+    size_t agents;
+};
 
-void SignalSource::update(World &world, double dt)
+void writeSweepCsv(ostream &os, const vector<WorldConfig> &runs, const vector<SweepResult> &results, int ticks)
 {
-    timer += dt;
-    if (timer >= cooldown)
+    os << "run,width,height,wanderers,seekers,trails,sources,sinks,radius,threads,seed,noise,streaming,chunk_budget,ticks,agents,arrivals,"
+          "trail_coverage,seconds,ticks_per_sec,state_hash\n";
+    for (size_t i = 0; i < runs.size(); ++i)
     {
-        timer -= cooldown;
-        Vec2 pos = getPos();
-        world.addSignalAt(pos);
-        world.broadcast(Event(EventType::Ping, getId(), EntityId(0), "signal", pos));
+        const WorldConfig &c = runs[i];
+        const SweepResult &r = results[i];
+        os << i << ',' << c.width << ',' << c.height << ',' << c.wanderers << ',' << c.seekers << ',' << c.trails
+           << ',' << c.sources << ',' << c.sinks << ',' << c.pingRadius << ',' << c.threads << ',' << c.seed << ','
+           << noiseModeName(c.noiseMode) << ',' << (c.streaming ? "on" : "off") << ',' << c.chunkBudget << ',' << ticks << ',' << r.agents << ',' << r.arrivals << ',' << fixed << setprecision(6) << r.trailCoverage
+           << ',' << r.seconds << ',' << setprecision(1) << (r.seconds > 0.0 ? ticks / r.seconds : 0.0) << defaultfloat
+           << ',' << hex << r.stateHash << dec << "\n";
     }
 }
 
-void SignalSource::onEvent(World &world, const Event &e)
-{
-    (void)world;
-    (void)e;
-}
-
-void SignalSink::update(World &world, double dt)
-{
-    (void)world;
-    (void)dt;
-}
-
-void SignalSink::onEvent(World &world, const Event &e)
+void writeSweepJson(ostream &os, const vector<WorldConfig> &runs, const vector<SweepResult> &results, int ticks)
 {
-    if (e.type == EventType::Arrive)
+    os << "{\"runs\": [";
+    for (size_t i = 0; i < runs.size(); ++i)
     {
-        (void)e;
+        const WorldConfig &c = runs[i];
+        const SweepResult &r = results[i];
+        os << (i == 0 ? "\n" : ",\n") << "  {\"run\": " << i << ", \"config\": {\"width\": " << c.width << ", \"height\": " << c.height
+           << ", \"wanderers\": " << c.wanderers << ", \"seekers\": " << c.seekers << ", \"trails\": " << c.trails
+           << ", \"sources\": " << c.sources << ", \"sinks\": " << c.sinks << ", \"radius\": " << c.pingRadius
+           << ", \"threads\": " << c.threads << ", \"seed\": " << c.seed << ", \"noise\": \"" << noiseModeName(c.noiseMode)
+           << "\", \"streaming\": " << (c.streaming ? "true" : "false") << ", \"chunk_budget\": " << c.chunkBudget << "}"
+           << ", \"ticks\": " << ticks << ", \"agents\": " << r.agents << ", \"arrivals\": " << r.arrivals
+           << fixed << setprecision(6) << ", \"trail_coverage\": " << r.trailCoverage << ", \"seconds\": " << r.seconds
+           << setprecision(1) << ", \"ticks_per_sec\": " << (r.seconds > 0.0 ? ticks / r.seconds : 0.0) << defaultfloat
+           << ", \"state_hash\": \"" << hex << r.stateHash << dec << "\"}";
     }
+    os << "\n]}\n";
 }
 
-int main()
+// Expands the sweep axes into their cross product (first axis outermost) and
+// runs every variant as an independent World, largest grids first so long runs
+// do not end up as stragglers.
+int runSweep(const WorldConfig &base, const RunOptions &opts)
 {
-    ios::sync_with_stdio(false);
-    cin.tie(nullptr);
-
-    World world;
-    world.init();
-
-    cout << "\x1b[2J";
-    world.requestRedraw();
-    world.render(cout);
-
-    auto last = chrono::high_resolution_clock::now();
-
-    string line;
-    bool interactive = true;
-
-    while (true)
+    vector<WorldConfig> runs(1, base);
+    for (const SweepAxis &axis : opts.sweep)
     {
-        auto now = chrono::high_resolution_clock::now();
-        double dt = chrono::duration<double>(now - last).count();
-        last = now;
-
-        world.step(dt);
-        world.render(cout);
-
-        if (!world.isRunning())
+        if (runs.size() * axis.values.size() > 1000000)
         {
-            cout << "\npaused. enter command (or 'q' to quit): ";
+            cerr << "sweep too large\n";
+            return 2;
         }
-
-        if (interactive)
+        vector<WorldConfig> next;
+        next.reserve(runs.size() * axis.values.size());
+        for (const WorldConfig &c : runs)
         {
-            if (!getline(cin, line))
+            for (const string &v : axis.values)
             {
-                break;
-            }
-            Command cmd = CommandParser::parse(line);
-            if (!cmd.name.empty())
-            {
-                world.handleCommand(cmd);
-                if (!world.isRunning())
-                {
-                    world.render(cout);
-                }
-                if (cmd.name == "q" || cmd.name == "quit" || cmd.name == "exit")
-                {
-                    break;
-                }
+                next.push_back(c);
+                applyConfigOption(next.back(), axis.name, v);
             }
         }
+        runs.swap(next);
+    }
+
+    auto cost = [](const WorldConfig &c)
+    {
+        return static_cast<double>(c.width) * c.height +
+               64.0 * (c.wanderers + c.seekers + c.trails + c.sources + c.sinks);
+    };
+    vector<size_t> order(runs.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                { return cost(runs[a]) > cost(runs[b]); });
+
+    size_t jobs = opts.jobs > 0 ? static_cast<size_t>(opts.jobs) : max<size_t>(1, thread::hardware_concurrency());
+    jobs = min(jobs, runs.size());
+#if defined(SIM_PROFILE)
+    mutex profileMutex;
+    Profiler profile;
+#endif
+    NoiseCache cache(max<size_t>(16, jobs * 4));
+    vector<SweepResult> results(runs.size());
+    ThreadPool workers(jobs);
+    auto start = chrono::high_resolution_clock::now();
+    workers.parallelFor(runs.size(), [&](size_t t)
+                        {
+                            size_t i = order[t];
+#if defined(SIM_PROFILE)
+                            Profiler::instance().reset();
+#endif
+                            unique_ptr<World> world = make_unique<World>();
+                            world->getConfig() = runs[i];
+                            world->setNoiseCache(&cache);
+                            world->init();
+                            auto t0 = chrono::high_resolution_clock::now();
+                            for (int k = 0; k < opts.ticks; ++k)
+                            {
+                                world->stepTick();
+                            }
+                            SweepResult &r = results[i];
+                            r.seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - t0).count();
+                            r.arrivals = world->eventsDispatched(EventType::Arrive);
+                            r.trailCoverage = world->trailCoverage();
+                            r.stateHash = world->stateHash();
+                            r.agents = world->agentCount();
+#if defined(SIM_PROFILE)
+                            lock_guard<mutex> lock(profileMutex);
+                            profile.merge(Profiler::instance());
+#endif
+                        });
+    double seconds = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+
+    bool json = opts.sweepOut.size() >= 5 && opts.sweepOut.compare(opts.sweepOut.size() - 5, 5, ".json") == 0;
+    if (opts.sweepOut.empty())
+    {
+        writeSweepCsv(cout, runs, results, opts.ticks);
+    }
+    else
+    {
+        ofstream out(opts.sweepOut);
+        if (!out)
+        {
+            cerr << "cannot write " << opts.sweepOut << "\n";
+            return 1;
+        }
+        if (json)
+        {
+            writeSweepJson(out, runs, results, opts.ticks);
+        }
         else
         {
-            if (!world.isRunning())
-            {
-                break;
-            }
+            writeSweepCsv(out, runs, results, opts.ticks);
         }
     }
-
+    cerr << "sweep: " << runs.size() << " runs on " << jobs << " workers in " << fixed << setprecision(3) << seconds
+         << " s, noise cache " << cache.getHits() << " hits / " << cache.getMisses() << " misses\n"
+         << defaultfloat;
+#if defined(SIM_PROFILE)
+    profile.report(cerr);
+#endif
     return 0;
 }
+
+int main(int argc, char **argv)
+{
+    ios::sync_with_stdio(false);
+    cin.tie(nullptr);
+
+    World world;
+    RunOptions opts{false, false, false, 1000, "", "", 0.25, "", "", {}, "", 0, -1};
+    if (!parseOptions(argc, argv, world.getConfig(), opts))
+    {
+        printUsage(cerr);
+        return 2;
+    }
+    if (opts.help)
+    {
+        printUsage(cout);
+        return 0;
+    }
+    if (opts.bench)
+    {
+        BenchmarkSuite suite;
+        registerBenchmarks(suite);
+        return suite.run(opts.benchFilter, opts.benchMinTime, cout, opts.benchOut);
+    }
+    if (!opts.sweep.empty())
+    {
+        return runSweep(world.getConfig(), opts);
+    }
+    if (opts.headless)
+    {
+        return runHeadless(world, opts);
+    }
+
+    return runInteractive(world, opts);
+}
@@ -3,11 +3,13 @@
  * * A comprehensive Text-Based System Monitor for Windows 10/11.
  * * FEATURES:
  * - Real-time Process Enumeration (PID, Name, Threads, Memory, Priority)
+ * - Per-Process CPU %, I/O Rates and Handle Counts with Sparkline History
  * - Service Enumeration (Name, Display Name, Status)
  * - System Performance Monitoring (Global CPU %, RAM Usage)
  * - Process Termination Capability
  * - Module (DLL) Inspection
- * - Double-Buffered Console UI (Flicker-free)
+ * - Background Collector Thread (UI never waits on queries)
+ * - Double-Buffered Console UI (Flicker-free, only changed cells are written)
  * - Event Logging
  * * COMPILATION (MSVC):
  * cl WinSysMon.cpp /EHsc /std:c++17 /O2
@@ -23,10 +25,14 @@
 #ifndef _UNICODE
 #define _UNICODE
 #endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
 
 #define _WIN32_WINNT 0x0A00 // Target Windows 10
 
 #include <windows.h>
+#include <winternl.h>
 #include <tlhelp32.h>
 #include <psapi.h>
 #include <pdh.h>
@@ -35,12 +41,15 @@
 #include <strsafe.h>
 
 #include <iostream>
+#include <cwchar>
+#include <cstdarg>
 #include <vector>
 #include <string>
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <mutex>
 #include <thread>
 #include <atomic>
@@ -69,21 +78,24 @@ namespace Utils {
         return strTo;
     }
 
-    // Format bytes to human readable string (KB, MB, GB)
-    std::wstring FormatBytes(SIZE_T bytes) {
+    // Format bytes to human readable text (KB, MB, GB) into out; returns the length
+    int FormatBytes(wchar_t* out, size_t capacity, SIZE_T bytes) {
         const double kb = 1024.0;
         const double mb = kb * 1024.0;
         const double gb = mb * 1024.0;
 
-        std::wstringstream ss;
-        ss << std::fixed << std::setprecision(2);
-
-        if (bytes > gb) ss << (bytes / gb) << L" GB";
-        else if (bytes > mb) ss << (bytes / mb) << L" MB";
-        else if (bytes > kb) ss << (bytes / kb) << L" KB";
-        else ss << bytes << L" B";
+        int len;
+        if (bytes > gb) len = swprintf(out, capacity, L"%.2f GB", bytes / gb);
+        else if (bytes > mb) len = swprintf(out, capacity, L"%.2f MB", bytes / mb);
+        else if (bytes > kb) len = swprintf(out, capacity, L"%.2f KB", bytes / kb);
+        else len = swprintf(out, capacity, L"%llu B", (unsigned long long)bytes);
+        return len < 0 ? 0 : len;
+    }
 
-        return ss.str();
+    std::wstring FormatBytes(SIZE_T bytes) {
+        wchar_t text[32];
+        int len = FormatBytes(text, 32, bytes);
+        return std::wstring(text, len);
     }
 
     std::wstring GetErrorString(DWORD errorMessageID) {
@@ -115,18 +127,29 @@ private:
     std::deque<LogEntry> logs;
     const size_t maxLogs = 50;
     std::mutex logMutex;
+    std::atomic<unsigned> version{0};
 
 public:
     void Log(LogLevel level, const std::wstring& msg) {
         std::lock_guard<std::mutex> lock(logMutex);
         logs.push_front({ std::chrono::system_clock::now(), level, msg });
         if (logs.size() > maxLogs) logs.pop_back();
+        version.fetch_add(1, std::memory_order_release);
     }
 
-    std::vector<LogEntry> GetRecentLogs(size_t count = 10) {
+    // Bumped on every Log call, so readers can tell when to redraw
+    unsigned Version() const { return version.load(std::memory_order_acquire); }
+
+    // Copies the newest entries into out, reusing its storage
+    void GetRecentLogs(std::vector<LogEntry>& out, size_t count = 10) {
         std::lock_guard<std::mutex> lock(logMutex);
         size_t n = std::min(count, logs.size());
-        return std::vector<LogEntry>(logs.begin(), logs.begin() + n);
+        out.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            out[i].timestamp = logs[i].timestamp;
+            out[i].level = logs[i].level;
+            out[i].message.assign(logs[i].message);
+        }
     }
 };
 
@@ -136,16 +159,100 @@ static Logger g_Logger; // Global logger instance
 // DATA STRUCTURES
 // ==========================================
 
+// Fixed-size per-process sample history; the oldest sample is overwritten first
+struct ProcessHistory {
+    static const int kSamples = 32;
+
+    float cpu[kSamples] = {};
+    float readRate[kSamples] = {};
+    float writeRate[kSamples] = {};
+    DWORD handles[kSamples] = {};
+    int head = 0;   // Next slot to write
+    int count = 0;
+
+    void Push(float cpuPercent, float readBytesPerSec, float writeBytesPerSec, DWORD handleCount) {
+        cpu[head] = cpuPercent;
+        readRate[head] = readBytesPerSec;
+        writeRate[head] = writeBytesPerSec;
+        handles[head] = handleCount;
+        head = (head + 1) % kSamples;
+        if (count < kSamples) ++count;
+    }
+
+    // Slot of the sample taken `ago` refreshes back; ago must be below count
+    int Slot(int ago) const { return (head - 1 - ago + kSamples) % kSamples; }
+};
+
 struct ProcessData {
     DWORD pid;
     DWORD parentPid;
     DWORD threadCount;
     DWORD priorityClass;
     SIZE_T workingSetSize; // Memory in bytes
+    double cpuPercent = 0.0; // Share of all logical processors since the last refresh
+    ULONGLONG readRate = 0;  // Bytes per second
+    ULONGLONG writeRate = 0;
+    DWORD handleCount = 0;
+    int historySlot = -1;    // Row in the ProcessHistoryStore
+    DWORD historyStamp = 0;  // Owner of that row when this copy was taken
     std::wstring name;
     std::wstring user;
 };
 
+// Sample histories for every tracked process. They live here rather than in
+// ProcessData so a refresh appends one sample per process instead of copying whole
+// rings into every snapshot; the UI copies out only the rows it draws.
+class ProcessHistoryStore {
+public:
+    // One refresh's change to a row; reset hands the row to a new owner
+    struct Update {
+        int slot;
+        DWORD stamp;
+        bool reset;
+        float cpu;
+        float readRate;
+        float writeRate;
+        DWORD handles;
+    };
+
+private:
+    struct Row {
+        ProcessHistory history;
+        DWORD stamp = 0;
+    };
+
+    std::mutex rowMutex;
+    std::vector<Row> rows;
+
+public:
+    // Collector side, once per refresh
+    void Apply(const std::vector<Update>& updates) {
+        if (updates.empty()) return;
+        std::lock_guard<std::mutex> lock(rowMutex);
+        for (const Update& u : updates) {
+            if (u.slot >= (int)rows.size()) rows.resize(u.slot + 1);
+            Row& row = rows[u.slot];
+            if (u.reset) {
+                row.stamp = u.stamp;
+                row.history.head = 0;
+                row.history.count = 0;
+            } else if (row.stamp == u.stamp) {
+                row.history.Push(u.cpu, u.readRate, u.writeRate, u.handles);
+            }
+        }
+    }
+
+    // UI side; false once the row has been handed to another process
+    bool Read(int slot, DWORD stamp, ProcessHistory& out) {
+        std::lock_guard<std::mutex> lock(rowMutex);
+        if (slot < 0 || slot >= (int)rows.size() || rows[slot].stamp != stamp) return false;
+        out = rows[slot].history;
+        return true;
+    }
+};
+
+enum class ProcessSort { MEMORY, CPU, IO };
+
 struct ServiceData {
     std::wstring serviceName;
     std::wstring displayName;
@@ -159,25 +266,372 @@ struct ModuleData {
     DWORD size;
 };
 
+// Layout of the records returned by NtQuerySystemInformation(SystemProcessInformation).
+// winternl.h only exposes a reserved-out subset, so the documented fields are spelled out here.
+struct SystemProcessInfo {
+    ULONG NextEntryOffset;
+    ULONG NumberOfThreads;
+    LARGE_INTEGER WorkingSetPrivateSize;
+    ULONG HardFaultCount;
+    ULONG NumberOfThreadsHighWatermark;
+    ULONGLONG CycleTime;
+    LARGE_INTEGER CreateTime;
+    LARGE_INTEGER UserTime;
+    LARGE_INTEGER KernelTime;
+    UNICODE_STRING ImageName;
+    LONG BasePriority;
+    HANDLE UniqueProcessId;
+    HANDLE InheritedFromUniqueProcessId;
+    ULONG HandleCount;
+    ULONG SessionId;
+    ULONG_PTR UniqueProcessKey;
+    SIZE_T PeakVirtualSize;
+    SIZE_T VirtualSize;
+    ULONG PageFaultCount;
+    SIZE_T PeakWorkingSetSize;
+    SIZE_T WorkingSetSize;
+    SIZE_T QuotaPeakPagedPoolUsage;
+    SIZE_T QuotaPagedPoolUsage;
+    SIZE_T QuotaPeakNonPagedPoolUsage;
+    SIZE_T QuotaNonPagedPoolUsage;
+    SIZE_T PagefileUsage;
+    SIZE_T PeakPagefileUsage;
+    SIZE_T PrivatePageCount;
+    LARGE_INTEGER ReadOperationCount;
+    LARGE_INTEGER WriteOperationCount;
+    LARGE_INTEGER OtherOperationCount;
+    LARGE_INTEGER ReadTransferCount;
+    LARGE_INTEGER WriteTransferCount;
+    LARGE_INTEGER OtherTransferCount;
+};
+
+typedef LONG (WINAPI *NtQuerySystemInformationFn)(ULONG, PVOID, ULONG, PULONG);
+
 // ==========================================
 // SYSTEM MONITOR ENGINE
 // ==========================================
 
 class SystemMonitor {
 private:
+    // Per-PID state kept across refreshes so only new or exited processes cost anything
+    struct CachedProcess {
+        ProcessData data;
+        ULONGLONG createTime = 0;
+        HANDLE handle = NULL;   // Kept open for the Toolhelp fallback
+        DWORD generation = 0;   // Refresh in which the PID was last seen
+        bool listed = false;    // Already has a row in processView
+
+        // Cumulative counters from the previous sample, used for rates
+        ULONGLONG sampleTime = 0;   // 100ns units, 0 until the first sample
+        ULONGLONG cpuTime = 0;
+        ULONGLONG readBytes = 0;
+        ULONGLONG writeBytes = 0;
+    };
+
+    static const ULONG kSystemProcessInformation = 5;
+    static const LONG kStatusInfoLengthMismatch = (LONG)0xC0000004;
+
     PDH_HQUERY cpuQuery;
     PDH_HCOUNTER cpuTotal;
     bool pdhInitialized = false;
 
+    NtQuerySystemInformationFn ntQuerySystemInformation = nullptr;
+    ProcessHistoryStore& histories;
+    std::vector<ProcessHistoryStore::Update> historyUpdates;  // Applied in one batch per refresh
+    std::vector<int> freeHistorySlots;
+    int historySlotCount = 0;
+    DWORD historyStamp = 0;
+    std::vector<BYTE> queryBuffer;
+    std::unordered_map<DWORD, CachedProcess> processCache;
+    std::vector<ProcessData> processView;
+    std::unordered_map<DWORD, int> rowByPid;
+    DWORD refreshGeneration = 0;
+    ULONGLONG refreshTime = 0;  // 100ns units, taken at the start of each refresh
+    DWORD processorCount = 1;
+    ProcessSort sortOrder = ProcessSort::MEMORY;
+    ProcessSort viewSortOrder = ProcessSort::MEMORY;  // Order processView is currently sorted by
+
+    static ULONGLONG FileTimeToTicks(const FILETIME& ft) {
+        return ((ULONGLONG)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    }
+
+    static ULONGLONG CounterDelta(ULONGLONG now, ULONGLONG before) {
+        return now > before ? now - before : 0;
+    }
+
+    // Turns cumulative counters into per-refresh rates and queues them for the history
+    void Sample(CachedProcess& entry, ULONGLONG cpuTime, ULONGLONG readBytes, ULONGLONG writeBytes, DWORD handleCount) {
+        ProcessData& d = entry.data;
+        d.handleCount = handleCount;
+        if (entry.sampleTime != 0 && refreshTime > entry.sampleTime) {
+            double elapsed = (double)(refreshTime - entry.sampleTime);
+            double seconds = elapsed / 1e7;
+            d.cpuPercent = std::min(100.0, CounterDelta(cpuTime, entry.cpuTime) * 100.0 / (elapsed * processorCount));
+            d.readRate = (ULONGLONG)(CounterDelta(readBytes, entry.readBytes) / seconds);
+            d.writeRate = (ULONGLONG)(CounterDelta(writeBytes, entry.writeBytes) / seconds);
+            historyUpdates.push_back({ d.historySlot, d.historyStamp, false,
+                (float)d.cpuPercent, (float)d.readRate, (float)d.writeRate, handleCount });
+        }
+        entry.sampleTime = refreshTime;
+        entry.cpuTime = cpuTime;
+        entry.readBytes = readBytes;
+        entry.writeBytes = writeBytes;
+    }
+
+    void Release(CachedProcess& entry) {
+        if (entry.handle) CloseHandle(entry.handle);
+        freeHistorySlots.push_back(entry.data.historySlot);
+    }
+
+    void Forget(std::unordered_map<DWORD, CachedProcess>::iterator it) {
+        Release(it->second);
+        processCache.erase(it);
+    }
+
+    // Returns the cache entry for pid, replacing it if the PID now belongs to a different process
+    CachedProcess& Track(DWORD pid, ULONGLONG createTime, bool& isNew) {
+        auto it = processCache.find(pid);
+        if (it != processCache.end() && it->second.createTime != createTime) {
+            Forget(it);
+            it = processCache.end();
+        }
+        isNew = it == processCache.end();
+        if (isNew) {
+            it = processCache.emplace(pid, CachedProcess()).first;
+            it->second.data.pid = pid;
+            it->second.createTime = createTime;
+
+            int slot = historySlotCount;
+            if (freeHistorySlots.empty()) ++historySlotCount;
+            else {
+                slot = freeHistorySlots.back();
+                freeHistorySlots.pop_back();
+            }
+            it->second.data.historySlot = slot;
+            it->second.data.historyStamp = ++historyStamp;
+            historyUpdates.push_back({ slot, historyStamp, true, 0.0f, 0.0f, 0.0f, 0 });
+        }
+        it->second.generation = refreshGeneration;
+        return it->second;
+    }
+
+    bool QueryProcessesNt() {
+        if (queryBuffer.empty()) queryBuffer.resize(512 * 1024);
+
+        LONG status = kStatusInfoLengthMismatch;
+        for (int attempt = 0; attempt < 4 && status == kStatusInfoLengthMismatch; ++attempt) {
+            ULONG needed = 0;
+            status = ntQuerySystemInformation(kSystemProcessInformation, queryBuffer.data(), (ULONG)queryBuffer.size(), &needed);
+            if (status == kStatusInfoLengthMismatch) {
+                queryBuffer.resize(std::max<size_t>(queryBuffer.size() * 2, needed + 64 * 1024));
+            }
+        }
+        if (status < 0) return false;
+
+        size_t offset = 0;
+        for (;;) {
+            const SystemProcessInfo* info = reinterpret_cast<const SystemProcessInfo*>(queryBuffer.data() + offset);
+            DWORD pid = (DWORD)(ULONG_PTR)info->UniqueProcessId;
+            bool isNew;
+            CachedProcess& entry = Track(pid, (ULONGLONG)info->CreateTime.QuadPart, isNew);
+            if (isNew) {
+                if (info->ImageName.Buffer) entry.data.name.assign(info->ImageName.Buffer, info->ImageName.Length / sizeof(WCHAR));
+                else entry.data.name = pid == 0 ? L"System Idle Process" : L"System";
+            }
+            entry.data.parentPid = (DWORD)(ULONG_PTR)info->InheritedFromUniqueProcessId;
+            entry.data.threadCount = info->NumberOfThreads;
+            entry.data.priorityClass = (DWORD)info->BasePriority;
+            entry.data.workingSetSize = info->WorkingSetSize;
+            Sample(entry, (ULONGLONG)(info->UserTime.QuadPart + info->KernelTime.QuadPart),
+                   (ULONGLONG)info->ReadTransferCount.QuadPart, (ULONGLONG)info->WriteTransferCount.QuadPart, info->HandleCount);
+
+            if (info->NextEntryOffset == 0 || offset + info->NextEntryOffset + sizeof(SystemProcessInfo) > queryBuffer.size()) break;
+            offset += info->NextEntryOffset;
+        }
+        return true;
+    }
+
+    bool QueryProcessesToolhelp() {
+        HANDLE hProcessSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+        if (hProcessSnap == INVALID_HANDLE_VALUE) {
+            g_Logger.Log(LogLevel::ERR, L"Failed to snapshot processes.");
+            return false;
+        }
+
+        PROCESSENTRY32 pe32;
+        pe32.dwSize = sizeof(PROCESSENTRY32);
+
+        if (!Process32First(hProcessSnap, &pe32)) {
+            CloseHandle(hProcessSnap);
+            return false;
+        }
+
+        do {
+            DWORD pid = pe32.th32ProcessID;
+            auto it = processCache.find(pid);
+            if (it != processCache.end()) {
+                // Exited handle or a different image under the same PID means it was reused
+                const CachedProcess& cached = it->second;
+                bool reused = cached.handle ? WaitForSingleObject(cached.handle, 0) == WAIT_OBJECT_0
+                                            : (cached.data.parentPid != pe32.th32ParentProcessID || cached.data.name != pe32.szExeFile);
+                if (reused) {
+                    Forget(it);
+                    it = processCache.end();
+                }
+            }
+            if (it == processCache.end()) {
+                it = processCache.emplace(pid, CachedProcess()).first;
+                it->second.data.pid = pid;
+                it->second.data.name = pe32.szExeFile;
+                it->second.handle = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | PROCESS_VM_READ | SYNCHRONIZE, FALSE, pid);
+            }
+
+            CachedProcess& entry = it->second;
+            entry.generation = refreshGeneration;
+            entry.data.parentPid = pe32.th32ParentProcessID;
+            entry.data.threadCount = pe32.cntThreads;
+            entry.data.priorityClass = pe32.pcPriClassBase;
+            entry.data.workingSetSize = 0;
+            if (entry.handle) {
+                PROCESS_MEMORY_COUNTERS pmc;
+                if (GetProcessMemoryInfo(entry.handle, &pmc, sizeof(pmc))) {
+                    entry.data.workingSetSize = pmc.WorkingSetSize;
+                }
+
+                FILETIME created, exited, kernel, user;
+                IO_COUNTERS io;
+                DWORD handleCount = 0;
+                if (GetProcessTimes(entry.handle, &created, &exited, &kernel, &user) && GetProcessIoCounters(entry.handle, &io)) {
+                    GetProcessHandleCount(entry.handle, &handleCount);
+                    Sample(entry, FileTimeToTicks(kernel) + FileTimeToTicks(user), io.ReadTransferCount, io.WriteTransferCount, handleCount);
+                }
+            }
+        } while (Process32Next(hProcessSnap, &pe32));
+
+        CloseHandle(hProcessSnap);
+        return true;
+    }
+
+    static void CopyCounters(const ProcessData& from, ProcessData& to) {
+        to.parentPid = from.parentPid;
+        to.threadCount = from.threadCount;
+        to.priorityClass = from.priorityClass;
+        to.workingSetSize = from.workingSetSize;
+        to.cpuPercent = from.cpuPercent;
+        to.readRate = from.readRate;
+        to.writeRate = from.writeRate;
+        to.handleCount = from.handleCount;
+    }
+
+    static bool MemoryBefore(const ProcessData& a, const ProcessData& b) {
+        return a.workingSetSize > b.workingSetSize;
+    }
+
+    static bool CpuBefore(const ProcessData& a, const ProcessData& b) {
+        return a.cpuPercent > b.cpuPercent;
+    }
+
+    static bool IoBefore(const ProcessData& a, const ProcessData& b) {
+        return a.readRate + a.writeRate > b.readRate + b.writeRate;
+    }
+
+    // Updates surviving rows in place, drops exited ones and appends new PIDs, then
+    // restores the order so rows with equal keys keep their previous position.
+    // Between refreshes only a few keys cross their neighbours, so a stable
+    // insertion pass repairs the order and rowByPid is patched for the rows that
+    // moved; a new sort key or a heavy reshuffle falls back to stable_sort.
+    void RebuildView() {
+        size_t dirtyFrom = SIZE_MAX;
+        size_t dirtyTo = 0;
+        size_t w = 0;
+        for (size_t r = 0; r < processView.size(); ++r) {
+            auto it = processCache.find(processView[r].pid);
+            if (it == processCache.end()) {
+                rowByPid.erase(processView[r].pid);
+                continue;
+            }
+
+            CachedProcess& entry = it->second;
+            if (w != r) {
+                processView[w] = std::move(processView[r]);
+                dirtyFrom = std::min(dirtyFrom, w);
+            }
+            if (entry.listed) CopyCounters(entry.data, processView[w]);
+            else processView[w] = entry.data;
+            entry.listed = true;
+            ++w;
+        }
+        processView.resize(w);
+
+        for (auto& kv : processCache) {
+            if (!kv.second.listed) {
+                dirtyFrom = std::min(dirtyFrom, processView.size());
+                processView.push_back(kv.second.data);
+                kv.second.listed = true;
+            }
+        }
+        if (dirtyFrom != SIZE_MAX) dirtyTo = processView.size();
+
+        bool (*before)(const ProcessData&, const ProcessData&) = MemoryBefore;
+        if (sortOrder == ProcessSort::CPU) before = CpuBefore;
+        else if (sortOrder == ProcessSort::IO) before = IoBefore;
+
+        size_t n = processView.size();
+        if (sortOrder != viewSortOrder) {
+            std::stable_sort(processView.begin(), processView.end(), before);
+            viewSortOrder = sortOrder;
+            dirtyFrom = 0;
+            dirtyTo = n;
+        } else {
+            size_t budget = n * 4;
+            size_t shifted = 0;
+            for (size_t i = 1; i < n && shifted <= budget; ++i) {
+                if (!before(processView[i], processView[i - 1])) continue;
+                ProcessData moving = std::move(processView[i]);
+                size_t j = i;
+                for (; j > 0 && before(moving, processView[j - 1]); --j) {
+                    processView[j] = std::move(processView[j - 1]);
+                }
+                processView[j] = std::move(moving);
+                shifted += i - j;
+                dirtyFrom = std::min(dirtyFrom, j);
+                dirtyTo = std::max(dirtyTo, i + 1);
+            }
+            if (shifted > budget) {
+                std::stable_sort(processView.begin(), processView.end(), before);
+                dirtyFrom = 0;
+                dirtyTo = n;
+            }
+        }
+
+        for (size_t r = dirtyFrom; r < dirtyTo; ++r) {
+            rowByPid[processView[r].pid] = (int)r;
+        }
+    }
+
 public:
-    SystemMonitor() {
+    explicit SystemMonitor(ProcessHistoryStore& histories) : histories(histories) {
         InitializePDH();
+
+        processorCount = std::max<DWORD>(1, GetActiveProcessorCount(ALL_PROCESSOR_GROUPS));
+
+        HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+        if (ntdll) {
+            ntQuerySystemInformation = reinterpret_cast<NtQuerySystemInformationFn>(
+                reinterpret_cast<void*>(GetProcAddress(ntdll, "NtQuerySystemInformation")));
+        }
+        if (!ntQuerySystemInformation) {
+            g_Logger.Log(LogLevel::WARNING, L"NtQuerySystemInformation unavailable, using Toolhelp.");
+        }
     }
 
     ~SystemMonitor() {
         if (pdhInitialized) {
             PdhCloseQuery(cpuQuery);
         }
+        for (auto& kv : processCache) {
+            if (kv.second.handle) CloseHandle(kv.second.handle);
+        }
     }
 
     void InitializePDH() {
@@ -217,54 +671,42 @@ public:
         avail = memInfo.ullAvailPhys;
     }
 
-    std::vector<ProcessData> EnumProcesses() {
-        std::vector<ProcessData> procs;
-        HANDLE hProcessSnap = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
-        if (hProcessSnap == INVALID_HANDLE_VALUE) {
-            g_Logger.Log(LogLevel::ERR, L"Failed to snapshot processes.");
-            return procs;
+    // Diffs the current process list against the cache and returns the sorted view.
+    // The reference stays valid until the next call.
+    const std::vector<ProcessData>& EnumProcesses() {
+        ++refreshGeneration;
+        FILETIME now;
+        GetSystemTimeAsFileTime(&now);
+        refreshTime = FileTimeToTicks(now);
+        bool ok = ntQuerySystemInformation && QueryProcessesNt();
+        if (!ok) ok = QueryProcessesToolhelp();
+        histories.Apply(historyUpdates);
+        historyUpdates.clear();
+        if (!ok) return processView;
+
+        for (auto it = processCache.begin(); it != processCache.end();) {
+            if (it->second.generation != refreshGeneration) {
+                Release(it->second);
+                it = processCache.erase(it);
+            } else {
+                ++it;
+            }
         }
 
-        PROCESSENTRY32 pe32;
-        pe32.dwSize = sizeof(PROCESSENTRY32);
-
-        if (!Process32First(hProcessSnap, &pe32)) {
-            CloseHandle(hProcessSnap);
-            return procs;
-        }
+        RebuildView();
+        return processView;
+    }
 
-        do {
-            ProcessData pd;
-            pd.pid = pe32.th32ProcessID;
-            pd.parentPid = pe32.th32ParentProcessID;
-            pd.threadCount = pe32.cntThreads;
-            pd.priorityClass = pe32.pcPriClassBase;
-            pd.name = pe32.szExeFile;
-            pd.workingSetSize = 0; // Filled below
-
-            // Open process to get memory info
-            HANDLE hProc = OpenProcess(PROCESS_QUERY_INFORMATION | PROCESS_VM_READ, FALSE, pd.pid);
-            if (hProc) {
-                PROCESS_MEMORY_COUNTERS_EX pmc;
-                if (GetProcessMemoryInfo(hProc, (PROCESS_MEMORY_COUNTERS*)&pmc, sizeof(pmc))) {
-                    pd.workingSetSize = pmc.WorkingSetSize;
-                }
-                CloseHandle(hProc);
-            }
+    // Row of pid in the last EnumProcesses view, or -1
+    int FindProcessRow(DWORD pid) const {
+        auto it = rowByPid.find(pid);
+        return it == rowByPid.end() ? -1 : it->second;
+    }
 
-            procs.push_back(pd);
+    const std::unordered_map<DWORD, int>& ProcessRows() const { return rowByPid; }
 
-        } while (Process32Next(hProcessSnap, &pe32));
-
-        CloseHandle(hProcessSnap);
-        
-        // Sort by PID descending usually, but let's do by Memory Usage
-        std::sort(procs.begin(), procs.end(), [](const ProcessData& a, const ProcessData& b) {
-            return a.workingSetSize > b.workingSetSize;
-        });
-
-        return procs;
-    }
+    // Takes effect on the next EnumProcesses
+    void SetSortOrder(ProcessSort order) { sortOrder = order; }
 
     std::vector<ServiceData> EnumServices() {
         std::vector<ServiceData> services;
@@ -302,7 +744,8 @@ public:
         return services;
     }
 
-    bool KillProcess(DWORD pid) {
+    // Touches no monitor state, so the UI thread may call it while the collector runs
+    static bool KillProcess(DWORD pid) {
         HANDLE hProc = OpenProcess(PROCESS_TERMINATE, FALSE, pid);
         if (hProc == NULL) {
             g_Logger.Log(LogLevel::ERR, L"Failed to open process for termination: " + std::to_wstring(pid));
@@ -343,6 +786,174 @@ public:
     }
 };
 
+// ==========================================
+// BACKGROUND COLLECTOR
+// ==========================================
+
+// Everything the UI draws from one collection pass. Once published it is never
+// written again until the UI has moved on to a newer one.
+struct SystemSnapshot {
+    ULONGLONG sequence = 0;
+    double cpuUsage = 0.0;
+    DWORD memLoad = 0;
+    SIZE_T totalMem = 0;
+    SIZE_T availMem = 0;
+    std::vector<ProcessData> processes;
+    ProcessSort processSort = ProcessSort::MEMORY;
+    std::unordered_map<DWORD, int> rowByPid;
+    std::vector<ServiceData> services;
+    bool servicesValid = false;
+    std::vector<ModuleData> modules;
+    DWORD modulesPid = 0;
+    DWORD moduleRequest = 0;    // Request id the module list answers
+
+    int FindProcessRow(DWORD pid) const {
+        auto it = rowByPid.find(pid);
+        return it == rowByPid.end() ? -1 : it->second;
+    }
+};
+
+// Single-producer/single-consumer triple buffer. The collector fills Back() and
+// publishes it; the UI swaps the newest published slot into Front(). Neither side
+// ever waits, and slots are reused so their vectors keep their capacity.
+class SnapshotExchange {
+private:
+    static const int kIndexMask = 3;
+    static const int kFresh = 4;
+
+    SystemSnapshot slots[3];
+    int back = 0;                   // Collector only
+    std::atomic<int> middle{1};     // Shared, kFresh set when not yet taken
+    int front = 2;                  // UI only
+
+public:
+    SystemSnapshot& Back() { return slots[back]; }
+
+    void Publish() {
+        int prev = middle.exchange(back | kFresh, std::memory_order_acq_rel);
+        back = prev & kIndexMask;
+    }
+
+    // Returns true if a newer snapshot replaced Front()
+    bool Acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & kFresh)) return false;
+        int prev = middle.exchange(front, std::memory_order_acq_rel);
+        front = prev & kIndexMask;
+        return true;
+    }
+
+    const SystemSnapshot& Front() const { return slots[front]; }
+};
+
+// Owns the SystemMonitor and runs every slow query on its own thread, so a stalled
+// enumeration never holds up input or redraw.
+class Collector {
+private:
+    SystemMonitor monitor;
+    SnapshotExchange& exchange;
+    std::thread worker;
+    HANDLE wakeEvent;
+    HANDLE publishedEvent;  // Signalled after every Publish so the UI can sleep until then
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> wantServices{false};
+    std::atomic<DWORD> modulePid{0};
+    std::atomic<DWORD> moduleRequest{0};
+    std::atomic<ProcessSort> processSort{ProcessSort::MEMORY};
+    int intervalMs;
+
+    // Collector-side copies carried into every snapshot between re-enumerations
+    std::vector<ServiceData> services;
+    bool servicesValid = false;
+    std::vector<ModuleData> modules;
+    DWORD modulesPid = 0;
+    DWORD servedModuleRequest = 0;
+    ULONGLONG sequence = 0;
+
+    void Collect() {
+        SystemSnapshot& s = exchange.Back();
+        s.sequence = ++sequence;
+        s.cpuUsage = monitor.GetCpuUsage();
+        monitor.GetMemoryStatus(s.memLoad, s.totalMem, s.availMem);
+        s.processSort = processSort.load(std::memory_order_relaxed);
+        monitor.SetSortOrder(s.processSort);
+        s.processes = monitor.EnumProcesses();
+        s.rowByPid = monitor.ProcessRows();
+
+        if (wantServices.load(std::memory_order_relaxed)) {
+            services = monitor.EnumServices();
+            servicesValid = true;
+        }
+        s.services = services;
+        s.servicesValid = servicesValid;
+
+        DWORD request = moduleRequest.load(std::memory_order_acquire);
+        if (request != servedModuleRequest) {
+            modulesPid = modulePid.load(std::memory_order_relaxed);
+            modules = monitor.GetProcessModules(modulesPid);
+            servedModuleRequest = request;
+        }
+        s.modules = modules;
+        s.modulesPid = modulesPid;
+        s.moduleRequest = servedModuleRequest;
+
+        exchange.Publish();
+        SetEvent(publishedEvent);
+    }
+
+    void Loop() {
+        while (!stopping.load()) {
+            Collect();
+            WaitForSingleObject(wakeEvent, intervalMs);
+        }
+    }
+
+public:
+    Collector(SnapshotExchange& exchange, ProcessHistoryStore& histories, int intervalMs = 1000)
+        : monitor(histories), exchange(exchange), intervalMs(intervalMs) {
+        wakeEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+        publishedEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    }
+
+    ~Collector() {
+        Stop();
+        if (wakeEvent) CloseHandle(wakeEvent);
+        if (publishedEvent) CloseHandle(publishedEvent);
+    }
+
+    HANDLE PublishedEvent() const { return publishedEvent; }
+
+    void Start() {
+        if (!worker.joinable()) worker = std::thread(&Collector::Loop, this);
+    }
+
+    void Stop() {
+        stopping = true;
+        Wake();
+        if (worker.joinable()) worker.join();
+    }
+
+    // Runs a collection pass now instead of at the next interval
+    void Wake() { SetEvent(wakeEvent); }
+
+    void SetProcessSort(ProcessSort order) {
+        processSort = order;
+        Wake();
+    }
+
+    void SetWantServices(bool want) {
+        wantServices = want;
+        if (want) Wake();
+    }
+
+    // Returns the request id a snapshot's moduleRequest will carry once pid is loaded
+    DWORD RequestModules(DWORD pid) {
+        modulePid.store(pid, std::memory_order_relaxed);
+        DWORD request = moduleRequest.fetch_add(1, std::memory_order_release) + 1;
+        Wake();
+        return request;
+    }
+};
+
 // ==========================================
 // CONSOLE UI ENGINE (Double Buffered)
 // ==========================================
@@ -351,13 +962,11 @@ class ConsoleUI {
 private:
     HANDLE hOut;
     HANDLE hIn;
-    SMALL_RECT windowRect;
-    int width;
-    int height;
-    CHAR_INFO* buffer;
+    int width = 0;
+    int height = 0;
+    std::vector<CHAR_INFO> buffer;  // Back buffer the draw routines write into
+    std::vector<CHAR_INFO> shown;   // What the console currently displays
     COORD bufferSize;
-    COORD bufferCoord;
-    SMALL_RECT writeRegion;
 
     // Colors
     const WORD COL_DEFAULT = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
@@ -366,6 +975,20 @@ private:
     const WORD COL_WARNING = FOREGROUND_RED | FOREGROUND_INTENSITY;
     const WORD COL_DIM = FOREGROUND_INTENSITY;
 
+    static bool SameCell(const CHAR_INFO& a, const CHAR_INFO& b) {
+        return a.Char.UnicodeChar == b.Char.UnicodeChar && a.Attributes == b.Attributes;
+    }
+
+    // Pushes rows [top, bottom], columns [left, right] of the back buffer to the console
+    void Flush(int top, int bottom, int left, int right) {
+        COORD from = {(SHORT)left, (SHORT)top};
+        SMALL_RECT region = {(SHORT)left, (SHORT)top, (SHORT)right, (SHORT)bottom};
+        WriteConsoleOutputW(hOut, buffer.data(), bufferSize, from, &region);
+        for (int y = top; y <= bottom; ++y) {
+            std::copy(buffer.begin() + y * width + left, buffer.begin() + y * width + right + 1, shown.begin() + y * width + left);
+        }
+    }
+
 public:
     ConsoleUI() {
         hOut = GetStdHandle(STD_OUTPUT_HANDLE);
@@ -383,11 +1006,6 @@ public:
         SetConsoleCursorInfo(hOut, &cursorInfo);
 
         UpdateSize();
-        buffer = new CHAR_INFO[width * height];
-    }
-
-    ~ConsoleUI() {
-        delete[] buffer;
     }
 
     void UpdateSize() {
@@ -395,11 +1013,18 @@ public:
         GetConsoleScreenBufferInfo(hOut, &csbi);
         width = csbi.srWindow.Right - csbi.srWindow.Left + 1;
         height = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
-        
-        windowRect = {0, 0, (SHORT)(width - 1), (SHORT)(height - 1)};
         bufferSize = {(SHORT)width, (SHORT)height};
-        bufferCoord = {0, 0};
-        writeRegion = windowRect;
+
+        buffer.resize(width * height);
+        Invalidate();
+    }
+
+    // Forces the next Render to rewrite every cell
+    void Invalidate() {
+        CHAR_INFO never;
+        never.Char.UnicodeChar = 0;
+        never.Attributes = 0xFFFF;
+        shown.assign(width * height, never);
     }
 
     void Clear(WORD attr = 0) {
@@ -410,13 +1035,41 @@ public:
         }
     }
 
-    void Write(int x, int y, const std::wstring& text, WORD attr = 0) {
+    void Put(int x, int y, WCHAR ch, WORD attr = 0) {
+        if (x < 0 || y < 0 || x >= width || y >= height) return;
         if (attr == 0) attr = COL_DEFAULT;
-        for (size_t i = 0; i < text.length(); ++i) {
-            if (x + i >= width || y >= height || x + i < 0 || y < 0) continue;
-            int idx = y * width + (x + i);
-            buffer[idx].Char.UnicodeChar = text[i];
-            buffer[idx].Attributes = attr;
+        CHAR_INFO& cell = buffer[y * width + x];
+        cell.Char.UnicodeChar = ch;
+        cell.Attributes = attr;
+    }
+
+    void Fill(int x, int y, int count, WCHAR ch, WORD attr = 0) {
+        for (int i = 0; i < count; ++i) Put(x + i, y, ch, attr);
+    }
+
+    void WriteN(int x, int y, const wchar_t* text, size_t len, WORD attr = 0) {
+        for (size_t i = 0; i < len; ++i) Put(x + (int)i, y, text[i], attr);
+    }
+
+    void Write(int x, int y, const wchar_t* text, WORD attr = 0) {
+        WriteN(x, y, text, wcslen(text), attr);
+    }
+
+    void Write(int x, int y, const std::wstring& text, WORD attr = 0) {
+        WriteN(x, y, text.data(), text.length(), attr);
+    }
+
+    // Writes text cut to maxLen columns, marking the cut with "..." at the end
+    // (or at the start when keepTail is set, which suits paths)
+    void WriteTruncated(int x, int y, const std::wstring& text, size_t maxLen, WORD attr = 0, bool keepTail = false) {
+        if (text.length() <= maxLen || maxLen < 3) {
+            WriteN(x, y, text.data(), std::min(text.length(), maxLen), attr);
+        } else if (keepTail) {
+            WriteN(x, y, L"...", 3, attr);
+            WriteN(x + 3, y, text.data() + text.length() - (maxLen - 3), maxLen - 3, attr);
+        } else {
+            WriteN(x, y, text.data(), maxLen - 3, attr);
+            WriteN(x + (int)maxLen - 3, y, L"...", 3, attr);
         }
     }
 
@@ -424,24 +1077,47 @@ public:
     void DrawBox(int x, int y, int w, int h, WORD attr = 0) {
         if (attr == 0) attr = COL_DEFAULT;
         // Corners
-        Write(x, y, L"\x250C", attr); // Top Left
-        Write(x + w - 1, y, L"\x2510", attr); // Top Right
-        Write(x, y + h - 1, L"\x2514", attr); // Bot Left
-        Write(x + w - 1, y + h - 1, L"\x2518", attr); // Bot Right
+        Put(x, y, L'\x250C', attr); // Top Left
+        Put(x + w - 1, y, L'\x2510', attr); // Top Right
+        Put(x, y + h - 1, L'\x2514', attr); // Bot Left
+        Put(x + w - 1, y + h - 1, L'\x2518', attr); // Bot Right
         
         // Edges
-        for (int i = 1; i < w - 1; ++i) {
-            Write(x + i, y, L"\x2500", attr);
-            Write(x + i, y + h - 1, L"\x2500", attr);
-        }
+        Fill(x + 1, y, w - 2, L'\x2500', attr);
+        Fill(x + 1, y + h - 1, w - 2, L'\x2500', attr);
         for (int i = 1; i < h - 1; ++i) {
-            Write(x, y + i, L"\x2502", attr);
-            Write(x + w - 1, y + i, L"\x2502", attr);
+            Put(x, y + i, L'\x2502', attr);
+            Put(x + w - 1, y + i, L'\x2502', attr);
         }
     }
 
+    // Writes only what changed since the last Render. Each run of consecutive
+    // changed rows goes out as one rectangle spanning their changed columns.
     void Render() {
-        WriteConsoleOutputW(hOut, buffer, bufferSize, bufferCoord, &writeRegion);
+        int top = -1, left = width, right = -1;
+        for (int y = 0; y <= height; ++y) {
+            int rowLeft = width, rowRight = -1;
+            if (y < height) {
+                const CHAR_INFO* back = &buffer[y * width];
+                const CHAR_INFO* front = &shown[y * width];
+                for (int x = 0; x < width; ++x) {
+                    if (!SameCell(back[x], front[x])) {
+                        if (rowRight < 0) rowLeft = x;
+                        rowRight = x;
+                    }
+                }
+            }
+            if (rowRight >= 0) {
+                if (top < 0) top = y;
+                left = std::min(left, rowLeft);
+                right = std::max(right, rowRight);
+            } else if (top >= 0) {
+                Flush(top, y - 1, left, right);
+                top = -1;
+                left = width;
+                right = -1;
+            }
+        }
     }
 
     int GetWidth() const { return width; }
@@ -463,33 +1139,49 @@ class Application {
 private:
     bool running = true;
     ConsoleUI ui;
-    SystemMonitor monitor;
+    SnapshotExchange snapshots;
+    ProcessHistoryStore histories;
+    Collector collector{snapshots, histories};
     AppState state = AppState::PROCESS_LIST;
     
-    // Data Caches
-    std::vector<ProcessData> processes;
-    std::vector<ServiceData> services;
-    std::vector<ModuleData> modules;
+    // Latest snapshot from the collector; only swapped in UpdateData
+    const SystemSnapshot* snapshot = &snapshots.Front();
     
     // State management
     int selectedIndex = 0;
     int scrollOffset = 0;
     DWORD selectedPid = 0; // For module view
-    
-    // Timers
-    std::chrono::steady_clock::time_point lastUpdate;
-    int updateIntervalMs = 1000;
+    DWORD moduleRequest = 0;
+    ProcessSort processSort = ProcessSort::MEMORY;
+
+    // Redraw bookkeeping; a frame is only drawn when one of these says so
+    static const DWORD kIdleWaitMs = 500;
+    bool needsRedraw = true;
+    unsigned drawnLogVersion = 0;
+
+    // Scratch space reused by every frame so drawing does not allocate
+    wchar_t text[256];
+    std::vector<LogEntry> recentLogs;
 
 public:
     void Run() {
         g_Logger.Log(LogLevel::INFO, L"WinSysMon Started.");
-        
+        collector.Start();
+
+        HANDLE waits[2] = { ui.GetInputHandle(), collector.PublishedEvent() };
         while (running) {
             ProcessInput();
             UpdateData();
-            Draw();
-            std::this_thread::sleep_for(std::chrono::milliseconds(30)); // Cap frame rate
+            if (g_Logger.Version() != drawnLogVersion) needsRedraw = true;
+            if (needsRedraw) {
+                Draw();
+                needsRedraw = false;
+            }
+            // Sleep until there is input or a new snapshot; the timeout only bounds log latency
+            WaitForMultipleObjects(2, waits, FALSE, kIdleWaitMs);
         }
+
+        collector.Stop();
     }
 
 private:
@@ -505,6 +1197,7 @@ private:
 
         for (DWORD i = 0; i < read; ++i) {
             if (ir[i].EventType == KEY_EVENT && ir[i].Event.KeyEvent.bKeyDown) {
+                needsRedraw = true;
                 WORD vk = ir[i].Event.KeyEvent.wVirtualKeyCode;
                 
                 switch (vk) {
@@ -535,34 +1228,46 @@ private:
                         // Toggle views
                         if (state == AppState::PROCESS_LIST) {
                             state = AppState::SERVICE_LIST;
-                            RefreshData(true);
+                            collector.SetWantServices(true);
                         }
                         else if (state == AppState::SERVICE_LIST) {
                             state = AppState::PROCESS_LIST;
-                            RefreshData(true);
+                            collector.SetWantServices(false);
+                            collector.Wake();
                         }
                         selectedIndex = 0;
                         scrollOffset = 0;
                         break;
                     case VK_RETURN:
                         if (state == AppState::PROCESS_LIST) {
+                            const auto& processes = snapshot->processes;
                             if (selectedIndex >= 0 && selectedIndex < processes.size()) {
                                 selectedPid = processes[selectedIndex].pid;
-                                modules = monitor.GetProcessModules(selectedPid);
+                                moduleRequest = collector.RequestModules(selectedPid);
                                 state = AppState::MODULE_VIEW;
                                 selectedIndex = 0;
                                 scrollOffset = 0;
                             }
                         }
                         break;
+                    case 'S':
+                        // Cycle process ordering: memory -> CPU -> I/O
+                        if (state == AppState::PROCESS_LIST) {
+                            if (processSort == ProcessSort::MEMORY) processSort = ProcessSort::CPU;
+                            else if (processSort == ProcessSort::CPU) processSort = ProcessSort::IO;
+                            else processSort = ProcessSort::MEMORY;
+                            collector.SetProcessSort(processSort);
+                        }
+                        break;
                     case VK_DELETE:
                         if (state == AppState::PROCESS_LIST) {
+                            const auto& processes = snapshot->processes;
                             if (selectedIndex >= 0 && selectedIndex < processes.size()) {
                                 DWORD pid = processes[selectedIndex].pid;
                                 std::wstring name = processes[selectedIndex].name;
-                                monitor.KillProcess(pid);
+                                SystemMonitor::KillProcess(pid);
                                 g_Logger.Log(LogLevel::WARNING, L"User requested kill for: " + name);
-                                RefreshData(true); // Force update
+                                collector.Wake(); // Force update
                             }
                         }
                         break;
@@ -570,53 +1275,53 @@ private:
             }
             else if (ir[i].EventType == WINDOW_BUFFER_SIZE_EVENT) {
                 ui.UpdateSize();
+                needsRedraw = true;
             }
         }
     }
 
     int GetItemCount() {
         switch(state) {
-            case AppState::PROCESS_LIST: return (int)processes.size();
-            case AppState::SERVICE_LIST: return (int)services.size();
-            case AppState::MODULE_VIEW: return (int)modules.size();
+            case AppState::PROCESS_LIST: return (int)snapshot->processes.size();
+            case AppState::SERVICE_LIST: return (int)snapshot->services.size();
+            case AppState::MODULE_VIEW: return ModulesReady() ? (int)snapshot->modules.size() : 0;
             default: return 0;
         }
     }
 
-    void RefreshData(bool force = false) {
-        auto now = std::chrono::steady_clock::now();
-        if (force || std::chrono::duration_cast<std::chrono::milliseconds>(now - lastUpdate).count() > updateIntervalMs) {
-            
-            // Only update process list if we are viewing it (heavy op)
-            if (state == AppState::PROCESS_LIST) {
-                 // Try to keep selection stable by finding PID
-                 DWORD currentPid = 0;
-                 if (selectedIndex < processes.size()) currentPid = processes[selectedIndex].pid;
-
-                 processes = monitor.EnumProcesses();
-                 
-                 // Restore selection
-                 if (currentPid != 0) {
-                     bool found = false;
-                     for(int i=0; i<processes.size(); i++) {
-                         if (processes[i].pid == currentPid) {
-                             selectedIndex = i;
-                             found = true;
-                             break;
-                         }
-                     }
-                     if (!found) selectedIndex = 0;
-                 }
-            } else if (state == AppState::SERVICE_LIST) {
-                services = monitor.EnumServices();
-            }
+    bool ModulesReady() const {
+        return snapshot->moduleRequest == moduleRequest && snapshot->modulesPid == selectedPid;
+    }
 
-            lastUpdate = now;
+    // Swaps in the newest published snapshot, if any; never waits on the collector
+    void UpdateData() {
+        // Try to keep selection stable by finding PID
+        DWORD currentPid = 0;
+        if (selectedIndex < snapshot->processes.size()) currentPid = snapshot->processes[selectedIndex].pid;
+
+        if (!snapshots.Acquire()) return;
+        snapshot = &snapshots.Front();
+        needsRedraw = true;
+
+        // Restore selection
+        if (state == AppState::PROCESS_LIST && currentPid != 0) {
+            int row = snapshot->FindProcessRow(currentPid);
+            selectedIndex = row >= 0 ? row : 0;
         }
     }
 
-    void UpdateData() {
-        RefreshData();
+    // Formats into the shared scratch buffer and writes the result
+    void Print(int x, int y, WORD attr, const wchar_t* format, ...) {
+        va_list args;
+        va_start(args, format);
+        int len = vswprintf(text, sizeof(text) / sizeof(text[0]), format, args);
+        va_end(args);
+        if (len > 0) ui.WriteN(x, y, text, len, attr);
+    }
+
+    void PrintBytes(int x, int y, WORD attr, SIZE_T bytes) {
+        int len = Utils::FormatBytes(text, sizeof(text) / sizeof(text[0]), bytes);
+        ui.WriteN(x, y, text, len, attr);
     }
 
     void Draw() {
@@ -626,7 +1331,7 @@ private:
 
         // 1. Draw Header
         ui.DrawBox(0, 0, w, 3);
-        ui.Write(2, 1, L"WinSysMon v1.0 | Tabs: Switch View | Enter: Details | Del: Kill Process | Esc: Back/Exit", FOREGROUND_GREEN | FOREGROUND_INTENSITY);
+        ui.Write(2, 1, L"WinSysMon v1.0 | Tabs: Switch View | Enter: Details | Del: Kill Process | S: Sort | Esc: Back/Exit", FOREGROUND_GREEN | FOREGROUND_INTENSITY);
         
         // 2. Draw System Stats
         DrawSystemStats();
@@ -647,37 +1352,47 @@ private:
     }
 
     void DrawSystemStats() {
-        double cpu = monitor.GetCpuUsage();
-        DWORD memLoad; SIZE_T totMem, availMem;
-        monitor.GetMemoryStatus(memLoad, totMem, availMem);
+        SIZE_T totMem = snapshot->totalMem, availMem = snapshot->availMem;
 
-        std::wstringstream ss;
-        ss << L" CPU Usage: " << std::fixed << std::setprecision(1) << cpu << L"% ";
-        ui.Write(2, 4, ss.str(), FOREGROUND_RED | FOREGROUND_INTENSITY);
+        Print(2, 4, FOREGROUND_RED | FOREGROUND_INTENSITY, L" CPU Usage: %.1f%% ", snapshot->cpuUsage);
 
-        ss.str(L"");
-        ss << L" Memory: " << memLoad << L"% (" << Utils::FormatBytes(totMem - availMem) << L" / " << Utils::FormatBytes(totMem) << L") ";
-        ui.Write(30, 4, ss.str(), FOREGROUND_CYAN | FOREGROUND_INTENSITY);
+        wchar_t used[32], total[32];
+        Utils::FormatBytes(used, 32, totMem - availMem);
+        Utils::FormatBytes(total, 32, totMem);
+        Print(30, 4, FOREGROUND_CYAN | FOREGROUND_INTENSITY, L" Memory: %lu%% (%ls / %ls) ", (unsigned long)snapshot->memLoad, used, total);
         
-        std::wstring modeStr = L" MODE: ";
-        if (state == AppState::PROCESS_LIST) modeStr += L"PROCESSES";
-        else if (state == AppState::SERVICE_LIST) modeStr += L"SERVICES";
-        else if (state == AppState::MODULE_VIEW) modeStr += L"MODULES (PID " + std::to_wstring(selectedPid) + L")";
+        int len = 0;
+        const size_t cap = sizeof(text) / sizeof(text[0]);
+        if (state == AppState::PROCESS_LIST) {
+            const wchar_t* order = L"MEMORY";
+            if (snapshot->processSort == ProcessSort::CPU) order = L"CPU";
+            else if (snapshot->processSort == ProcessSort::IO) order = L"I/O";
+            len = swprintf(text, cap, L" MODE: PROCESSES by %ls", order);
+        }
+        else if (state == AppState::SERVICE_LIST) len = swprintf(text, cap, L" MODE: SERVICES");
+        else if (state == AppState::MODULE_VIEW) len = swprintf(text, cap, L" MODE: MODULES (PID %lu)", (unsigned long)selectedPid);
 
-        ui.Write(ui.GetWidth() - (int)modeStr.length() - 2, 4, modeStr, FOREGROUND_YELLOW | FOREGROUND_INTENSITY);
+        if (len > 0) ui.WriteN(ui.GetWidth() - len - 2, 4, text, len, FOREGROUND_YELLOW | FOREGROUND_INTENSITY);
     }
 
     void DrawProcessList(int x, int y, int w, int h) {
         // Header
         ui.Write(x + 1, y, L"PID", FOREGROUND_INTENSITY);
         ui.Write(x + 8, y, L"Name", FOREGROUND_INTENSITY);
-        ui.Write(x + 40, y, L"Threads", FOREGROUND_INTENSITY);
-        ui.Write(x + 50, y, L"Memory", FOREGROUND_INTENSITY);
-        ui.Write(x + 65, y, L"Priority", FOREGROUND_INTENSITY);
-        ui.Write(x, y + 1, std::wstring(w, L'-'), FOREGROUND_INTENSITY);
+        ui.Write(x + 34, y, L"CPU%", FOREGROUND_INTENSITY);
+        ui.Write(x + 41, y, L"Threads", FOREGROUND_INTENSITY);
+        ui.Write(x + 49, y, L"Handles", FOREGROUND_INTENSITY);
+        ui.Write(x + 58, y, L"Memory", FOREGROUND_INTENSITY);
+        ui.Write(x + 70, y, L"Read/s", FOREGROUND_INTENSITY);
+        ui.Write(x + 82, y, L"Write/s", FOREGROUND_INTENSITY);
+        ui.Write(x + 94, y, L"Pri", FOREGROUND_INTENSITY);
+        ui.Write(x + 99, y, L"CPU History", FOREGROUND_INTENSITY);
+        ui.Fill(x, y + 1, w, L'-', FOREGROUND_INTENSITY);
 
         int startY = y + 2;
         int listCapacity = h - 2;
+        const auto& processes = snapshot->processes;
+        ProcessHistory history;
 
         for (int i = 0; i < listCapacity; ++i) {
             int idx = scrollOffset + i;
@@ -686,28 +1401,50 @@ private:
             const auto& p = processes[idx];
             WORD attr = (idx == selectedIndex) ? (BACKGROUND_GREEN | FOREGROUND_BLACK) : (FOREGROUND_WHITE);
 
-            std::wstring line = std::wstring(w, L' '); // Clear line background
-            ui.Write(x, startY + i, line, attr);
+            ui.Fill(x, startY + i, w, L' ', attr); // Clear line background
 
-            std::wstringstream ss;
-            
             // PID
-            ss << p.pid;
-            ui.Write(x + 1, startY + i, ss.str(), attr);
+            Print(x + 1, startY + i, attr, L"%lu", (unsigned long)p.pid);
             
             // Name
-            std::wstring name = p.name;
-            if (name.length() > 30) name = name.substr(0, 27) + L"...";
-            ui.Write(x + 8, startY + i, name, attr);
+            ui.WriteTruncated(x + 8, startY + i, p.name, 25, attr);
 
-            // Threads
-            ui.Write(x + 40, startY + i, std::to_wstring(p.threadCount), attr);
+            // CPU
+            Print(x + 34, startY + i, attr, L"%.1f", p.cpuPercent);
+
+            // Threads / Handles
+            Print(x + 41, startY + i, attr, L"%lu", (unsigned long)p.threadCount);
+            Print(x + 49, startY + i, attr, L"%lu", (unsigned long)p.handleCount);
 
             // Memory
-            ui.Write(x + 50, startY + i, Utils::FormatBytes(p.workingSetSize), attr);
+            PrintBytes(x + 58, startY + i, attr, p.workingSetSize);
+
+            // I/O
+            PrintBytes(x + 70, startY + i, attr, (SIZE_T)p.readRate);
+            PrintBytes(x + 82, startY + i, attr, (SIZE_T)p.writeRate);
 
             // Priority
-            ui.Write(x + 65, startY + i, std::to_wstring(p.priorityClass), attr);
+            Print(x + 94, startY + i, attr, L"%lu", (unsigned long)p.priorityClass);
+
+            if (histories.Read(p.historySlot, p.historyStamp, history)) {
+                DrawSparkline(x + 99, startY + i, std::min(16, w - 99), history, attr);
+            }
+        }
+    }
+
+    // Newest sample on the right, scaled to the largest CPU value shown
+    void DrawSparkline(int x, int y, int width, const ProcessHistory& history, WORD attr) {
+        int n = std::min(width, history.count);
+        if (n <= 0) return;
+
+        float peak = 1.0f;
+        for (int ago = 0; ago < n; ++ago) peak = std::max(peak, history.cpu[history.Slot(ago)]);
+
+        for (int ago = 0; ago < n; ++ago) {
+            float v = history.cpu[history.Slot(ago)];
+            if (v <= 0.0f) continue;
+            int level = std::min(7, (int)(v / peak * 8.0f));
+            ui.Put(x + width - 1 - ago, y, (WCHAR)(0x2581 + level), attr);
         }
     }
 
@@ -715,10 +1452,16 @@ private:
         ui.Write(x + 1, y, L"Status", FOREGROUND_INTENSITY);
         ui.Write(x + 10, y, L"Service Name", FOREGROUND_INTENSITY);
         ui.Write(x + 45, y, L"Display Name", FOREGROUND_INTENSITY);
-        ui.Write(x, y + 1, std::wstring(w, L'-'), FOREGROUND_INTENSITY);
+        ui.Fill(x, y + 1, w, L'-', FOREGROUND_INTENSITY);
 
         int startY = y + 2;
         int listCapacity = h - 2;
+        const auto& services = snapshot->services;
+
+        if (!snapshot->servicesValid) {
+             ui.Write(x + 1, startY, L"Loading services...", FOREGROUND_INTENSITY);
+             return;
+        }
 
         for (int i = 0; i < listCapacity; ++i) {
             int idx = scrollOffset + i;
@@ -728,23 +1471,16 @@ private:
             WORD attr = (idx == selectedIndex) ? (BACKGROUND_GREEN | FOREGROUND_BLACK) : (FOREGROUND_WHITE);
             WORD statusAttr = attr;
             
-            std::wstring statusStr = (s.status == SERVICE_RUNNING) ? L"RUNNING" : L"STOPPED";
+            const wchar_t* statusStr = (s.status == SERVICE_RUNNING) ? L"RUNNING" : L"STOPPED";
             if (idx != selectedIndex) {
                  statusAttr = (s.status == SERVICE_RUNNING) ? FOREGROUND_GREEN : FOREGROUND_RED;
             }
 
-            std::wstring line = std::wstring(w, L' ');
-            ui.Write(x, startY + i, line, attr);
+            ui.Fill(x, startY + i, w, L' ', attr);
 
             ui.Write(x + 1, startY + i, statusStr, statusAttr);
-            
-            std::wstring sName = s.serviceName;
-            if (sName.length() > 33) sName = sName.substr(0, 30) + L"...";
-            ui.Write(x + 10, startY + i, sName, attr);
-
-            std::wstring dName = s.displayName;
-            if (dName.length() > 40) dName = dName.substr(0, 37) + L"...";
-            ui.Write(x + 45, startY + i, dName, attr);
+            ui.WriteTruncated(x + 10, startY + i, s.serviceName, 33, attr);
+            ui.WriteTruncated(x + 45, startY + i, s.displayName, 40, attr);
         }
     }
 
@@ -753,10 +1489,16 @@ private:
         ui.Write(x + 30, y, L"Base Address", FOREGROUND_INTENSITY);
         ui.Write(x + 50, y, L"Size", FOREGROUND_INTENSITY);
         ui.Write(x + 65, y, L"Path", FOREGROUND_INTENSITY);
-        ui.Write(x, y + 1, std::wstring(w, L'-'), FOREGROUND_INTENSITY);
+        ui.Fill(x, y + 1, w, L'-', FOREGROUND_INTENSITY);
 
         int startY = y + 2;
         int listCapacity = h - 2;
+        const auto& modules = snapshot->modules;
+
+        if (!ModulesReady()) {
+             ui.Write(x + 1, startY, L"Loading modules...", FOREGROUND_INTENSITY);
+             return;
+        }
 
         if (modules.empty()) {
              ui.Write(x + 1, startY, L"No modules found or access denied.", FOREGROUND_RED);
@@ -770,20 +1512,12 @@ private:
             const auto& m = modules[idx];
             WORD attr = (idx == selectedIndex) ? (BACKGROUND_GREEN | FOREGROUND_BLACK) : (FOREGROUND_WHITE);
 
-            std::wstring line = std::wstring(w, L' ');
-            ui.Write(x, startY + i, line, attr);
+            ui.Fill(x, startY + i, w, L' ', attr);
 
             ui.Write(x + 1, startY + i, m.moduleName, attr);
-            
-            std::wstringstream ssAddr;
-            ssAddr << L"0x" << std::hex << (uintptr_t)m.hModule;
-            ui.Write(x + 30, startY + i, ssAddr.str(), attr);
-
-            ui.Write(x + 50, startY + i, Utils::FormatBytes(m.size), attr);
-
-            std::wstring path = m.modulePath;
-            if (path.length() > 40) path = L"..." + path.substr(path.length() - 37);
-            ui.Write(x + 65, startY + i, path, attr);
+            Print(x + 30, startY + i, attr, L"0x%llx", (unsigned long long)(uintptr_t)m.hModule);
+            PrintBytes(x + 50, startY + i, attr, m.size);
+            ui.WriteTruncated(x + 65, startY + i, m.modulePath, 40, attr, true);
         }
     }
 
@@ -791,9 +1525,10 @@ private:
         ui.DrawBox(x, y, w, h);
         ui.Write(x + 2, y, L" Event Log ", FOREGROUND_MAGENTA | FOREGROUND_INTENSITY);
 
-        auto logs = g_Logger.GetRecentLogs(h - 2);
+        drawnLogVersion = g_Logger.Version();
+        g_Logger.GetRecentLogs(recentLogs, h - 2);
         int currentY = y + 1;
-        for (const auto& log : logs) {
+        for (const auto& log : recentLogs) {
             WORD color = FOREGROUND_WHITE;
             if (log.level == LogLevel::ERR) color = FOREGROUND_RED;
             if (log.level == LogLevel::WARNING) color = FOREGROUND_YELLOW;
@@ -802,13 +1537,11 @@ private:
             auto tt = std::chrono::system_clock::to_time_t(log.timestamp);
             struct tm tm; 
             localtime_s(&tm, &tt);
-            char timeBuf[10];
-            std::strftime(timeBuf, sizeof(timeBuf), "%H:%M:%S", &tm);
-            
-            std::string tb(timeBuf);
-            std::wstring wTime(tb.begin(), tb.end());
+            wchar_t timeBuf[16];
+            std::wcsftime(timeBuf, 16, L"[%H:%M:%S] ", &tm);
 
-            ui.Write(x + 1, currentY++, L"[" + wTime + L"] " + log.message, color);
+            ui.Write(x + 1, currentY, timeBuf, color);
+            ui.Write(x + 12, currentY++, log.message, color);
         }
     }
 };